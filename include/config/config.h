@@ -7,6 +7,14 @@
 #include <stdint.h>
 #include <wayland-server-core.h>
 
+enum config_cpu_group_id {
+    CPU_GROUP_ACTIVE,
+    CPU_GROUP_BACKGROUND,
+    CPU_GROUP_TITLE,
+    CPU_GROUP_HELPERS,
+    CPU_GROUP_COUNT,
+};
+
 struct config {
     struct {
         bool debug;
@@ -65,6 +73,13 @@ struct config {
         size_t count;
     } shaders;
 
+    struct config_cpu_group {
+        bool enabled;
+        uint64_t cores; // bitmask of allowed cores, 0 for all cores
+        int nice;
+        bool idle; // use SCHED_IDLE
+    } cpu[CPU_GROUP_COUNT];
+
     struct config_vm *vm;
 };
 
@@ -101,7 +116,9 @@ struct config_shader {
 
 struct config *config_create();
 void config_destroy(struct config *cfg);
+void config_apply_env(struct config *cfg);
 ssize_t config_find_action(struct config *cfg, const struct config_action *action);
+int config_find_cpu_group(const char *name);
 int config_load(struct config *cfg, const char *profile);
 int config_parse_remap(const char *src, const char *dst, struct config_remap *remap);
 /**
@@ -6,6 +6,7 @@
 #include <stdint.h>
 
 int config_api_init(struct config_vm *vm);
+int config_cache_load(lua_State *L, const char *path);
 
 void config_dump_stack(lua_State *L);
 int config_parse_hex(uint8_t rgba[static 4], const char *raw);
@@ -16,6 +16,7 @@ struct config_vm {
 
     char *profile;
     struct wl_list wakers; // config_vm_waker.link
+    struct wl_list env;    // config_vm_env.link, queued by config_vm_set_env
 };
 
 struct wrap;
@@ -26,10 +27,12 @@ void config_vm_destroy(struct config_vm *vm);
 struct config_vm *config_vm_from(lua_State *L);
 struct wrap *config_vm_get_wrap(struct config_vm *vm);
 void config_vm_set_wrap(struct config_vm *vm, struct wrap *wrap);
+void config_vm_set_env(struct config_vm *vm, const char *name, const char *value);
 void config_vm_set_profile(struct config_vm *vm, const char *profile);
 
 struct config_vm_waker *config_vm_create_waker(lua_State *L, config_vm_waker_destroy_func_t destroy,
                                                void *data);
+void config_vm_apply_env(struct config_vm *vm);
 int config_vm_exec_bcode(struct config_vm *vm, const unsigned char *bc, size_t bc_size,
                          const char *bc_name);
 bool config_vm_is_thread(lua_State *L);
@@ -42,5 +45,6 @@ void config_vm_signal_event(struct config_vm *vm, const char *name);
 bool config_vm_try_action(struct config_vm *vm, size_t index);
 bool config_vm_try_callback_arg(struct config_vm *vm);
 bool config_vm_try_callback_args2(struct config_vm *vm);
+bool config_vm_try_callback_argn(struct config_vm *vm, int nargs);
 
 #endif
@@ -0,0 +1,10 @@
+#ifndef WAYWALL_CPU_H
+#define WAYWALL_CPU_H
+
+#include <sys/types.h>
+
+struct config_cpu_group;
+
+int cpu_apply(pid_t pid, const struct config_cpu_group *group);
+
+#endif
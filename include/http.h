@@ -2,46 +2,50 @@
 #define HTTP_H
 #include "lua.h"
 #include <curl/curl.h>
-#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
 
-#define MAX_CLIENTS 8
-#define MAX_QUEUED_RESPONSES 256
-#define MAX_RESPONSE_LENGTH 8192
+#define HTTP_MAX_TIMEOUT_MS (24 * 60 * 60 * 1000)
 
-struct queued_response {
-    char *data;
-    size_t size;
-    char *url;
-};
+struct http_engine;
+
+struct http_request_options {
+    const char *url;
+    const char *method; // NULL for GET, or POST if a body is given
+
+    const char *const *headers; // "Name: value" strings
+    size_t headers_len;
+
+    const char *body; // NULL for no body
+    size_t body_len;
 
-struct response_queue {
-    struct queued_response *responses[MAX_QUEUED_RESPONSES];
-    int write_pos;
-    int read_pos;
+    long timeout_ms; // 0 for the default timeout
+    int callback;    // per-request callback (owned by the request), or LUA_NOREF
+
+    bool stream; // deliver the body to Lua in chunks as it arrives
+    bool json;   // decode the body as JSON into a Lua table
+    bool cache;  // revalidate against (and store the response in) the on-disk cache
 };
 
 struct Http_client {
-    CURL *curl;
-    int callback;
-    int index;
-    pthread_t thread_id;
-    bool thread_running;
-    struct response_queue response_queue;
-    pthread_mutex_t queue_mutex;
-    pthread_mutex_t request_mutex;
+    struct http_engine *engine; // NULL once the event loop has been destroyed
+    struct wl_list link;        // http_engine.clients
+
+    int callback; // LUA_NOREF if every request must provide its own callback
     struct config_vm *vm;
 
-    char *pending_requests[MAX_QUEUED_RESPONSES];
-    int request_write_pos;
-    int request_read_pos;
-    pthread_cond_t request_cond;
-    bool should_exit;
+    struct wl_list requests; // http_request.link
+
+    struct {
+        // A revalidation is counted whenever a cached entry is sent with its validators. Each one
+        // ends in either a hit (304) or a miss, along with any cacheable request with no entry.
+        uint64_t hits, revalidations, misses;
+    } cache;
 };
 
-struct Http_client *http_client_create(int callback, lua_State *L);
-void manage_new_responses();
-void http_client_get(struct Http_client *client, const char *url);
+struct Http_client *http_client_create(struct wl_event_loop *loop, int callback, lua_State *L);
+void http_client_request(struct Http_client *client, const struct http_request_options *options);
 void http_client_destroy(struct Http_client *client);
 
 #endif
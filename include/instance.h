@@ -1,11 +1,15 @@
 #ifndef WAYWALL_INSTANCE_H
 #define WAYWALL_INSTANCE_H
 
-#include "inotify.h"
 #include "util/str.h"
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <sys/types.h>
+#include <wayland-server-core.h>
+
+#define INSTANCE_HISTORY_LEN 32
 
 struct instance {
     char *dir;
@@ -31,12 +35,59 @@ struct instance {
         } data;
     } state;
 
+    // The most recent state transitions, so that none are lost between reads from Lua.
+    struct {
+        struct instance_transition {
+            struct instance_state old, new;
+            int64_t time_ns; // CLOCK_MONOTONIC
+        } entries[INSTANCE_HISTORY_LEN];
+        uint64_t count; // total number of transitions recorded
+    } history;
+
+    struct {
+        uint64_t events;  // inotify events received for the state file
+        uint64_t reads;   // reads of the state file
+        uint64_t changes; // reads which produced a state transition
+    } stats;
+
+    struct server_view *view;
+};
+
+typedef void (*instance_detect_func_t)(struct server_view *view, struct instance *instance,
+                                       void *data);
+
+/*
+ * Instance detection checks the game directory of a view (as returned by instance_get_dir)
+ * immediately, and then scans its mods for state output on a worker thread. The callback is
+ * invoked on the main thread once the scan has finished, with a NULL instance if the game does not
+ * have state output.
+ */
+struct instance_detect {
     struct server_view *view;
+    char *dir;
+
+    instance_detect_func_t func;
+    void *data;
+
+    pthread_t thread;
+    atomic_bool cancel;
+    int done_fd; // eventfd, written by the worker thread once it has finished
+    struct wl_event_source *src;
+
+    int ret;          // written by the worker thread
+    bool stateoutput; // written by the worker thread
 };
 
-struct instance *instance_create(struct server_view *view, struct inotify *inotify);
+char *instance_get_dir(struct server_view *view);
+struct instance_detect *instance_detect_create(struct server_view *view, const char *dir,
+                                               struct wl_event_loop *loop,
+                                               instance_detect_func_t func, void *data);
+void instance_detect_destroy(struct instance_detect *detect);
+
 void instance_destroy(struct instance *instance);
 str instance_get_state_path(struct instance *instance);
-void instance_state_update(struct instance *instance);
+size_t instance_get_history(struct instance *instance, const struct instance_transition **out,
+                            size_t max);
+bool instance_state_update(struct instance *instance);
 
 #endif
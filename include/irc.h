@@ -2,35 +2,106 @@
 #define IRC_H
 
 #include "lua.h"
+#include "util/list.h"
+#include "util/spsc.h"
 #include <libircclient/libircclient.h>
 #include <pthread.h>
+#include <regex.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
 
 #define MAX_CLIENTS 8
 #define MAX_QUEUED_MESSAGES 64
 #define MAX_MESSAGE_LENGTH 1024
+#define MAX_QUEUED_SENDS 256
 
-struct message_queue {
-    char *messages[MAX_QUEUED_MESSAGES];
-    int write_pos;
-    int read_pos;
+// The default send rate matches Twitch's limit for regular users.
+#define DEFAULT_SEND_LIMIT 20
+#define DEFAULT_SEND_PERIOD 30.0
+
+#define RECONNECT_MIN_SECONDS 1
+#define RECONNECT_MAX_SECONDS 60
+
+struct irc_filter {
+    int id;
+    char *command; // NULL to match any command
+    char *channel; // NULL to match any channel (first parameter)
+
+    bool has_pattern;
+    regex_t pattern; // matched against the message text (last parameter)
+};
+
+LIST_DEFINE(struct irc_filter *, list_irc_filter);
+
+struct irc_filter_options {
+    const char *command, *channel, *pattern;
+};
+
+struct irc_client_options {
+    bool parsed; // deliver messages as tables rather than flattened strings
+
+    // At most send_limit messages are sent in any send_period seconds.
+    int send_limit;
+    double send_period;
 };
 
 struct Irc_client {
-    irc_session_t *session;
+    irc_session_t *session; // owned by the worker thread, NULL while not connected
     int callback;
     int index;
     pthread_t thread_id;
     bool thread_running;
-    struct message_queue message_queue;
-    pthread_mutex_t queue_mutex;
+    bool thread_done; // set by the worker thread once it has finished with the client
+
+    char *ip, *nick, *pass;
+    long port;
+
+    // Guards session, should_exit, thread_done, and the send queues against the worker thread.
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool should_exit;
+    bool registered; // worker thread only
+
+    // Messages sent from Lua are queued and written by the worker thread, which also applies the
+    // rate limit. The outcome of each send is then passed back through the completed list.
+    struct wl_list outbound;  // irc_outbound.link
+    struct wl_list completed; // irc_outbound.link
+    int outbound_len;
+    struct irc_outbound *sending; // removed from outbound but not yet completed, or NULL
+    uint64_t next_send_id;    // main thread only
+    int send_fd;              // wakes the worker thread
+
+    struct {
+        double tokens, rate, burst;
+        struct timespec last;
+    } bucket; // worker thread only
+
+    struct spsc_ring *messages; // struct irc_message *
     struct config_vm *vm;
+    bool parsed;
+
+    // Messages from the server are only delivered to Lua if they match at least one filter (or if
+    // there are no filters). The filters are checked on the worker thread.
+    pthread_mutex_t filter_mutex;
+    struct list_irc_filter filters;
+    int next_filter_id;
+    uint64_t filtered; // worker thread only
+
+    int wake_fd;
+    struct wl_event_source *src;
+    struct wl_listener on_loop_destroy;
+
+    bool *destroyed; // set while messages are being delivered to Lua
 };
 
-struct Irc_client *irc_client_create(const char *ip, long port, const char *nick, const char *pass,
-                                     int callback, lua_State *L);
-void manage_new_messages();
-void irc_client_send(struct Irc_client *client, const char *message);
+struct Irc_client *irc_client_create(struct wl_event_loop *loop, const char *ip, long port,
+                                     const char *nick, const char *pass, int callback,
+                                     const struct irc_client_options *options, lua_State *L);
+int irc_client_add_filter(struct Irc_client *client, const struct irc_filter_options *options);
+bool irc_client_remove_filter(struct Irc_client *client, int id);
+uint64_t irc_client_send(struct Irc_client *client, const char *message, const char *coalesce_key,
+                         int callback);
 void irc_client_destroy(struct Irc_client *client);
 
 #endif
\ No newline at end of file
@@ -4,7 +4,10 @@
 #include "config/config.h"
 #include "util/list.h"
 #include "util/str.h"
+#include <pthread.h>
+#include <stdbool.h>
 #include <sys/types.h>
+#include <wayland-server-core.h>
 
 typedef void (*reload_func_t)(struct config *cfg, void *data);
 
@@ -21,10 +24,24 @@ struct reload {
     struct list_int config_wd;
 
     struct ww_timer_entry *timer_entry;
+
+    // The new configuration is compiled on a separate thread so that the compositor can continue
+    // processing input and frames. The worker signals `fd` (an eventfd) once it has finished.
+    struct {
+        pthread_t thread;
+        bool running, pending;
+
+        int fd;
+        struct wl_event_source *src;
+
+        struct config *cfg;
+        double elapsed_ms;
+    } worker;
 };
 
-struct reload *reload_create(struct inotify *inotify, struct ww_timer *timer, const char *profile,
-                             reload_func_t callback, void *data);
+struct reload *reload_create(struct wl_event_loop *loop, struct inotify *inotify,
+                             struct ww_timer *timer, const char *profile, reload_func_t callback,
+                             void *data);
 void reload_destroy(struct reload *rl);
 void reload_disable(struct reload *rl);
 
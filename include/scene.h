@@ -5,6 +5,7 @@
 #include "util/box.h"
 #include <GLES2/gl2.h>
 #include <ft2build.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/types.h>
@@ -18,6 +19,8 @@
 #define SHADER_SRC_RGBA_ATTRIB_LOC 2
 #define SHADER_DST_RGBA_ATTRIB_LOC 3
 
+#define SCENE_WALL_MAX_TILES 64
+
 // represents a single character to draw, with color
 struct text_char {
     uint32_t c;    // utf8 codepoint
@@ -62,6 +65,13 @@ struct Custom_atlas {
     u_int32_t width;
 };
 
+// The scene's view of a single Minecraft instance, used to draw walls.
+struct scene_instance {
+    int index;
+    struct server_gl_capture *capture;
+    int percent; // world generation progress, or -1 if no world is generating
+};
+
 struct scene {
     struct server_gl *gl;
     struct server_ui *ui;
@@ -80,6 +90,13 @@ struct scene {
         unsigned int stencil_rect;
     } buffers;
 
+    GLuint white_texture; // 1x1, used to draw solid colors with the color key shader
+
+    struct {
+        struct scene_instance *data;
+        size_t len;
+    } instances;
+
     struct {
         int32_t width, height;
         int32_t tex_width, tex_height;
@@ -92,11 +109,18 @@ struct scene {
         struct wl_list unsorted_images;  // scene_object.link
         struct wl_list unsorted_mirrors; // scene_object.link
         struct wl_list unsorted_text;    // scene_object.link
+        struct wl_list unsorted_walls;   // scene_object.link
     } objects;
 
     int skipped_frames;
 
     struct wl_listener on_gl_frame;
+    struct wl_listener on_gl_capture_commit;
+    struct wl_event_source *redraw_idle; // pending redraw for a non-active capture, or NULL
+
+    struct {
+        struct wl_signal frame; // data: NULL
+    } events;
 
     struct {
         FT_Library ft;
@@ -143,6 +167,20 @@ struct scene_mirror_options {
 
     int32_t depth;
     char *shader_name;
+
+    struct server_gl_capture *capture; // NULL to mirror the active instance
+};
+
+struct scene_wall_options {
+    struct box dst;
+    int32_t rows, cols;
+    int32_t gap;
+
+    float lock_rgba[4];     // drawn over locked tiles, ignored if transparent
+    float progress_rgba[4]; // world generation progress bar, ignored if transparent
+
+    int32_t depth;
+    char *shader_name;
 };
 
 struct scene_text_options {
@@ -172,6 +210,13 @@ struct scene_mirror *scene_add_mirror(struct scene *scene,
                                       const struct scene_mirror_options *options);
 struct scene_text *scene_add_text(struct scene *scene, const char *data,
                                   const struct scene_text_options *options);
+struct scene_wall *scene_add_wall(struct scene *scene, const struct scene_wall_options *options);
+int scene_wall_set_locked(struct scene_wall *wall, int index, bool locked);
+int scene_wall_get_locked(struct scene_wall *wall, int index, bool *locked);
+
+void scene_set_instance(struct scene *scene, int index, struct server_gl_capture *capture,
+                        int percent);
+void scene_remove_instance(struct scene *scene, int index);
 struct Custom_atlas *scene_create_atlas(struct scene *scene, const uint32_t width, const char *data,
                                         size_t len);
 void scene_atlas_raw_image(struct scene *scene, struct Custom_atlas *atlas, const char *data,
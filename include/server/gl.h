@@ -44,21 +44,35 @@ struct server_gl {
         EGLSurface egl;
     } surface;
 
-    struct {
-        struct server_surface *surface;
-        struct wl_list buffers; // gl_buffer.link
-        struct gl_buffer *current;
-    } capture;
+    struct wl_list captures;           // server_gl_capture.link
+    struct server_gl_capture *capture; // active capture, may be NULL
 
-    struct wl_listener on_surface_commit;
-    struct wl_listener on_surface_destroy;
     struct wl_listener on_ui_resize;
 
     struct {
-        struct wl_signal frame; // data: NULL
+        struct wl_signal frame;          // data: NULL, on commits of the active capture
+        struct wl_signal capture_commit; // data: struct server_gl_capture *, for other captures
     } events;
 };
 
+/*
+ * A capture imports the buffers committed to a single surface as OpenGL textures. Captures are
+ * reference counted so that scene objects can keep one around after its surface is destroyed, at
+ * which point it no longer has a texture.
+ */
+struct server_gl_capture {
+    struct wl_list link; // server_gl.captures
+    struct server_gl *gl;
+    int refcount;
+
+    struct server_surface *surface; // NULL once the surface has been destroyed
+    struct wl_list buffers;         // gl_buffer.link
+    struct gl_buffer *current;
+
+    struct wl_listener on_surface_commit;
+    struct wl_listener on_surface_destroy;
+};
+
 struct server_gl_shader {
     GLuint vert, frag;
     GLuint program;
@@ -73,9 +87,17 @@ struct server_gl_shader *server_gl_compile(struct server_gl *gl, const char *ver
                                            const char *fragment);
 GLuint server_gl_get_capture(struct server_gl *gl);
 void server_gl_get_capture_size(struct server_gl *gl, int32_t *width, int32_t *height);
-void server_gl_set_capture(struct server_gl *gl, struct server_surface *surface);
+void server_gl_set_capture(struct server_gl *gl, struct server_gl_capture *capture);
 void server_gl_swap_buffers(struct server_gl *gl);
 
+struct server_gl_capture *server_gl_capture_create(struct server_gl *gl,
+                                                   struct server_surface *surface);
+struct server_gl_capture *server_gl_capture_ref(struct server_gl_capture *capture);
+void server_gl_capture_unref(struct server_gl_capture *capture);
+GLuint server_gl_capture_get_texture(struct server_gl_capture *capture);
+void server_gl_capture_get_size(struct server_gl_capture *capture, int32_t *width,
+                                int32_t *height);
+
 void server_gl_shader_destroy(struct server_gl_shader *shader);
 void server_gl_shader_use(struct server_gl_shader *shader);
 
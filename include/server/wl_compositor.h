@@ -46,6 +46,15 @@ struct server_surface {
     const struct server_surface_role *role;
     struct wl_resource *role_resource;
 
+    // Frame callbacks are normally forwarded to the host compositor. While throttled, they are
+    // instead completed locally at most `fps` times per second.
+    struct {
+        int32_t fps;                   // 0 if not throttled
+        struct wl_list pending, ready; // server_surface_frame.link
+        struct wl_event_source *timer;
+        int64_t last_done;             // CLOCK_MONOTONIC, in milliseconds
+    } throttle;
+
     struct {
         struct wl_signal commit;  // data: struct server_surface *
         struct wl_signal destroy; // data: struct server_surface *
@@ -67,5 +76,6 @@ struct server_surface *server_surface_try_from_resource(struct wl_resource *reso
 struct server_buffer *server_surface_next_buffer(struct server_surface *surface);
 int server_surface_set_role(struct server_surface *surface, const struct server_surface_role *role,
                             struct wl_resource *role_resource);
+void server_surface_set_frame_rate(struct server_surface *surface, int32_t fps);
 
 #endif
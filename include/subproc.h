@@ -2,10 +2,28 @@
 #define WAYWALL_SUBPROC_H
 
 #include "util/list.h"
+#include <stdbool.h>
+#include <stddef.h>
 #include <sys/types.h>
 
+#define SUBPROC_MAX_LINE 4096
+
 LIST_DEFINE(struct subproc_entry, list_subproc_entry);
 
+typedef void (*subproc_output_func_t)(void *data, bool is_stderr, const char *line, size_t len);
+typedef void (*subproc_exit_func_t)(void *data, int status);
+
+/*
+ * A subprocess's output can be captured line by line. Lines longer than SUBPROC_MAX_LINE bytes are
+ * split. The exit callback is called exactly once unless the capture is detached, with the wait
+ * status of the subprocess or -1 if waywall is exiting before it.
+ */
+struct subproc_capture {
+    subproc_output_func_t output; // NULL if output should not be captured
+    subproc_exit_func_t exit;
+    void *data;
+};
+
 struct subproc {
     struct server *server;
     struct list_subproc_entry entries;
@@ -15,10 +33,21 @@ struct subproc_entry {
     pid_t pid;
     int pidfd;
     struct wl_event_source *pidfd_src;
+
+    struct subproc_capture capture; // zeroed if not captured or detached
+    struct subproc_stream {
+        int fd; // -1 if not captured or already closed
+        struct wl_event_source *src;
+        char *buf; // incomplete line, SUBPROC_MAX_LINE bytes
+        size_t len;
+    } streams[2]; // stdout, stderr
 };
 
 struct subproc *subproc_create(struct server *server);
 void subproc_destroy(struct subproc *subproc);
-void subproc_exec(struct subproc *subproc, char *cmd[static 64]);
+void subproc_detach(struct subproc *subproc, pid_t pid);
+bool subproc_owns(struct subproc *subproc, pid_t pid);
+pid_t subproc_exec(struct subproc *subproc, char *cmd[static 64],
+                   const struct subproc_capture *capture);
 
 #endif
@@ -1,22 +1,36 @@
 #ifndef WAYWALL_TIMER_H
 #define WAYWALL_TIMER_H
 
+#include "util/list.h"
+#include <stdbool.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <wayland-server-core.h>
 
 typedef void (*ww_timer_func_t)(void *data);
 
+LIST_DEFINE(struct ww_timer_entry *, list_timer_entry);
+
 struct ww_timer {
     struct server *server;
     struct wl_list entries; // ww_timer_entry.link
+
+    int fd;
+    struct wl_event_source *src;
+    struct timespec armed;
+    bool firing;
+
+    // Scheduled entries, ordered as a binary min-heap on their deadlines.
+    struct list_timer_entry heap;
 };
 
 struct ww_timer_entry {
     struct wl_list link; // ww_timer.entries
+    struct ww_timer *parent;
 
-    int fd;
-    struct wl_event_source *src;
+    ssize_t heap_index; // -1 if not scheduled
+    struct timespec deadline;
+    struct timespec interval; // zero for one-shot entries
 
     ww_timer_func_t fire, destroy;
     void *data;
@@ -29,6 +43,8 @@ struct ww_timer_entry *ww_timer_add_entry(struct ww_timer *timer, struct timespe
                                           ww_timer_func_t fire, ww_timer_func_t destroy,
                                           void *data);
 void ww_timer_entry_destroy(struct ww_timer_entry *entry);
+int ww_timer_entry_set_deadline(struct ww_timer_entry *entry, struct timespec deadline);
 int ww_timer_entry_set_duration(struct ww_timer_entry *entry, struct timespec duration);
+void ww_timer_entry_set_interval(struct ww_timer_entry *entry, struct timespec interval);
 
 #endif
@@ -0,0 +1,13 @@
+#ifndef WAYWALL_UTIL_CACHE_H
+#define WAYWALL_UTIL_CACHE_H
+
+#include "util/str.h"
+#include <stddef.h>
+
+str util_cache_dir(const char *subdir);
+str util_cache_file(const char *dir, const char *key);
+str util_cache_path(const char *subdir, const char *key);
+char *util_cache_read(const char *path, size_t *len);
+int util_cache_write(const char *path, const void *data, size_t len);
+
+#endif
@@ -41,6 +41,18 @@ extern struct util_debug {
 
         bool fullscreen;
     } ui;
+
+    struct {
+        int active;
+        uint64_t steps;
+
+        int64_t last_lateness_us;
+        int64_t max_lateness_us;
+    } macro;
+
+    struct {
+        uint64_t events, reads, changes;
+    } state;
 } util_debug_data;
 
 bool util_debug_init();
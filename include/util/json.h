@@ -0,0 +1,51 @@
+#ifndef WAYWALL_UTIL_JSON_H
+#define WAYWALL_UTIL_JSON_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define JSON_MAX_DEPTH 512
+
+enum json_type {
+    JSON_NULL,
+    JSON_FALSE,
+    JSON_TRUE,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT,
+};
+
+/*
+ * A parsed JSON document is stored as a flat array of nodes in document order. Each array or
+ * object node records its number of direct children and the index just past its last descendant,
+ * so consumers can size containers up front and skip over subtrees without recursion. Object
+ * children alternate between a key (always a string) and its value.
+ */
+struct json_node {
+    enum json_type type;
+    union {
+        double number;
+        struct {
+            uint32_t offset, len; // into json_doc.strings
+        } string;
+        struct {
+            uint32_t count; // direct children (key/value pairs count as one for objects)
+            uint32_t end;   // index of the first node after this container
+        } container;
+    };
+};
+
+struct json_doc {
+    struct json_node *nodes;
+    size_t len, cap;
+
+    char *strings;
+    size_t strings_len, strings_cap;
+};
+
+struct json_doc *json_parse(const char *data, size_t len);
+void json_doc_destroy(struct json_doc *doc);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef WAYWALL_UTIL_SPSC_H
+#define WAYWALL_UTIL_SPSC_H
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SPSC_CACHE_LINE 64
+
+/*
+ * What the producer does when it pushes to a full ring.
+ */
+enum spsc_policy {
+    SPSC_DROP_NEWEST, // discard the item being pushed
+    SPSC_DROP_OLDEST, // discard the oldest queued item to make room
+    SPSC_BLOCK,       // wait until the consumer makes room or the ring is closed
+};
+
+typedef void (*spsc_drop_func_t)(void *item);
+
+struct spsc_stats {
+    uint64_t pushed, popped, dropped, blocked;
+};
+
+struct spsc_ring {
+    // The producer and consumer indices are kept on separate cache lines so that the two threads
+    // do not contend on the same line when only one of them is written.
+    alignas(SPSC_CACHE_LINE) atomic_size_t head; // next slot to write (producer)
+    alignas(SPSC_CACHE_LINE) atomic_size_t tail; // next slot to read (consumer)
+
+    alignas(SPSC_CACHE_LINE) size_t mask;
+    enum spsc_policy policy;
+    spsc_drop_func_t drop;
+    _Atomic(void *) *slots;
+
+    atomic_bool closed;
+
+    struct {
+        atomic_uint_fast64_t pushed, popped, dropped, blocked;
+    } stats;
+};
+
+struct spsc_ring *spsc_ring_create(size_t capacity, enum spsc_policy policy, spsc_drop_func_t drop);
+void spsc_ring_destroy(struct spsc_ring *ring);
+
+void spsc_ring_close(struct spsc_ring *ring);
+void *spsc_ring_pop(struct spsc_ring *ring);
+bool spsc_ring_push(struct spsc_ring *ring, void *item);
+struct spsc_stats spsc_ring_stats(struct spsc_ring *ring);
+
+#endif
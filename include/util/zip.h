@@ -1,10 +1,15 @@
 #ifndef WAYWALL_UTIL_ZIP_H
 #define WAYWALL_UTIL_ZIP_H
 
+#include <stdbool.h>
+#include <stddef.h>
+
 struct zip;
 
 void zip_close(struct zip *zip);
+bool zip_contains(struct zip *zip, const char *name);
 const char *zip_next(struct zip *zip);
 struct zip *zip_open(const char *path);
+char *zip_read(struct zip *zip, const char *name, size_t *len);
 
 #endif
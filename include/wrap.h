@@ -4,8 +4,37 @@
 #include "util/box.h"
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/types.h>
 #include <wayland-server-core.h>
 
+struct subproc_capture;
+
+struct wrap_macro_step {
+    uint32_t keycode;
+    bool press;
+    uint32_t delay_us; // delay after the previous step
+};
+
+/*
+ * Each Minecraft instance running inside waywall has its own state watch and capture. Only the
+ * active instance is visible and receives input; the others can still be mirrored.
+ */
+struct wrap_instance {
+    struct wl_list link; // wrap.instances
+    struct wrap *wrap;
+    int index; // 1-based, stable until the instance closes
+
+    struct server_view *view;
+    char *dir;                      // working directory of the game, or NULL if unknown
+    struct instance *instance;      // NULL until detected, or if the game lacks state output
+    struct instance_detect *detect; // pending mod scan, or NULL
+    struct server_gl_capture *capture;
+    struct wl_event_source *state_idle; // pending read of the instance's state file
+    int32_t fps;                        // frame rate cap set from Lua, 0 for the default
+    int cpu_group;                      // config_cpu_group_id last applied, or -1 for defaults
+    int cpu_override;                   // config_cpu_group_id set from Lua, or -1
+};
+
 struct wrap {
     struct config *cfg;
 
@@ -20,6 +49,11 @@ struct wrap {
     int32_t width, height;
     bool is_fullscreen;
 
+    struct wl_list instances;              // wrap_instance.link, sorted by index
+    struct wrap_instance *active;          // may be NULL
+    struct wrap_instance *last_transition; // instance with the latest state change
+
+    // The view and instance of the active instance, if any.
     struct server_view *view;
     struct instance *instance;
     struct {
@@ -37,6 +71,8 @@ struct wrap {
         struct wl_listener on_anchored_resize;
     } floating;
 
+    struct wl_list macros; // wrap_macro.link
+
     struct {
         uint32_t modifiers;
         bool pointer_locked;
@@ -47,6 +83,7 @@ struct wrap {
     struct wl_listener on_pointer_lock;
     struct wl_listener on_pointer_unlock;
     struct wl_listener on_resize;
+    struct wl_listener on_scene_frame;
     struct wl_listener on_view_create;
     struct wl_listener on_view_destroy;
 };
@@ -56,8 +93,16 @@ struct wrap *wrap_create(struct server *server, struct inotify *inotify, struct
 void wrap_destroy(struct wrap *wrap);
 int wrap_set_config(struct wrap *wrap, struct config *cfg);
 
-void wrap_lua_exec(struct wrap *wrap, char *cmd[static 64]);
-void wrap_lua_press_key(struct wrap *wrap, uint32_t keycode);
+struct wrap_instance *wrap_get_instance(struct wrap *wrap, int index);
+
+pid_t wrap_lua_exec(struct wrap *wrap, char *cmd[static 64],
+                    const struct subproc_capture *capture);
+void wrap_lua_press_key(struct wrap *wrap, struct wrap_instance *target, uint32_t keycode);
+void wrap_lua_press_keys(struct wrap *wrap, struct wrap_instance *target, size_t num_steps,
+                         const struct wrap_macro_step steps[static num_steps]);
+int wrap_lua_set_active_instance(struct wrap *wrap, struct wrap_instance *target);
+void wrap_lua_set_cpu_group(struct wrap *wrap, struct wrap_instance *target, int group);
+void wrap_lua_set_fps(struct wrap *wrap, struct wrap_instance *target, int32_t fps);
 int wrap_lua_set_res(struct wrap *wrap, int32_t width, int32_t height);
 void wrap_lua_show_floating(struct wrap *wrap, bool show);
 void wrap_lua_toggle_fullscreen(struct wrap *wrap);
@@ -12,6 +12,7 @@
 #include "server/ui.h"
 #include "server/wl_seat.h"
 #include "server/wp_relative_pointer.h"
+#include "subproc.h"
 #include "timer.h"
 #include "util/alloc.h"
 #include "util/box.h"
@@ -32,6 +33,7 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 #include <xkbcommon/xkbcommon.h>
@@ -81,9 +83,12 @@ static const struct {
 #define METATABLE_IMAGE "waywall.image"
 #define METATABLE_MIRROR "waywall.mirror"
 #define METATABLE_TEXT "waywall.text"
+#define METATABLE_WALL "waywall.wall"
 #define METATABLE_IRC "waywall.irc"
 #define METATABLE_HTTP "waywall.http"
 #define METATABLE_ATLAS "waywall.atlas"
+#define METATABLE_PERIODIC "waywall.periodic"
+#define METATABLE_EXEC "waywall.exec"
 
 #define STARTUP_ERRMSG(function) function " cannot be called during startup"
 
@@ -94,6 +99,24 @@ struct waker_sleep {
     struct config_vm_waker *vm;
 };
 
+struct periodic {
+    struct ww_timer_entry *timer;
+    struct config_vm *vm;
+
+    int callback; // registry reference to the callback function
+    int self;     // registry reference to the userdata, held until cancelled
+};
+
+struct exec_capture {
+    struct config_vm *vm;
+    struct subproc *subproc;
+    pid_t pid; // 0 once the subprocess has exited
+
+    int on_output; // registry reference to the output callback, or LUA_NOREF
+    int on_exit;   // registry reference to the exit callback, or LUA_NOREF
+    int self;      // registry reference to the userdata, held until the subprocess exits
+};
+
 static int
 object_get_depth(lua_State *L) {
     struct scene_object **object = lua_touserdata(L, -1);
@@ -277,6 +300,167 @@ text_gc(lua_State *L) {
     return 0;
 }
 
+static int
+wall_close(lua_State *L) {
+    struct scene_wall **wall = lua_touserdata(L, 1);
+
+    if (!*wall) {
+        return luaL_error(L, "cannot close wall more than once");
+    }
+
+    scene_object_destroy((struct scene_object *)*wall);
+    *wall = NULL;
+
+    return 0;
+}
+
+static int
+wall_get_locked(lua_State *L) {
+    struct scene_wall **wall = luaL_checkudata(L, 1, METATABLE_WALL);
+    if (!*wall) {
+        return luaL_error(L, "wall already closed");
+    }
+
+    int index = luaL_checkint(L, 2);
+
+    bool locked;
+    if (scene_wall_get_locked(*wall, index, &locked) != 0) {
+        return luaL_error(L, "no tile for instance %d", index);
+    }
+
+    lua_pushboolean(L, locked);
+    return 1;
+}
+
+static int
+wall_set_locked(lua_State *L) {
+    struct scene_wall **wall = luaL_checkudata(L, 1, METATABLE_WALL);
+    if (!*wall) {
+        return luaL_error(L, "wall already closed");
+    }
+
+    int index = luaL_checkint(L, 2);
+    luaL_checktype(L, 3, LUA_TBOOLEAN);
+    bool locked = lua_toboolean(L, 3);
+
+    if (scene_wall_set_locked(*wall, index, locked) != 0) {
+        return luaL_error(L, "no tile for instance %d", index);
+    }
+
+    return 0;
+}
+
+static int
+wall_index(lua_State *L) {
+    const char *key = luaL_checkstring(L, 2);
+
+    if (strcmp(key, "close") == 0) {
+        lua_pushcfunction(L, wall_close);
+    } else if (strcmp(key, "get_depth") == 0) {
+        lua_pushcfunction(L, object_get_depth);
+    } else if (strcmp(key, "set_depth") == 0) {
+        lua_pushcfunction(L, object_set_depth);
+    } else if (strcmp(key, "show") == 0) {
+        lua_pushcfunction(L, object_show);
+    } else if (strcmp(key, "hide") == 0) {
+        lua_pushcfunction(L, object_hide);
+    } else if (strcmp(key, "get_locked") == 0) {
+        lua_pushcfunction(L, wall_get_locked);
+    } else if (strcmp(key, "set_locked") == 0) {
+        lua_pushcfunction(L, wall_set_locked);
+    } else {
+        lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+static int
+wall_gc(lua_State *L) {
+    struct scene_wall **wall = lua_touserdata(L, 1);
+
+    if (*wall) {
+        scene_object_destroy((struct scene_object *)*wall);
+    }
+    *wall = NULL;
+
+    return 0;
+}
+
+static void
+periodic_release(lua_State *L, struct periodic *periodic) {
+    if (periodic->timer) {
+        ww_timer_entry_destroy(periodic->timer);
+        periodic->timer = NULL;
+    }
+
+    luaL_unref(L, LUA_REGISTRYINDEX, periodic->callback);
+    periodic->callback = LUA_NOREF;
+
+    // Dropping the self reference allows the userdata to be garbage collected once the user no
+    // longer holds on to it.
+    luaL_unref(L, LUA_REGISTRYINDEX, periodic->self);
+    periodic->self = LUA_NOREF;
+}
+
+static int
+periodic_cancel(lua_State *L) {
+    struct periodic **periodic = lua_touserdata(L, 1);
+
+    if (!*periodic) {
+        return luaL_error(L, "cannot cancel periodic callback more than once");
+    }
+
+    periodic_release(L, *periodic);
+    free(*periodic);
+    *periodic = NULL;
+
+    return 0;
+}
+
+static int
+periodic_index(lua_State *L) {
+    const char *key = luaL_checkstring(L, 2);
+
+    if (strcmp(key, "cancel") == 0) {
+        lua_pushcfunction(L, periodic_cancel);
+    } else {
+        lua_pushnil(L);
+    }
+
+    return 1;
+}
+
+static int
+periodic_gc(lua_State *L) {
+    struct periodic **periodic = lua_touserdata(L, 1);
+
+    if (*periodic) {
+        periodic_release(L, *periodic);
+        free(*periodic);
+    }
+    *periodic = NULL;
+
+    return 0;
+}
+
+static int
+exec_gc(lua_State *L) {
+    struct exec_capture **exec = lua_touserdata(L, 1);
+
+    // The userdata is only collected while the subprocess is still running if the VM is being
+    // closed (e.g. on a configuration reload), in which case the callbacks can no longer be run.
+    if (*exec) {
+        if ((*exec)->pid != 0) {
+            subproc_detach((*exec)->subproc, (*exec)->pid);
+        }
+        free(*exec);
+    }
+    *exec = NULL;
+
+    return 0;
+}
+
 static int
 irc_client_close_(lua_State *L) {
     struct Irc_client **client = lua_touserdata(L, 1);
@@ -293,13 +477,102 @@ irc_client_close_(lua_State *L) {
 
 static int
 irc_client_send_(lua_State *L) {
-    struct Irc_client **client = lua_touserdata(L, 1);
+    static const int ARG_CLIENT = 1;
+    static const int ARG_MESSAGE = 2;
+    static const int ARG_OPTIONS = 3;
+
+    // Prologue
+    struct Irc_client **client = lua_touserdata(L, ARG_CLIENT);
+    if (!*client) {
+        return luaL_error(L, "cannot send with closed irc client");
+    }
 
-    const char *message = luaL_checkstring(L, 2);
+    const char *message = luaL_checkstring(L, ARG_MESSAGE);
 
-    irc_client_send(*client, message);
+    const char *coalesce_key = NULL;
+    int callback = LUA_NOREF;
+    if (!lua_isnoneornil(L, ARG_OPTIONS)) {
+        luaL_checktype(L, ARG_OPTIONS, LUA_TTABLE);
 
-    return 0;
+        lua_getfield(L, ARG_OPTIONS, "coalesce"); // stack: 4
+        if (!lua_isnil(L, -1)) {
+            if (lua_type(L, -1) != LUA_TSTRING) {
+                return luaL_error(L, "expected 'coalesce' to be a string");
+            }
+            coalesce_key = lua_tostring(L, -1);
+        }
+
+        lua_getfield(L, ARG_OPTIONS, "callback"); // stack: 5
+        if (!lua_isnil(L, -1)) {
+            if (!lua_isfunction(L, -1)) {
+                return luaL_error(L, "expected 'callback' to be a function");
+            }
+            callback = luaL_ref(L, LUA_REGISTRYINDEX); // stack: 4
+        }
+    }
+
+    // Body
+    uint64_t id = irc_client_send(*client, message, coalesce_key, callback);
+
+    // Epilogue
+    if (id == 0) {
+        lua_pushnil(L);
+    } else {
+        lua_pushinteger(L, id);
+    }
+    return 1;
+}
+
+static int
+irc_client_filter_(lua_State *L) {
+    static const int ARG_CLIENT = 1;
+    static const int ARG_OPTIONS = 2;
+
+    // Prologue
+    struct Irc_client **client = lua_touserdata(L, ARG_CLIENT);
+    if (!*client) {
+        return luaL_error(L, "cannot add filter to closed irc client");
+    }
+    luaL_checktype(L, ARG_OPTIONS, LUA_TTABLE);
+
+    // Body
+    static const char *fields[] = {"command", "channel", "pattern"};
+    const char *values[STATIC_ARRLEN(fields)] = {0};
+    for (size_t i = 0; i < STATIC_ARRLEN(fields); i++) {
+        lua_getfield(L, ARG_OPTIONS, fields[i]); // stack: 3 + i
+        if (!lua_isnil(L, -1)) {
+            if (lua_type(L, -1) != LUA_TSTRING) {
+                return luaL_error(L, "expected '%s' to be a string", fields[i]);
+            }
+            values[i] = lua_tostring(L, -1);
+        }
+    }
+
+    struct irc_filter_options options = {
+        .command = values[0],
+        .channel = values[1],
+        .pattern = values[2],
+    };
+    int id = irc_client_add_filter(*client, &options);
+    if (id < 0) {
+        return luaL_error(L, "invalid filter pattern");
+    }
+
+    // Epilogue
+    lua_pushinteger(L, id);
+    return 1;
+}
+
+static int
+irc_client_remove_filter_(lua_State *L) {
+    struct Irc_client **client = lua_touserdata(L, 1);
+    if (!*client) {
+        return luaL_error(L, "cannot remove filter from closed irc client");
+    }
+
+    int id = luaL_checkinteger(L, 2);
+    lua_pushboolean(L, irc_client_remove_filter(*client, id));
+    return 1;
 }
 
 static int
@@ -310,6 +583,10 @@ irc_client_index(lua_State *L) {
         lua_pushcfunction(L, irc_client_close_);
     } else if (strcmp(key, "send") == 0) {
         lua_pushcfunction(L, irc_client_send_);
+    } else if (strcmp(key, "filter") == 0) {
+        lua_pushcfunction(L, irc_client_filter_);
+    } else if (strcmp(key, "remove_filter") == 0) {
+        lua_pushcfunction(L, irc_client_remove_filter_);
     } else {
         lua_pushnil(L);
     }
@@ -343,17 +620,169 @@ http_client_close_(lua_State *L) {
     return 0;
 }
 
+static void
+unmarshal_http_flags(lua_State *L, int idx, struct http_request_options *options) {
+    lua_getfield(L, idx, "stream");
+    options->stream = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "json");
+    options->json = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+
+    lua_getfield(L, idx, "cache");
+    options->cache = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+}
+
 static int
 http_client_get_(lua_State *L) {
     struct Http_client **client = lua_touserdata(L, 1);
+    if (!*client) {
+        return luaL_error(L, "cannot send request with closed http client");
+    }
+    if ((*client)->callback == LUA_NOREF) {
+        return luaL_error(L, "http client has no callback; use request instead");
+    }
 
-    const char *message = luaL_checkstring(L, 2);
+    struct http_request_options options = {0};
+    options.url = luaL_checkstring(L, 2);
+    options.callback = LUA_NOREF;
+    if (lua_istable(L, 3)) {
+        unmarshal_http_flags(L, 3, &options);
+    }
 
-    http_client_get(*client, message);
+    http_client_request(*client, &options);
 
     return 0;
 }
 
+static int
+http_client_request_(lua_State *L) {
+    static const int ARG_CLIENT = 1;
+    static const int ARG_OPTIONS = 2;
+
+    // Prologue
+    struct Http_client **client = lua_touserdata(L, ARG_CLIENT);
+    if (!*client) {
+        return luaL_error(L, "cannot send request with closed http client");
+    }
+    luaL_checktype(L, ARG_OPTIONS, LUA_TTABLE);
+
+    // Body
+    struct http_request_options options = {0};
+    options.callback = LUA_NOREF;
+    unmarshal_http_flags(L, ARG_OPTIONS, &options);
+
+    lua_getfield(L, ARG_OPTIONS, "url");
+    if (!lua_isstring(L, -1)) {
+        return luaL_error(L, "expected 'url' to be a string");
+    }
+    options.url = lua_tostring(L, -1);
+    lua_pop(L, 1);
+
+    // The strings in the options table remain referenced by it (and therefore alive) for the
+    // duration of this call.
+    lua_getfield(L, ARG_OPTIONS, "method");
+    if (!lua_isnil(L, -1)) {
+        if (!lua_isstring(L, -1)) {
+            return luaL_error(L, "expected 'method' to be a string");
+        }
+        options.method = lua_tostring(L, -1);
+    }
+    lua_pop(L, 1);
+
+    lua_getfield(L, ARG_OPTIONS, "body");
+    if (!lua_isnil(L, -1)) {
+        if (!lua_isstring(L, -1)) {
+            return luaL_error(L, "expected 'body' to be a string");
+        }
+        options.body = lua_tolstring(L, -1, &options.body_len);
+    }
+    lua_pop(L, 1);
+
+    lua_getfield(L, ARG_OPTIONS, "timeout");
+    if (!lua_isnil(L, -1)) {
+        if (lua_type(L, -1) != LUA_TNUMBER) {
+            return luaL_error(L, "expected 'timeout' to be a number");
+        }
+
+        // The timeout is checked before it is converted so that fractional values do not round
+        // down to 0 (the default) and large values are not truncated.
+        lua_Number timeout = lua_tonumber(L, -1);
+        if (!(timeout >= 1 && timeout <= HTTP_MAX_TIMEOUT_MS)) {
+            return luaL_error(L, "expected 'timeout' to be between 1 and %d milliseconds",
+                              HTTP_MAX_TIMEOUT_MS);
+        }
+        options.timeout_ms = (long)timeout;
+    }
+    lua_pop(L, 1);
+
+    // Header lines are formatted onto the Lua stack so that they are collected along with
+    // everything else if an error is raised partway through.
+    lua_getfield(L, ARG_OPTIONS, "headers");
+    int headers_idx = lua_gettop(L);
+    const char *headers[64];
+    if (!lua_isnil(L, headers_idx)) {
+        if (!lua_istable(L, headers_idx)) {
+            return luaL_error(L, "expected 'headers' to be a table");
+        }
+
+        lua_pushnil(L);
+        while (lua_next(L, headers_idx)) {
+            if (lua_type(L, -2) != LUA_TSTRING || !lua_isstring(L, -1)) {
+                return luaL_error(L, "expected 'headers' to map strings to strings");
+            }
+            if (options.headers_len == STATIC_ARRLEN(headers)) {
+                return luaL_error(L, "too many headers (max %d)", (int)STATIC_ARRLEN(headers));
+            }
+
+            lua_pushfstring(L, "%s: %s", lua_tostring(L, -2), lua_tostring(L, -1));
+            headers[options.headers_len++] = lua_tostring(L, -1);
+            lua_insert(L, headers_idx);
+            headers_idx++;
+            lua_pop(L, 1);
+        }
+    }
+    options.headers = headers;
+
+    lua_getfield(L, ARG_OPTIONS, "callback");
+    if (!lua_isnil(L, -1)) {
+        if (!lua_isfunction(L, -1)) {
+            return luaL_error(L, "expected 'callback' to be a function");
+        }
+        options.callback = luaL_ref(L, LUA_REGISTRYINDEX);
+    } else {
+        lua_pop(L, 1);
+        if ((*client)->callback == LUA_NOREF) {
+            return luaL_error(L, "expected 'callback' to be a function");
+        }
+    }
+
+    http_client_request(*client, &options);
+
+    // Epilogue
+    return 0;
+}
+
+static int
+http_client_cache_stats_(lua_State *L) {
+    struct Http_client **client = lua_touserdata(L, 1);
+    if (!*client) {
+        return luaL_error(L, "cannot get cache stats of closed http client");
+    }
+
+    lua_createtable(L, 0, 3);
+    lua_pushinteger(L, (*client)->cache.hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushinteger(L, (*client)->cache.revalidations);
+    lua_setfield(L, -2, "revalidations");
+    lua_pushinteger(L, (*client)->cache.misses);
+    lua_setfield(L, -2, "misses");
+
+    return 1;
+}
+
 static int
 http_client_index(lua_State *L) {
     const char *key = luaL_checkstring(L, 2);
@@ -362,6 +791,10 @@ http_client_index(lua_State *L) {
         lua_pushcfunction(L, http_client_close_);
     } else if (strcmp(key, "get") == 0) {
         lua_pushcfunction(L, http_client_get_);
+    } else if (strcmp(key, "request") == 0) {
+        lua_pushcfunction(L, http_client_request_);
+    } else if (strcmp(key, "cache_stats") == 0) {
+        lua_pushcfunction(L, http_client_cache_stats_);
     } else {
         lua_pushnil(L);
     }
@@ -491,6 +924,75 @@ waker_sleep_timer_fire(void *data) {
     config_vm_resume(waker->vm);
 }
 
+static void
+periodic_timer_fire(void *data) {
+    struct periodic *periodic = data;
+    lua_State *L = periodic->vm->L;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint32_t time = (uint32_t)((uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000);
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, periodic->callback);
+    lua_pushinteger(L, time);
+    config_vm_try_callback_arg(periodic->vm);
+}
+
+static void
+periodic_timer_destroy(void *data) {
+    struct periodic *periodic = data;
+
+    // This function is called if the timer entry is destroyed (which should only happen if the
+    // global timer manager is destroyed.)
+    periodic->timer = NULL;
+}
+
+static void
+exec_output(void *data, bool is_stderr, const char *line, size_t len) {
+    struct exec_capture *exec = data;
+    lua_State *L = exec->vm->L;
+
+    lua_rawgeti(L, LUA_REGISTRYINDEX, exec->on_output);
+    lua_pushlstring(L, line, len);
+    lua_pushstring(L, is_stderr ? "stderr" : "stdout");
+    config_vm_try_callback_args2(exec->vm);
+}
+
+static void
+exec_exit(void *data, int status) {
+    struct exec_capture *exec = data;
+    lua_State *L = exec->vm->L;
+
+    exec->pid = 0;
+
+    // A status of -1 means that waywall is shutting down, so there is no exit status to report.
+    if (status != -1 && exec->on_exit != LUA_NOREF) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, exec->on_exit);
+        if (WIFEXITED(status)) {
+            lua_pushinteger(L, WEXITSTATUS(status));
+        } else {
+            lua_pushnil(L);
+        }
+        if (WIFSIGNALED(status)) {
+            lua_pushinteger(L, WTERMSIG(status));
+        } else {
+            lua_pushnil(L);
+        }
+        config_vm_try_callback_args2(exec->vm);
+    }
+
+    luaL_unref(L, LUA_REGISTRYINDEX, exec->on_output);
+    exec->on_output = LUA_NOREF;
+    luaL_unref(L, LUA_REGISTRYINDEX, exec->on_exit);
+    exec->on_exit = LUA_NOREF;
+
+    // The userdata (and this struct along with it) may be collected as soon as the self reference
+    // is dropped, so this must come last.
+    int self = exec->self;
+    exec->self = LUA_NOREF;
+    luaL_unref(L, LUA_REGISTRYINDEX, self);
+}
+
 static int
 unmarshal_box(lua_State *L, struct box *out) {
     const struct {
@@ -540,6 +1042,22 @@ unmarshal_box_key(lua_State *L, const char *key, struct box *out) {
     return 0;
 }
 
+static int
+unmarshal_int_key(lua_State *L, const char *key, int32_t *out, bool required) {
+    lua_pushstring(L, key); // stack: n+1
+    lua_rawget(L, -2);      // stack: n+1
+
+    if (lua_type(L, -1) == LUA_TNUMBER) {
+        *out = lua_tointeger(L, -1);
+    } else if (required || !lua_isnil(L, -1)) {
+        return luaL_error(L, "expected '%s' to be a number, got '%s'", key, luaL_typename(L, -1));
+    }
+
+    lua_pop(L, 1); // stack: n
+
+    return 0;
+}
+
 static int
 unmarshal_color(lua_State *L, const char *key, float rgba[static 4]) {
     lua_pushstring(L, key); // stack: n+1
@@ -566,6 +1084,40 @@ unmarshal_color(lua_State *L, const char *key, float rgba[static 4]) {
     return 0;
 }
 
+static struct wrap_instance *
+check_instance(lua_State *L, struct wrap *wrap, int arg) {
+    // An omitted index refers to the active instance, which may not exist.
+    if (lua_isnoneornil(L, arg)) {
+        return wrap->active;
+    }
+
+    int index = luaL_checkint(L, arg);
+    struct wrap_instance *winst = wrap_get_instance(wrap, index);
+    if (!winst) {
+        luaL_error(L, "no instance with index %d", index);
+    }
+
+    return winst;
+}
+
+static int
+l_active_instance(lua_State *L) {
+    // Prologue
+    struct config_vm *vm = config_vm_from(L);
+    struct wrap *wrap = config_vm_get_wrap(vm);
+    if (!wrap) {
+        return luaL_error(L, STARTUP_ERRMSG("active_instance"));
+    }
+
+    // Epilogue
+    if (wrap->active) {
+        lua_pushinteger(L, wrap->active->index);
+    } else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
 static int
 l_active_res(lua_State *L) {
     // Prologue
@@ -593,9 +1145,65 @@ l_current_time(lua_State *L) {
     return 1;
 }
 
+static int
+l_every(lua_State *L) {
+    static const int ARG_MS = 1;
+    static const int ARG_CALLBACK = 2;
+
+    // Prologue
+    struct config_vm *vm = config_vm_from(L);
+    struct wrap *wrap = config_vm_get_wrap(vm);
+    if (!wrap) {
+        return luaL_error(L, STARTUP_ERRMSG("every"));
+    }
+
+    int ms = luaL_checkinteger(L, ARG_MS);
+    if (ms <= 0) {
+        return luaL_error(L, "interval must be a positive number of milliseconds");
+    }
+    luaL_checktype(L, ARG_CALLBACK, LUA_TFUNCTION);
+
+    lua_settop(L, ARG_CALLBACK);
+
+    // Body
+    struct timespec interval = {
+        .tv_sec = ms / 1000,
+        .tv_nsec = (ms % 1000) * 1000000,
+    };
+
+    struct periodic *periodic = zalloc(1, sizeof(*periodic));
+    periodic->vm = vm;
+    periodic->timer = ww_timer_add_entry(wrap->timer, interval, periodic_timer_fire,
+                                         periodic_timer_destroy, periodic);
+    if (!periodic->timer) {
+        free(periodic);
+        return luaL_error(L, "failed to create periodic timer");
+    }
+    ww_timer_entry_set_interval(periodic->timer, interval);
+
+    lua_pushvalue(L, ARG_CALLBACK);                      // stack: 3
+    periodic->callback = luaL_ref(L, LUA_REGISTRYINDEX); // stack: 2
+
+    // The userdata holds a reference to itself in the registry so that the callback keeps running
+    // even if the user discards the returned handle.
+    struct periodic **udata = lua_newuserdata(L, sizeof(*udata)); // stack: 3
+    check_alloc(udata);
+    *udata = periodic;
+
+    luaL_getmetatable(L, METATABLE_PERIODIC); // stack: 4
+    lua_setmetatable(L, -2);                  // stack: 3
+
+    lua_pushvalue(L, -1);                           // stack: 4
+    periodic->self = luaL_ref(L, LUA_REGISTRYINDEX); // stack: 3
+
+    // Epilogue
+    return 1;
+}
+
 static int
 l_exec(lua_State *L) {
     static const int ARG_COMMAND = 1;
+    static const int ARG_OPTIONS = 2;
 
     // Prologue
     struct config_vm *vm = config_vm_from(L);
@@ -606,7 +1214,28 @@ l_exec(lua_State *L) {
 
     const char *lua_str = luaL_checkstring(L, ARG_COMMAND);
 
-    lua_settop(L, ARG_COMMAND);
+    bool has_output = false, has_exit = false;
+    if (!lua_isnoneornil(L, ARG_OPTIONS)) {
+        luaL_checktype(L, ARG_OPTIONS, LUA_TTABLE);
+
+        lua_getfield(L, ARG_OPTIONS, "on_output"); // stack: 3
+        if (!lua_isnil(L, -1)) {
+            if (!lua_isfunction(L, -1)) {
+                return luaL_error(L, "expected 'on_output' to be a function");
+            }
+            has_output = true;
+        }
+
+        lua_getfield(L, ARG_OPTIONS, "on_exit"); // stack: 4
+        if (!lua_isnil(L, -1)) {
+            if (!lua_isfunction(L, -1)) {
+                return luaL_error(L, "expected 'on_exit' to be a function");
+            }
+            has_exit = true;
+        }
+    }
+
+    lua_settop(L, ARG_OPTIONS + 2);
 
     // Body. Duplicate the string from the Lua VM so that it can be modified for in-place
     // argument parsing.
@@ -635,24 +1264,96 @@ l_exec(lua_State *L) {
         }
     }
 
-    wrap_lua_exec(wrap, cmd);
-    free(cmd_str);
-
+    if (!has_output && !has_exit) {
+        wrap_lua_exec(wrap, cmd, NULL);
+        free(cmd_str);
+        return 0;
+    }
+
+    struct exec_capture *exec = zalloc(1, sizeof(*exec));
+    exec->vm = vm;
+    exec->subproc = wrap->subproc;
+    exec->on_output = LUA_NOREF;
+    exec->on_exit = LUA_NOREF;
+    exec->self = LUA_NOREF;
+
+    struct subproc_capture capture = {
+        .output = has_output ? exec_output : NULL,
+        .exit = exec_exit,
+        .data = exec,
+    };
+
+    exec->pid = wrap_lua_exec(wrap, cmd, &capture);
+    free(cmd_str);
+    if (exec->pid <= 0) {
+        free(exec);
+        return luaL_error(L, "failed to spawn '%s'", lua_str);
+    }
+
+    // The callbacks are referenced only once the subprocess has been spawned, since the exit
+    // callback (which releases them) is never called otherwise.
+    if (has_exit) {
+        exec->on_exit = luaL_ref(L, LUA_REGISTRYINDEX); // stack: 3
+    } else {
+        lua_pop(L, 1); // stack: 3
+    }
+    if (has_output) {
+        exec->on_output = luaL_ref(L, LUA_REGISTRYINDEX); // stack: 2
+    } else {
+        lua_pop(L, 1); // stack: 2
+    }
+
+    // The userdata keeps the capture alive until the subprocess exits, even though it is never
+    // returned to the user. It is collected early only when the VM is closed.
+    struct exec_capture **udata = lua_newuserdata(L, sizeof(*udata)); // stack: 3
+    check_alloc(udata);
+    *udata = exec;
+
+    luaL_getmetatable(L, METATABLE_EXEC); // stack: 4
+    lua_setmetatable(L, -2);              // stack: 3
+
+    exec->self = luaL_ref(L, LUA_REGISTRYINDEX); // stack: 2
+
+    // Epilogue
+    return 0;
+}
+
+static int
+l_floating_shown(lua_State *L) {
+    // Prologue
+    struct config_vm *vm = config_vm_from(L);
+    struct wrap *wrap = config_vm_get_wrap(vm);
+    if (!wrap) {
+        return luaL_error(L, STARTUP_ERRMSG("floating_shown"));
+    }
+
     // Epilogue
-    return 0;
+    lua_pushboolean(L, wrap->floating.visible);
+    return 1;
 }
 
 static int
-l_floating_shown(lua_State *L) {
+l_instances(lua_State *L) {
     // Prologue
     struct config_vm *vm = config_vm_from(L);
     struct wrap *wrap = config_vm_get_wrap(vm);
     if (!wrap) {
-        return luaL_error(L, STARTUP_ERRMSG("floating_shown"));
+        return luaL_error(L, STARTUP_ERRMSG("instances"));
+    }
+
+    lua_settop(L, 0);
+
+    // Body
+    lua_createtable(L, wl_list_length(&wrap->instances), 0); // stack: 1
+
+    int i = 1;
+    struct wrap_instance *winst;
+    wl_list_for_each (winst, &wrap->instances, link) {
+        lua_pushinteger(L, winst->index); // stack: 2
+        lua_rawseti(L, -2, i++);          // stack: 1
     }
 
     // Epilogue
-    lua_pushboolean(L, wrap->floating.visible);
     return 1;
 }
 
@@ -808,6 +1509,24 @@ l_mirror(lua_State *L) {
     }
     lua_pop(L, 1); // stack: 1
 
+    lua_pushstring(L, "instance"); // stack: 2
+    lua_rawget(L, ARG_OPTIONS);    // stack: 2
+    if (!lua_isnil(L, -1)) {
+        if (!lua_isnumber(L, -1)) {
+            free(options.shader_name);
+            return luaL_error(L, "expected 'instance' to be a number");
+        }
+
+        int index = lua_tointeger(L, -1);
+        struct wrap_instance *winst = wrap_get_instance(wrap, index);
+        if (!winst) {
+            free(options.shader_name);
+            return luaL_error(L, "no instance with index %d", index);
+        }
+        options.capture = winst->capture;
+    }
+    lua_pop(L, 1); // stack: 1
+
     // Body
     struct scene_mirror **mirror = lua_newuserdata(L, sizeof(*mirror));
     check_alloc(mirror);
@@ -828,6 +1547,7 @@ l_mirror(lua_State *L) {
 static int
 l_press_key(lua_State *L) {
     static const int ARG_KEYNAME = 1;
+    static const int ARG_INSTANCE = 2;
 
     // Prologue
     struct config_vm *vm = config_vm_from(L);
@@ -837,8 +1557,9 @@ l_press_key(lua_State *L) {
     }
 
     const char *key = luaL_checkstring(L, ARG_KEYNAME);
+    struct wrap_instance *target = check_instance(L, wrap, ARG_INSTANCE);
 
-    lua_settop(L, ARG_KEYNAME);
+    lua_settop(L, ARG_INSTANCE);
 
     // Body. Determine which keycode to send to the Minecraft instance.
     uint32_t keycode = KEY_UNKNOWN;
@@ -852,7 +1573,101 @@ l_press_key(lua_State *L) {
         return luaL_error(L, "unknown key %s", key);
     }
 
-    wrap_lua_press_key(wrap, keycode);
+    wrap_lua_press_key(wrap, target, keycode);
+
+    // Epilogue
+    return 0;
+}
+
+static int
+l_press_keys(lua_State *L) {
+    static const int ARG_STEPS = 1;
+    static const int ARG_INSTANCE = 2;
+    static const int IDX_STEP = 2;
+
+    static const size_t MAX_STEPS = 1024;
+
+    // Prologue
+    struct config_vm *vm = config_vm_from(L);
+    struct wrap *wrap = config_vm_get_wrap(vm);
+    if (!wrap) {
+        return luaL_error(L, STARTUP_ERRMSG("press_keys"));
+    }
+
+    luaL_checktype(L, ARG_STEPS, LUA_TTABLE);
+    struct wrap_instance *target = check_instance(L, wrap, ARG_INSTANCE);
+
+    // The instance argument is no longer needed, so its stack slot is reused for each step.
+    lua_settop(L, ARG_STEPS);
+
+    // Body. Each step may expand into two key events if it does not specify whether the key should
+    // be pressed or released.
+    size_t len = lua_objlen(L, ARG_STEPS);
+    if (len > MAX_STEPS) {
+        return luaL_error(L, "too many steps (%zu > %zu)", len, MAX_STEPS);
+    }
+
+    struct wrap_macro_step *steps = zalloc(len * 2 + 1, sizeof(*steps));
+    size_t num_steps = 0;
+
+    for (size_t i = 1; i <= len; i++) {
+        lua_rawgeti(L, ARG_STEPS, i); // stack: 2
+        if (!lua_istable(L, IDX_STEP)) {
+            free(steps);
+            return luaL_error(L, "expected step %zu to be of type 'table', was '%s'", i,
+                              luaL_typename(L, IDX_STEP));
+        }
+
+        lua_getfield(L, IDX_STEP, "key"); // stack: 3
+        const char *key = lua_tostring(L, -1);
+        if (!key) {
+            free(steps);
+            return luaL_error(L, "expected 'key' of step %zu to be a string", i);
+        }
+
+        uint32_t keycode = KEY_UNKNOWN;
+        for (size_t j = 0; j < STATIC_ARRLEN(util_keycodes); j++) {
+            if (strcasecmp(util_keycodes[j].name, key) == 0) {
+                keycode = util_keycodes[j].value;
+                break;
+            }
+        }
+        if (keycode == KEY_UNKNOWN) {
+            free(steps);
+            return luaL_error(L, "unknown key %s", key);
+        }
+        lua_pop(L, 1); // stack: 2
+
+        lua_getfield(L, IDX_STEP, "delay_us"); // stack: 3
+        uint32_t delay_us = 0;
+        if (!lua_isnil(L, -1)) {
+            if (lua_type(L, -1) != LUA_TNUMBER) {
+                free(steps);
+                return luaL_error(L, "expected 'delay_us' of step %zu to be a number, was '%s'", i,
+                                  luaL_typename(L, -1));
+            }
+
+            lua_Number delay = lua_tonumber(L, -1);
+            if (!(delay >= 0 && delay <= UINT32_MAX)) {
+                free(steps);
+                return luaL_error(L, "invalid delay for step %zu", i);
+            }
+            delay_us = (uint32_t)delay;
+        }
+        lua_pop(L, 1); // stack: 2
+
+        lua_getfield(L, IDX_STEP, "down"); // stack: 3
+        if (lua_isnil(L, -1)) {
+            steps[num_steps++] = (struct wrap_macro_step){keycode, true, delay_us};
+            steps[num_steps++] = (struct wrap_macro_step){keycode, false, 0};
+        } else {
+            steps[num_steps++] = (struct wrap_macro_step){keycode, lua_toboolean(L, -1), delay_us};
+        }
+        lua_pop(L, 2); // stack: 1
+    }
+
+    wrap_lua_press_keys(wrap, target, num_steps, steps);
+    free(steps);
 
     // Epilogue
     return 0;
@@ -915,6 +1730,66 @@ l_profile(lua_State *L) {
     return 1;
 }
 
+static int
+l_set_cpu_group(lua_State *L) {
+    static const int ARG_GROUP = 1;
+    static const int ARG_INSTANCE = 2;
+
+    // Prologue
+    struct config_vm *vm = config_vm_from(L);
+    struct wrap *wrap = config_vm_get_wrap(vm);
+    if (!wrap) {
+        return luaL_error(L, STARTUP_ERRMSG("set_cpu_group"));
+    }
+
+    const char *name = luaL_optstring(L, ARG_GROUP, NULL);
+    struct wrap_instance *target = check_instance(L, wrap, ARG_INSTANCE);
+
+    lua_settop(L, ARG_INSTANCE);
+
+    // Body
+    int group = -1;
+    if (name) {
+        group = config_find_cpu_group(name);
+        if (group == -1) {
+            return luaL_error(L, "unknown CPU group '%s'", name);
+        }
+    }
+
+    wrap_lua_set_cpu_group(wrap, target, group);
+
+    // Epilogue
+    return 0;
+}
+
+static int
+l_set_fps(lua_State *L) {
+    static const int ARG_FPS = 1;
+    static const int ARG_INSTANCE = 2;
+
+    // Prologue
+    struct config_vm *vm = config_vm_from(L);
+    struct wrap *wrap = config_vm_get_wrap(vm);
+    if (!wrap) {
+        return luaL_error(L, STARTUP_ERRMSG("set_fps"));
+    }
+
+    int fps = luaL_checkint(L, ARG_FPS);
+    struct wrap_instance *target = check_instance(L, wrap, ARG_INSTANCE);
+
+    lua_settop(L, ARG_INSTANCE);
+
+    // Body
+    if (fps < 0 || fps > 1000) {
+        return luaL_error(L, "invalid frame rate %d", fps);
+    }
+
+    wrap_lua_set_fps(wrap, target, fps);
+
+    // Epilogue
+    return 0;
+}
+
 static int
 l_set_keymap(lua_State *L) {
     static const int ARG_KEYMAP = 1;
@@ -1069,6 +1944,31 @@ l_set_remaps(lua_State *L) {
     return 0;
 }
 
+static int
+l_set_active_instance(lua_State *L) {
+    static const int ARG_INDEX = 1;
+
+    // Prologue
+    struct config_vm *vm = config_vm_from(L);
+    struct wrap *wrap = config_vm_get_wrap(vm);
+    if (!wrap) {
+        return luaL_error(L, STARTUP_ERRMSG("set_active_instance"));
+    }
+
+    luaL_checktype(L, ARG_INDEX, LUA_TNUMBER);
+    struct wrap_instance *target = check_instance(L, wrap, ARG_INDEX);
+
+    lua_settop(L, ARG_INDEX);
+
+    // Body
+    if (wrap_lua_set_active_instance(wrap, target) != 0) {
+        return luaL_error(L, "cannot set active instance");
+    }
+
+    // Epilogue
+    return 0;
+}
+
 static int
 l_set_resolution(lua_State *L) {
     static const int ARG_WIDTH = 1;
@@ -1168,6 +2068,9 @@ l_sleep(lua_State *L) {
     }
 
     int ms = luaL_checkinteger(L, ARG_MS);
+    if (ms < 0) {
+        return luaL_error(L, "sleep duration must not be negative");
+    }
 
     lua_settop(L, ARG_MS);
 
@@ -1192,8 +2095,37 @@ l_sleep(lua_State *L) {
     return lua_yield(L, 0);
 }
 
+static void
+push_state(lua_State *L, const struct instance_state *state) {
+    static const char *screen_names[] = {
+        [SCREEN_TITLE] = "title",           [SCREEN_WAITING] = "waiting",
+        [SCREEN_GENERATING] = "generating", [SCREEN_PREVIEWING] = "previewing",
+        [SCREEN_INWORLD] = "inworld",       [SCREEN_WALL] = "wall",
+    };
+
+    static const char *inworld_names[] = {
+        [INWORLD_UNPAUSED] = "unpaused",
+        [INWORLD_PAUSED] = "paused",
+        [INWORLD_MENU] = "menu",
+    };
+
+    lua_createtable(L, 0, 2);
+
+    lua_pushstring(L, screen_names[state->screen]);
+    lua_setfield(L, -2, "screen");
+
+    if (state->screen == SCREEN_GENERATING || state->screen == SCREEN_PREVIEWING) {
+        lua_pushinteger(L, state->data.percent);
+        lua_setfield(L, -2, "percent");
+    } else if (state->screen == SCREEN_INWORLD) {
+        lua_pushstring(L, inworld_names[state->data.inworld]);
+        lua_setfield(L, -2, "inworld");
+    }
+}
+
 static int
 l_state(lua_State *L) {
+    static const int ARG_INDEX = 1;
     static const int IDX_STATE = 1;
 
     // Prologue
@@ -1203,45 +2135,72 @@ l_state(lua_State *L) {
         return luaL_error(L, STARTUP_ERRMSG("state"));
     }
 
+    struct wrap_instance *winst = check_instance(L, wrap, ARG_INDEX);
+
     lua_settop(L, 0);
 
     // Body
-    if (!wrap->instance) {
+    if (!winst || !winst->instance) {
         return luaL_error(L, "no state output");
     }
 
-    static const char *screen_names[] = {
-        [SCREEN_TITLE] = "title",           [SCREEN_WAITING] = "waiting",
-        [SCREEN_GENERATING] = "generating", [SCREEN_PREVIEWING] = "previewing",
-        [SCREEN_INWORLD] = "inworld",       [SCREEN_WALL] = "wall",
-    };
+    push_state(L, &winst->instance->state); // stack: IDX_STATE
 
-    static const char *inworld_names[] = {
-        [INWORLD_UNPAUSED] = "unpaused",
-        [INWORLD_PAUSED] = "paused",
-        [INWORLD_MENU] = "menu",
-    };
+    // Epilogue. The state table was already pushed to the stack by the above code.
+    ww_assert(lua_gettop(L) == IDX_STATE);
+    return 1;
+}
 
-    struct instance_state *state = &wrap->instance->state;
+static int
+l_state_history(lua_State *L) {
+    static const int ARG_COUNT = 1;
+    static const int ARG_INDEX = 2;
+
+    // Prologue
+    struct config_vm *vm = config_vm_from(L);
+    struct wrap *wrap = config_vm_get_wrap(vm);
+    if (!wrap) {
+        return luaL_error(L, STARTUP_ERRMSG("state_history"));
+    }
 
-    lua_newtable(L); // stack: IDX_STATE
+    size_t max = INSTANCE_HISTORY_LEN;
+    if (!lua_isnoneornil(L, ARG_COUNT)) {
+        int count = luaL_checkinteger(L, ARG_COUNT);
+        if (count < 0) {
+            return luaL_error(L, "count must be non-negative");
+        }
+        if ((size_t)count < max) {
+            max = count;
+        }
+    }
 
-    lua_pushstring(L, "screen");                    // stack: IDX_STATE + 1 (key)
-    lua_pushstring(L, screen_names[state->screen]); // stack: IDX_STATE + 2 (value)
-    lua_rawset(L, IDX_STATE);                       // stack: IDX_STATE
+    struct wrap_instance *winst = check_instance(L, wrap, ARG_INDEX);
 
-    if (state->screen == SCREEN_GENERATING || state->screen == SCREEN_PREVIEWING) {
-        lua_pushstring(L, "percent");            // stack: IDX_STATE + 1 (key)
-        lua_pushinteger(L, state->data.percent); // stack: IDX_STATE + 2 (value)
-        lua_rawset(L, IDX_STATE);                // stack: IDX_STATE
-    } else if (state->screen == SCREEN_INWORLD) {
-        lua_pushstring(L, "inworld");                          // stack: IDX_STATE + 1 (key)
-        lua_pushstring(L, inworld_names[state->data.inworld]); // stack: IDX_STATE + 2 (value)
-        lua_rawset(L, IDX_STATE);                              // stack: IDX_STATE
+    // Body
+    if (!winst || !winst->instance) {
+        return luaL_error(L, "no state output");
     }
 
-    // Epilogue. The state table was already pushed to the stack by the above code.
-    ww_assert(lua_gettop(L) == IDX_STATE);
+    const struct instance_transition *transitions[INSTANCE_HISTORY_LEN];
+    size_t n = instance_get_history(winst->instance, transitions, max);
+
+    lua_createtable(L, n, 0);
+    for (size_t i = 0; i < n; i++) {
+        lua_createtable(L, 0, 3);
+
+        push_state(L, &transitions[i]->old);
+        lua_setfield(L, -2, "old");
+        push_state(L, &transitions[i]->new);
+        lua_setfield(L, -2, "new");
+
+        // This uses the same clock and units as waywall.current_time.
+        lua_pushinteger(L, (uint32_t)(transitions[i]->time_ns / 1000000));
+        lua_setfield(L, -2, "time");
+
+        lua_rawseti(L, -2, i + 1);
+    }
+
+    // Epilogue
     return 1;
 }
 
@@ -1359,6 +2318,124 @@ l_text_advance(lua_State *L) {
     return 1;
 }
 
+static int
+l_last_transition(lua_State *L) {
+    // Prologue
+    struct config_vm *vm = config_vm_from(L);
+    struct wrap *wrap = config_vm_get_wrap(vm);
+    if (!wrap) {
+        return luaL_error(L, STARTUP_ERRMSG("last_transition"));
+    }
+
+    // Epilogue
+    if (wrap->last_transition) {
+        lua_pushinteger(L, wrap->last_transition->index);
+    } else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+static int
+l_wall(lua_State *L) {
+    static const int ARG_OPTIONS = 1;
+
+    // Prologue
+    struct config_vm *vm = config_vm_from(L);
+    struct wrap *wrap = config_vm_get_wrap(vm);
+    if (!wrap) {
+        return luaL_error(L, STARTUP_ERRMSG("wall"));
+    }
+
+    luaL_checktype(L, ARG_OPTIONS, LUA_TTABLE);
+    lua_settop(L, ARG_OPTIONS);
+
+    struct scene_wall_options options = {0};
+
+    unmarshal_box_key(L, "dst", &options.dst);
+
+    unmarshal_int_key(L, "rows", &options.rows, true);
+    unmarshal_int_key(L, "cols", &options.cols, true);
+    unmarshal_int_key(L, "gap", &options.gap, false);
+
+    options.depth = DEFAULT_DEPTH;
+    unmarshal_int_key(L, "depth", &options.depth, false);
+
+    if (options.rows < 1 || options.cols < 1) {
+        return luaL_error(L, "rows and cols must be positive");
+    }
+    // Each dimension is bounded first so that the product below cannot overflow.
+    if (options.rows > SCENE_WALL_MAX_TILES || options.cols > SCENE_WALL_MAX_TILES ||
+        options.rows * options.cols > SCENE_WALL_MAX_TILES) {
+        return luaL_error(L, "too many tiles (%d x %d > %d)", options.rows, options.cols,
+                          SCENE_WALL_MAX_TILES);
+    }
+    if (options.gap < 0) {
+        return luaL_error(L, "gap must be non-negative");
+    }
+    if (options.dst.width <= (int64_t)options.gap * (options.cols - 1) ||
+        options.dst.height <= (int64_t)options.gap * (options.rows - 1)) {
+        return luaL_error(L, "dst is too small for the given gap");
+    }
+
+    lua_pushstring(L, "lock_color"); // stack: 2
+    lua_rawget(L, ARG_OPTIONS);      // stack: 2
+    bool has_lock_color = !lua_isnil(L, -1);
+    lua_pop(L, 1); // stack: 1
+    if (has_lock_color) {
+        unmarshal_color(L, "lock_color", options.lock_rgba);
+    }
+
+    lua_pushstring(L, "progress_color"); // stack: 2
+    lua_rawget(L, ARG_OPTIONS);          // stack: 2
+    bool has_progress_color = !lua_isnil(L, -1);
+    lua_pop(L, 1); // stack: 1
+    if (has_progress_color) {
+        unmarshal_color(L, "progress_color", options.progress_rgba);
+    }
+
+    lua_pushstring(L, "shader");
+    lua_rawget(L, ARG_OPTIONS);
+    if (lua_type(L, -1) == LUA_TSTRING) {
+        options.shader_name = strdup(lua_tostring(L, -1));
+    }
+    lua_pop(L, 1);
+
+    // Body
+    struct scene_wall **wall = lua_newuserdata(L, sizeof(*wall));
+    check_alloc(wall);
+
+    luaL_getmetatable(L, METATABLE_WALL);
+    lua_setmetatable(L, -2);
+
+    *wall = scene_add_wall(wrap->scene, &options);
+    free(options.shader_name);
+    if (!*wall) {
+        return luaL_error(L, "failed to create wall");
+    }
+
+    // Epilogue. The userdata (wall) was already pushed to the stack by the above code.
+    return 1;
+}
+
+static int
+l_load_module(lua_State *L) {
+    static const int ARG_PATH = 1;
+
+    // Prologue
+    const char *path = luaL_checkstring(L, ARG_PATH);
+
+    lua_settop(L, ARG_PATH);
+
+    // Body
+    if (config_cache_load(L, path) != 0) {
+        return lua_error(L);
+    }
+
+    // Epilogue
+    return 1; // stack: 2
+}
+
 static int
 l_log(lua_State *L) {
     ww_log(LOG_INFO, "lua: %s", lua_tostring(L, 1));
@@ -1414,11 +2491,7 @@ l_setenv(lua_State *L) {
     lua_settop(L, ARG_VALUE);
 
     // Body
-    if (value) {
-        setenv(name, value, 1);
-    } else {
-        unsetenv(name);
-    }
+    config_vm_set_env(config_vm_from(L), name, value);
 
     // Epilogue
     return 0;
@@ -1443,6 +2516,7 @@ l_irc_client(lua_State *L) {
     static const int ARG_USER = 3;
     static const int ARG_TOKEN = 4;
     static const int ARG_CALLBACK = 5;
+    static const int ARG_OPTIONS = 6;
 
     // Prologue
     struct config_vm *vm = config_vm_from(L);
@@ -1456,6 +2530,36 @@ l_irc_client(lua_State *L) {
     const char *nick = luaL_checkstring(L, ARG_USER);
     const char *pass = luaL_checkstring(L, ARG_TOKEN);
 
+    struct irc_client_options options = {
+        .send_limit = DEFAULT_SEND_LIMIT,
+        .send_period = DEFAULT_SEND_PERIOD,
+    };
+    if (!lua_isnoneornil(L, ARG_OPTIONS)) {
+        luaL_checktype(L, ARG_OPTIONS, LUA_TTABLE);
+
+        lua_getfield(L, ARG_OPTIONS, "parsed");
+        options.parsed = lua_toboolean(L, -1);
+        lua_pop(L, 1);
+
+        lua_getfield(L, ARG_OPTIONS, "send_limit");
+        if (!lua_isnil(L, -1)) {
+            if (!lua_isnumber(L, -1) || lua_tointeger(L, -1) < 1) {
+                return luaL_error(L, "expected 'send_limit' to be a positive integer");
+            }
+            options.send_limit = lua_tointeger(L, -1);
+        }
+        lua_pop(L, 1);
+
+        lua_getfield(L, ARG_OPTIONS, "send_period");
+        if (!lua_isnil(L, -1)) {
+            if (!lua_isnumber(L, -1) || lua_tonumber(L, -1) <= 0) {
+                return luaL_error(L, "expected 'send_period' to be a positive number");
+            }
+            options.send_period = lua_tonumber(L, -1);
+        }
+        lua_pop(L, 1);
+    }
+
     luaL_checktype(L, ARG_CALLBACK, LUA_TFUNCTION);
     lua_pushvalue(L, ARG_CALLBACK);
     const int callback = luaL_ref(L, LUA_REGISTRYINDEX);
@@ -1467,7 +2571,8 @@ l_irc_client(lua_State *L) {
     luaL_getmetatable(L, METATABLE_IRC);
     lua_setmetatable(L, -2);
 
-    *client = irc_client_create(server, port, nick, pass, callback, L);
+    struct wl_event_loop *loop = wl_display_get_event_loop(wrap->server->display);
+    *client = irc_client_create(loop, server, port, nick, pass, callback, &options, L);
     if (!*client) {
         luaL_unref(L, LUA_REGISTRYINDEX, callback);
         return luaL_error(L, "failed to create irc client");
@@ -1487,9 +2592,13 @@ l_http_client(lua_State *L) {
         return luaL_error(L, STARTUP_ERRMSG("http_client"));
     }
 
-    luaL_checktype(L, ARG_CALLBACK, LUA_TFUNCTION);
-    lua_pushvalue(L, ARG_CALLBACK);
-    const int callback = luaL_ref(L, LUA_REGISTRYINDEX);
+    // The client-wide callback is optional, since requests can carry their own.
+    int callback = LUA_NOREF;
+    if (!lua_isnoneornil(L, ARG_CALLBACK)) {
+        luaL_checktype(L, ARG_CALLBACK, LUA_TFUNCTION);
+        lua_pushvalue(L, ARG_CALLBACK);
+        callback = luaL_ref(L, LUA_REGISTRYINDEX);
+    }
 
     // Body
     struct Http_client **client = lua_newuserdata(L, sizeof(*client));
@@ -1498,7 +2607,7 @@ l_http_client(lua_State *L) {
     luaL_getmetatable(L, METATABLE_HTTP);
     lua_setmetatable(L, -2);
 
-    *client = http_client_create(callback, L);
+    *client = http_client_create(wl_display_get_event_loop(wrap->server->display), callback, L);
     if (!*client) {
         luaL_unref(L, LUA_REGISTRYINDEX, callback);
         return luaL_error(L, "failed to create http client");
@@ -1544,15 +2653,22 @@ l_atlas(lua_State *L) {
 }
 static const struct luaL_Reg lua_lib[] = {
     // public (see api.lua)
+    {"active_instance", l_active_instance},
     {"active_res", l_active_res},
     {"current_time", l_current_time},
+    {"every", l_every},
     {"exec", l_exec},
     {"floating_shown", l_floating_shown},
     {"image", l_image},
+    {"instances", l_instances},
     {"mirror", l_mirror},
     {"press_key", l_press_key},
+    {"press_keys", l_press_keys},
     {"get_key", l_get_key},
     {"profile", l_profile},
+    {"set_active_instance", l_set_active_instance},
+    {"set_cpu_group", l_set_cpu_group},
+    {"set_fps", l_set_fps},
     {"set_keymap", l_set_keymap},
     {"set_remaps", l_set_remaps},
     {"set_resolution", l_set_resolution},
@@ -1560,8 +2676,10 @@ static const struct luaL_Reg lua_lib[] = {
     {"show_floating", l_show_floating},
     {"sleep", l_sleep},
     {"state", l_state},
+    {"state_history", l_state_history},
     {"text", l_text},
     {"toggle_fullscreen", l_toggle_fullscreen},
+    {"wall", l_wall},
     {"irc_client_create", l_irc_client},
     {"http_client_create", l_http_client},
     {"atlas", l_atlas},
@@ -1569,7 +2687,9 @@ static const struct luaL_Reg lua_lib[] = {
     {"text_advance", l_text_advance},
 
     // private (see init.lua)
+    {"last_transition", l_last_transition},
     {"log", l_log},
+    {"load_module", l_load_module},
     {"log_error", l_log_error},
     {"register", l_register},
     {"setenv", l_setenv},
@@ -1610,6 +2730,16 @@ config_api_init(struct config_vm *vm) {
     lua_settable(vm->L, -3);                  // stack: n+1
     lua_pop(vm->L, 1);                        // stack: n
 
+    // Create the metatable for "wall" objects.
+    luaL_newmetatable(vm->L, METATABLE_WALL); // stack: n+1
+    lua_pushstring(vm->L, "__gc");            // stack: n+2
+    lua_pushcfunction(vm->L, wall_gc);        // stack: n+3
+    lua_settable(vm->L, -3);                  // stack: n+1
+    lua_pushstring(vm->L, "__index");         // stack: n+2
+    lua_pushcfunction(vm->L, wall_index);     // stack: n+3
+    lua_settable(vm->L, -3);                  // stack: n+1
+    lua_pop(vm->L, 1);                        // stack: n
+
     // Create the metatable for "irc_client" objects.
     luaL_newmetatable(vm->L, METATABLE_IRC);    // stack: n+1
     lua_pushstring(vm->L, "__gc");              // stack: n+2
@@ -1630,6 +2760,23 @@ config_api_init(struct config_vm *vm) {
     lua_settable(vm->L, -3);                     // stack: n+1
     lua_pop(vm->L, 1);                           // stack: n
 
+    // Create the metatable for "periodic" objects.
+    luaL_newmetatable(vm->L, METATABLE_PERIODIC); // stack: n+1
+    lua_pushstring(vm->L, "__gc");                // stack: n+2
+    lua_pushcfunction(vm->L, periodic_gc);        // stack: n+3
+    lua_settable(vm->L, -3);                      // stack: n+1
+    lua_pushstring(vm->L, "__index");             // stack: n+2
+    lua_pushcfunction(vm->L, periodic_index);     // stack: n+3
+    lua_settable(vm->L, -3);                      // stack: n+1
+    lua_pop(vm->L, 1);                            // stack: n
+
+    // Create the metatable for "exec" objects.
+    luaL_newmetatable(vm->L, METATABLE_EXEC); // stack: n+1
+    lua_pushstring(vm->L, "__gc");            // stack: n+2
+    lua_pushcfunction(vm->L, exec_gc);        // stack: n+3
+    lua_settable(vm->L, -3);                  // stack: n+1
+    lua_pop(vm->L, 1);                        // stack: n
+
     // Create the metatable for "atlas" objects.
     luaL_newmetatable(vm->L, METATABLE_ATLAS); // stack: n+1
     lua_pushstring(vm->L, "__gc");             // stack: n+2
@@ -0,0 +1,171 @@
+#include "config/internal.h"
+#include "util/alloc.h"
+#include "util/cache.h"
+#include "util/log.h"
+#include "util/prelude.h"
+#include "util/str.h"
+#include <luajit-2.1/lauxlib.h>
+#include <luajit-2.1/lua.h>
+#include <luajit-2.1/luajit.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/*
+ * Lua modules in the user's configuration directory are compiled to bytecode once and stored in
+ * the cache directory. Subsequent loads (e.g. when the configuration is reloaded) skip the parser
+ * entirely as long as the source file has not been modified.
+ *
+ * Each cache entry is laid out as follows:
+ *
+ *   struct cache_header
+ *   char path[header.path_len]
+ *   char bytecode[header.bc_size]
+ */
+
+#define CACHE_MAGIC 0x4357574C // "LWWC"
+#define CACHE_VERSION 1
+
+struct cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t luajit_version;
+    uint32_t path_len;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+    uint64_t bc_size;
+};
+
+struct dump_buffer {
+    char *data;
+    size_t len, cap;
+};
+
+static int
+dump_writer(lua_State *L, const void *p, size_t sz, void *ud) {
+    struct dump_buffer *buf = ud;
+
+    if (buf->len + sz > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : 4096;
+        while (cap < buf->len + sz) {
+            cap *= 2;
+        }
+
+        buf->data = realloc(buf->data, cap);
+        check_alloc(buf->data);
+        buf->cap = cap;
+    }
+
+    memcpy(buf->data + buf->len, p, sz);
+    buf->len += sz;
+    return 0;
+}
+
+static int
+load_cached(lua_State *L, const char *cache_path, const char *path, const struct stat *stat) {
+    size_t len;
+    char *data = util_cache_read(cache_path, &len);
+    if (!data) {
+        return 1;
+    }
+
+    struct cache_header header;
+    if (len < sizeof(header)) {
+        goto fail;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    bool valid = header.magic == CACHE_MAGIC && header.version == CACHE_VERSION &&
+                 header.luajit_version == LUAJIT_VERSION_NUM &&
+                 header.mtime_sec == (int64_t)stat->st_mtim.tv_sec &&
+                 header.mtime_nsec == (int64_t)stat->st_mtim.tv_nsec &&
+                 header.size == (int64_t)stat->st_size && header.path_len == strlen(path) &&
+                 header.path_len <= len - sizeof(header) &&
+                 header.bc_size == len - sizeof(header) - header.path_len &&
+                 memcmp(data + sizeof(header), path, header.path_len) == 0;
+    if (!valid) {
+        goto fail;
+    }
+
+    str chunkname = str_new();
+    str_append(&chunkname, "@");
+    str_append(&chunkname, path);
+
+    const char *bc = data + sizeof(header) + header.path_len;
+    int ret = luaL_loadbuffer(L, bc, header.bc_size, chunkname);
+    str_free(chunkname);
+
+    if (ret != 0) {
+        ww_log(LOG_WARN, "failed to load cached bytecode for '%s': %s", path,
+               lua_tostring(L, -1));
+        lua_pop(L, 1);
+        goto fail;
+    }
+
+    free(data);
+    return 0;
+
+fail:
+    free(data);
+    return 1;
+}
+
+static void
+store_cached(lua_State *L, const char *cache_path, const char *path, const struct stat *stat) {
+    struct dump_buffer buf = {0};
+
+    struct cache_header header = {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_VERSION,
+        .luajit_version = LUAJIT_VERSION_NUM,
+        .path_len = strlen(path),
+        .mtime_sec = stat->st_mtim.tv_sec,
+        .mtime_nsec = stat->st_mtim.tv_nsec,
+        .size = stat->st_size,
+    };
+    dump_writer(L, &header, sizeof(header), &buf);
+    dump_writer(L, path, header.path_len, &buf);
+
+    size_t bc_start = buf.len;
+    if (lua_dump(L, dump_writer, &buf) != 0) {
+        ww_log(LOG_WARN, "failed to dump bytecode for '%s'", path);
+        goto done;
+    }
+
+    header.bc_size = buf.len - bc_start;
+    memcpy(buf.data, &header, sizeof(header));
+
+    util_cache_write(cache_path, buf.data, buf.len);
+
+done:
+    free(buf.data);
+}
+
+int
+config_cache_load(lua_State *L, const char *path) {
+    struct stat stat_buf = {0};
+    if (stat(path, &stat_buf) != 0) {
+        return luaL_loadfile(L, path);
+    }
+
+    str cache_path = util_cache_path("bytecode", path);
+    if (!cache_path) {
+        return luaL_loadfile(L, path);
+    }
+
+    if (load_cached(L, cache_path, path, &stat_buf) == 0) {
+        str_free(cache_path);
+        return 0;
+    }
+
+    int ret = luaL_loadfile(L, path);
+    if (ret == 0) {
+        store_cached(L, cache_path, path, &stat_buf);
+    }
+
+    str_free(cache_path);
+    return ret;
+}
@@ -12,6 +12,7 @@
 #include <luajit-2.1/lua.h>
 #include <luajit-2.1/luajit.h>
 #include <luajit-2.1/lualib.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
@@ -80,6 +81,13 @@ static const struct {
     {"mod5", KB_MOD_MOD5},
 };
 
+static const char *cpu_group_names[CPU_GROUP_COUNT] = {
+    [CPU_GROUP_ACTIVE] = "active",
+    [CPU_GROUP_BACKGROUND] = "background",
+    [CPU_GROUP_TITLE] = "title",
+    [CPU_GROUP_HELPERS] = "helpers",
+};
+
 static int
 get_bool(struct config *cfg, const char *key, bool *dst, const char *full_name, bool required) {
     lua_pushstring(cfg->vm->L, key); // stack: n+1
@@ -729,6 +737,124 @@ process_config_shaders(struct config *cfg) {
     return 0;
 }
 
+static int
+process_config_cpu_cores(struct config *cfg, struct config_cpu_group *group, const char *name) {
+    // stack state
+    // 4:   config.cpu[name].cores
+    // 3:   config.cpu[name]
+    // 2:   config.cpu
+    // 1:   config
+    static const int IDX_CORES = 4;
+
+    size_t len = lua_objlen(cfg->vm->L, IDX_CORES);
+    if (len == 0) {
+        ww_log(LOG_ERROR, "'cpu.%s.cores' must contain at least one core", name);
+        return 1;
+    }
+
+    for (size_t i = 1; i <= len; i++) {
+        lua_rawgeti(cfg->vm->L, IDX_CORES, i); // stack: 5
+
+        if (!lua_isnumber(cfg->vm->L, -1)) {
+            ww_log(LOG_ERROR, "expected 'cpu.%s.cores[%zu]' to be of type 'number', was '%s'",
+                   name, i, luaL_typename(cfg->vm->L, -1));
+            return 1;
+        }
+
+        // The range is checked before converting, since casting an out of range double to int
+        // is undefined.
+        double x = lua_tonumber(cfg->vm->L, -1);
+        if (!(x >= 0 && x < 64) || (int)x != x) {
+            ww_log(LOG_ERROR, "'cpu.%s.cores[%zu]' must be an integer from 0 to 63", name, i);
+            return 1;
+        }
+        int core = (int)x;
+        group->cores |= (uint64_t)1 << core;
+
+        lua_pop(cfg->vm->L, 1); // stack: 4
+    }
+
+    return 0;
+}
+
+static int
+process_config_cpu_group(struct config *cfg, struct config_cpu_group *group, const char *name) {
+    // stack state
+    // 3:   config.cpu[name]
+    // 2:   config.cpu
+    // 1:   config
+    ww_assert(lua_gettop(cfg->vm->L) == 3);
+
+    char full_name[64];
+
+    group->enabled = true;
+
+    snprintf(full_name, STATIC_ARRLEN(full_name), "cpu.%s.nice", name);
+    if (get_int(cfg, "nice", &group->nice, full_name, false) != 0) {
+        return 1;
+    }
+    if (group->nice < -20 || group->nice > 19) {
+        ww_log(LOG_ERROR, "'%s' must be from -20 to 19", full_name);
+        return 1;
+    }
+
+    snprintf(full_name, STATIC_ARRLEN(full_name), "cpu.%s.idle", name);
+    if (get_bool(cfg, "idle", &group->idle, full_name, false) != 0) {
+        return 1;
+    }
+
+    lua_pushstring(cfg->vm->L, "cores"); // stack: 4
+    lua_rawget(cfg->vm->L, -2);          // stack: 4
+
+    switch (lua_type(cfg->vm->L, -1)) {
+    case LUA_TTABLE:
+        if (process_config_cpu_cores(cfg, group, name) != 0) {
+            return 1;
+        }
+        break;
+    case LUA_TNIL:
+        break;
+    default:
+        ww_log(LOG_ERROR, "expected 'cpu.%s.cores' to be of type 'table', was '%s'", name,
+               luaL_typename(cfg->vm->L, -1));
+        return 1;
+    }
+
+    lua_pop(cfg->vm->L, 1); // stack: 3
+    return 0;
+}
+
+static int
+process_config_cpu(struct config *cfg) {
+    // stack state
+    // 2:   config.cpu
+    // 1:   config
+    ww_assert(lua_gettop(cfg->vm->L) == 2);
+
+    for (size_t i = 0; i < STATIC_ARRLEN(cpu_group_names); i++) {
+        lua_pushstring(cfg->vm->L, cpu_group_names[i]); // stack: 3
+        lua_rawget(cfg->vm->L, -2);                     // stack: 3
+
+        switch (lua_type(cfg->vm->L, -1)) {
+        case LUA_TTABLE:
+            if (process_config_cpu_group(cfg, &cfg->cpu[i], cpu_group_names[i]) != 0) {
+                return 1;
+            }
+            break;
+        case LUA_TNIL:
+            break;
+        default:
+            ww_log(LOG_ERROR, "expected 'cpu.%s' to be of type 'table', was '%s'",
+                   cpu_group_names[i], luaL_typename(cfg->vm->L, -1));
+            return 1;
+        }
+
+        lua_pop(cfg->vm->L, 1); // stack: 2
+    }
+
+    return 0;
+}
+
 static int
 process_config(struct config *cfg) {
     // stack state
@@ -755,6 +881,10 @@ process_config(struct config *cfg) {
         return 1;
     }
 
+    if (get_table(cfg, "cpu", process_config_cpu, "cpu", false) != 0) {
+        return 1;
+    }
+
     return 0;
 }
 
@@ -867,6 +997,13 @@ config_destroy(struct config *cfg) {
     free(cfg);
 }
 
+void
+config_apply_env(struct config *cfg) {
+    ww_assert(cfg->vm);
+
+    config_vm_apply_env(cfg->vm);
+}
+
 ssize_t
 config_find_action(struct config *cfg, const struct config_action *action) {
     for (size_t i = 0; i < cfg->input.actions.count; i++) {
@@ -914,6 +1051,17 @@ config_find_action(struct config *cfg, const struct config_action *action) {
     return -1;
 }
 
+int
+config_find_cpu_group(const char *name) {
+    for (size_t i = 0; i < STATIC_ARRLEN(cpu_group_names); i++) {
+        if (strcmp(cpu_group_names[i], name) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
 int
 config_load(struct config *cfg, const char *profile) {
     ww_assert(!cfg->vm);
@@ -7,8 +7,17 @@
 #include <luajit-2.1/lua.h>
 #include <luajit-2.1/luajit.h>
 #include <luajit-2.1/lualib.h>
+#include <stdlib.h>
+#include <string.h>
 #include <wayland-util.h>
 
+struct config_vm_env {
+    struct wl_list link; // config_vm.env
+
+    char *name;
+    char *value; // NULL if the variable should be unset
+};
+
 struct config_vm_waker {
     struct wl_list link; // config_vm.wakers
 
@@ -143,6 +152,7 @@ config_vm_create() {
     struct config_vm *vm = zalloc(1, sizeof(*vm));
 
     wl_list_init(&vm->wakers);
+    wl_list_init(&vm->env);
 
     // Create the Lua state.
     vm->L = luaL_newstate();
@@ -193,6 +203,15 @@ config_vm_destroy(struct config_vm *vm) {
     }
 
     lua_close(vm->L);
+
+    struct config_vm_env *env, *env_tmp;
+    wl_list_for_each_safe (env, env_tmp, &vm->env, link) {
+        wl_list_remove(&env->link);
+        free(env->name);
+        free(env->value);
+        free(env);
+    }
+
     free(vm);
 }
 
@@ -211,6 +230,47 @@ config_vm_get_wrap(struct config_vm *vm) {
     return registry_get(vm->L, &REG_KEYS.wrap);
 }
 
+void
+config_vm_apply_env(struct config_vm *vm) {
+    struct config_vm_env *env, *tmp;
+    wl_list_for_each_safe (env, tmp, &vm->env, link) {
+        if (env->value) {
+            setenv(env->name, env->value, 1);
+        } else {
+            unsetenv(env->name);
+        }
+
+        wl_list_remove(&env->link);
+        free(env->name);
+        free(env->value);
+        free(env);
+    }
+}
+
+void
+config_vm_set_env(struct config_vm *vm, const char *name, const char *value) {
+    // Configurations are loaded on a worker thread when reloading, where modifying the environment
+    // would race with getenv calls on other threads. Changes made before the configuration is
+    // attached to a wrap are queued until config_vm_apply_env is called from the main thread.
+    if (config_vm_get_wrap(vm)) {
+        if (value) {
+            setenv(name, value, 1);
+        } else {
+            unsetenv(name);
+        }
+        return;
+    }
+
+    struct config_vm_env *env = zalloc(1, sizeof(*env));
+    env->name = strdup(name);
+    check_alloc(env->name);
+    if (value) {
+        env->value = strdup(value);
+        check_alloc(env->value);
+    }
+    wl_list_insert(vm->env.prev, &env->link);
+}
+
 void
 config_vm_set_profile(struct config_vm *vm, const char *profile) {
     vm->profile = strdup(profile);
@@ -400,80 +460,26 @@ config_vm_try_action(struct config_vm *vm, size_t index) {
 
 bool
 config_vm_try_callback_arg(struct config_vm *vm) {
-    ww_assert(lua_gettop(vm->L) == 2); // the function + arugment
-
-    lua_State *coro = lua_newthread(vm->L); // stack: +1 coroutine
-    coro_table_add(coro, NULL);
-
-    // move function from vm->L to coro stack
-    lua_pushvalue(vm->L, 1);
-    lua_xmove(vm->L, coro, 1);
-
-    // push argument onto the coroutine stack
-    lua_pushvalue(vm->L, 2);
-    lua_xmove(vm->L, coro, 1);
-
-    // pop function and argument from the vm->L
-    lua_pop(vm->L, 2);
-
-    // coro stack:
-    // 1. callback func
-    // 2. arg
-
-    // resume the coroutine passing 1 argument
-    int ret = lua_resume(coro, 1);
-    bool consumed = true;
-
-    switch (ret) {
-    case LUA_YIELD:
-        process_yield(coro);
-        break;
-    case 0:
-        if (lua_gettop(coro) == 0) {
-            lua_pushnil(coro);
-        }
-        consumed = (!lua_isboolean(coro, -1) || lua_toboolean(coro, -1));
-        coro_table_del(coro);
-        break;
-    default:
-        ww_log(LOG_ERROR, "failed to start callback: '%s'", lua_tostring(coro, -1));
-        coro_table_del(coro);
-        break;
-    }
-
-    lua_pop(vm->L, 1); // pop coroutine from vm->L stack
-    ww_assert(lua_gettop(vm->L) == 0);
-
-    return consumed;
+    return config_vm_try_callback_argn(vm, 1);
 }
 
 bool
 config_vm_try_callback_args2(struct config_vm *vm) {
-    ww_assert(lua_gettop(vm->L) == 3); // function + 2 arguments
-
-    lua_State *coro = lua_newthread(vm->L); // stack: +1 coroutine
-    coro_table_add(coro, NULL);
-
-    // move function from vm->L to coro stack
-    lua_pushvalue(vm->L, 1);
-    lua_xmove(vm->L, coro, 1);
+    return config_vm_try_callback_argn(vm, 2);
+}
 
-    // push the two arguments onto the coroutine stack
-    lua_pushvalue(vm->L, 2);
-    lua_xmove(vm->L, coro, 1);
-    lua_pushvalue(vm->L, 3);
-    lua_xmove(vm->L, coro, 1);
+bool
+config_vm_try_callback_argn(struct config_vm *vm, int nargs) {
+    ww_assert(lua_gettop(vm->L) == nargs + 1); // function + arguments
 
-    // pop function + args from vm->L
-    lua_pop(vm->L, 3);
+    lua_State *coro = lua_newthread(vm->L); // stack: nargs+2
+    coro_table_add(coro, NULL);
+    lua_pop(vm->L, 1); // stack: nargs+1
 
-    // coro stack:
-    // 1. callback func
-    // 2. arg1
-    // 3. arg2
+    // move the function and its arguments from vm->L to the coroutine stack
+    lua_xmove(vm->L, coro, nargs + 1); // stack: 0
 
-    // resume the coroutine passing 2 arguments
-    int ret = lua_resume(coro, 2);
+    int ret = lua_resume(coro, nargs);
     bool consumed = true;
 
     switch (ret) {
@@ -493,7 +499,6 @@ config_vm_try_callback_args2(struct config_vm *vm) {
         break;
     }
 
-    lua_pop(vm->L, 1); // pop coroutine from vm->L stack
     ww_assert(lua_gettop(vm->L) == 0);
 
     return consumed;
@@ -0,0 +1,88 @@
+#define _GNU_SOURCE
+
+#include "cpu.h"
+#include "config/config.h"
+#include "util/log.h"
+#include "util/prelude.h"
+#include <dirent.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+static int
+apply_thread(pid_t tid, const struct config_cpu_group *group, const cpu_set_t *cores) {
+    int ret = 0;
+
+    if (sched_setaffinity(tid, sizeof(*cores), cores) == -1) {
+        ret = -1;
+    }
+
+    // Threads which are not using SCHED_IDLE are moved back to SCHED_OTHER so that a group without
+    // `idle` undoes a previous group with it. This also resets the SCHED_RR policy which children
+    // of waywall inherit from it.
+    int policy = group->idle ? SCHED_IDLE : SCHED_OTHER;
+    if (sched_getscheduler(tid) != policy) {
+        const struct sched_param param = {.sched_priority = 0};
+        if (sched_setscheduler(tid, policy, &param) == -1) {
+            ret = -1;
+        }
+    }
+
+    // On Linux, the nice value is a per-thread attribute despite what POSIX says.
+    if (setpriority(PRIO_PROCESS, tid, group->nice) == -1) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+int
+cpu_apply(pid_t pid, const struct config_cpu_group *group) {
+    ww_assert(group->enabled);
+
+    cpu_set_t cores;
+    CPU_ZERO(&cores);
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+        if (group->cores == 0 || (i < 64 && (group->cores & ((uint64_t)1 << i)))) {
+            CPU_SET(i, &cores);
+        }
+    }
+
+    // Every thread has to be updated individually. The JVM creates most of its threads early on,
+    // and any threads it creates later inherit their attributes from the creating thread.
+    char path[64];
+    snprintf(path, STATIC_ARRLEN(path), "/proc/%jd/task", (intmax_t)pid);
+
+    DIR *dir = opendir(path);
+    if (!dir) {
+        ww_log_errno(LOG_ERROR, "failed to open '%s'", path);
+        return 1;
+    }
+
+    size_t failed = 0;
+    struct dirent *dirent;
+    while ((dirent = readdir(dir))) {
+        char *end;
+        long tid = strtol(dirent->d_name, &end, 10);
+        if (*end != '\0' || tid <= 0) {
+            continue;
+        }
+
+        // Threads may exit while the directory is being read.
+        if (apply_thread(tid, group, &cores) != 0 && errno != ESRCH) {
+            failed++;
+        }
+    }
+    closedir(dir);
+
+    if (failed > 0) {
+        ww_log(LOG_WARN, "failed to set CPU scheduling for %zu thread(s) of process %jd", failed,
+               (intmax_t)pid);
+        return 1;
+    }
+
+    return 0;
+}
@@ -1,6 +1,13 @@
 #include "http.h"
+#include "util/alloc.h"
+#include "util/cache.h"
+#include "util/json.h"
 #include "util/log.h"
+#include "util/prelude.h"
+#include "util/str.h"
 #include <config/vm.h>
+#include <ctype.h>
+#include <errno.h>
 #include <curl/curl.h>
 #include <lua.h>
 #include <pthread.h>
@@ -9,419 +16,1346 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+
+/*
+ * All HTTP clients share a single curl multi handle which is driven by the main event loop. curl
+ * tells us which sockets to watch (CURLMOPT_SOCKETFUNCTION) and when it next needs to be woken up
+ * (CURLMOPT_TIMERFUNCTION), and we register both directly with the wl_event_loop. Completed
+ * transfers are delivered to Lua from the event loop, so no locking is required.
+ *
+ * Sharing the multi handle allows any number of requests to be in flight at once, and lets curl
+ * reuse connections and multiplex requests over HTTP/2 where possible.
+ *
+ * Streaming requests hand their data to Lua in chunks instead of buffering the whole body. Lua
+ * cannot be called from within curl's write callback (the callback may close the client, which is
+ * not allowed from inside curl), so received data is buffered until curl returns control to the
+ * event loop handler, at which point all pending chunks are delivered.
+ *
+ * Requests may carry their own callback. Such callbacks receive a single response table with the
+ * status code, headers, body and curl's timing information rather than the client-wide (body, url)
+ * arguments, so response headers are only recorded for them.
+ *
+ * GET requests may opt into an on-disk cache under $XDG_CACHE_HOME/waywall/http. Each URL maps to
+ * a single file (named by the hash of the URL) containing the validators, headers and body of the
+ * last successful response. When an entry exists, the request is sent with If-None-Match and
+ * If-Modified-Since headers, and a 304 response is answered with the cached headers and body.
+ *
+ * Reading and writing cache entries and parsing JSON bodies are done on a worker thread owned by
+ * the engine, which hands each request back through an eventfd once it is done. A cached request
+ * is only started once its entry has been read. A parsed JSON document is then converted to Lua
+ * values a bounded number of nodes at a time, once per event loop iteration, so that a large
+ * response cannot stall the compositor. The partially built values live on the stack of a
+ * dedicated Lua thread between iterations.
+ */
+
+struct http_engine {
+    CURLM *multi;
+
+    struct wl_event_loop *loop;
+    struct wl_event_source *timer;
+    struct wl_listener on_loop_destroy;
+
+    struct wl_list clients;  // Http_client.link
+    struct wl_list streams;  // http_request.stream_link
+    struct wl_list building; // http_request.job_link
+    struct http_request *build_current; // request being built, NULL outside of build_continue
+    str cache_dir;                      // created on the first cached request
+
+    struct {
+        pthread_t thread;
+        bool running;
+
+        // Guards should_exit and both lists.
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        bool should_exit;
+        struct wl_list queue; // http_request.job_link
+        struct wl_list done;  // http_request.job_link
+
+        int fd; // signalled when a job is done, or to continue building
+        struct wl_event_source *src;
+    } worker;
+};
+
+struct http_buffer {
+    char *data;
+    size_t size, cap;
+};
 
-static struct Http_client *all_clients[MAX_CLIENTS] = {0};
-static int client_count = 0;
-static pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
+struct http_cache_entry {
+    char *data; // NULL if there is no entry
+    size_t len;
 
-static int pushed_count = 0;
-static int popped_count = 0;
+    // These point into data and are NUL terminated.
+    const char *etag, *last_modified, *headers, *body;
+    size_t headers_len, body_len;
+};
 
-struct response_buffer {
-    char *data;
-    size_t size;
+struct http_cache_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t url_len, etag_len, last_modified_len;
+    uint32_t headers_len;
+    uint64_t body_len;
+};
+
+static const char CACHE_MAGIC[4] = {'W', 'W', 'H', 'C'};
+#define CACHE_VERSION 2
+
+enum http_request_state {
+    REQUEST_ACTIVE,   // the transfer is in progress
+    REQUEST_WORKER,   // queued on (or being processed by) the worker thread
+    REQUEST_BUILDING, // the parsed body is being converted to Lua values
+};
+
+enum http_job {
+    JOB_LOAD,   // read the cache entry before the request is started
+    JOB_FINISH, // store or apply the cache entry, and parse the body
 };
 
+struct json_frame {
+    uint32_t end; // index of the first node after the container
+    uint32_t n;   // number of values (and keys) added to the container so far
+    bool object;
+};
+
+struct json_build {
+    lua_State *T; // holds the unfinished containers on its stack
+    int ref;      // registry reference to T
+
+    uint32_t idx;
+    struct json_frame *frames; // JSON_MAX_DEPTH + 1 entries
+    size_t depth;
+};
+
+struct http_request {
+    struct wl_list link; // Http_client.requests
+    struct Http_client *client;
+
+    CURL *curl;
+    struct curl_slist *headers;
+    char *url;
+
+    int callback; // LUA_NOREF if the client's callback should be used
+    bool stream, json;
+    struct wl_list stream_link; // http_engine.streams, if there is data to deliver
+
+    struct http_buffer response;
+    struct http_buffer response_headers;
+
+    str cache_path; // NULL if the response should not be cached
+    struct http_cache_entry cached;
+
+    enum http_request_state state;
+    enum http_job job;
+    struct wl_list job_link; // http_engine.worker.queue, http_engine.worker.done or
+                             // http_engine.building, depending on the state
+    CURLcode result;
+    long status;     // response code, for finished requests
+    bool from_cache; // answered from the cache after a 304
+
+    struct json_doc *doc; // NULL if the body is not JSON, or failed to parse
+    struct json_build build;
+};
+
+#define DEFAULT_TIMEOUT_MS 30000
+
+// The number of JSON nodes converted to Lua values per event loop iteration, and the largest
+// document which will be converted at all. Larger documents are passed to Lua as a string.
+#define JSON_BUILD_STEP 4096
+#define JSON_MAX_NODES (1 << 20)
+
+static struct http_engine *engine = NULL;
+
+static void check_multi_info(void);
+static void deliver_response(struct http_request *req);
+static void flush_streams(void);
+
+static bool
+buffer_append(struct http_buffer *buf, const void *data, size_t size) {
+    // The buffer grows geometrically so that large responses are not copied once per chunk.
+    if (buf->size + size > buf->cap) {
+        size_t cap = buf->cap ? buf->cap : CURL_MAX_WRITE_SIZE;
+        while (cap < buf->size + size) {
+            cap *= 2;
+        }
+
+        char *ptr = realloc(buf->data, cap);
+        if (!ptr) {
+            return false;
+        }
+
+        buf->data = ptr;
+        buf->cap = cap;
+    }
+
+    memcpy(buf->data + buf->size, data, size);
+    buf->size += size;
+    return true;
+}
+
 static size_t
-write_callback(void *contents, size_t size, size_t nmemb, struct response_buffer *buffer) {
+write_callback(void *contents, size_t size, size_t nmemb, void *data) {
+    struct http_request *req = data;
     size_t realsize = size * nmemb;
-    char *ptr = realloc(buffer->data, buffer->size + realsize + 1);
-    if (!ptr) {
+
+    if (req->stream && req->response.size == 0 && realsize > 0) {
+        wl_list_insert(engine->streams.prev, &req->stream_link);
+    }
+
+    if (!buffer_append(&req->response, contents, realsize)) {
         ww_log(LOG_ERROR, "realloc failed in write_callback");
+        wl_list_remove(&req->stream_link);
+        wl_list_init(&req->stream_link);
         return 0;
     }
 
-    buffer->data = ptr;
-    memcpy(&(buffer->data[buffer->size]), contents, realsize);
-    buffer->size += realsize;
-    buffer->data[buffer->size] = '\0';
+    return realsize;
+}
+
+static size_t
+header_callback(char *contents, size_t size, size_t nitems, void *data) {
+    struct http_request *req = data;
+    size_t realsize = size * nitems;
+
+    // Every response in a chain of redirects (or an interim 1xx response) starts with a new status
+    // line, and only the headers of the final response should be reported.
+    if (realsize >= 5 && memcmp(contents, "HTTP/", 5) == 0) {
+        req->response_headers.size = 0;
+    }
+
+    if (!buffer_append(&req->response_headers, contents, realsize)) {
+        ww_log(LOG_ERROR, "realloc failed in header_callback");
+        return 0;
+    }
 
     return realsize;
 }
 
+static int
+handle_socket(int32_t fd, uint32_t mask, void *data) {
+    int flags = 0;
+    if (mask & WL_EVENT_READABLE) {
+        flags |= CURL_CSELECT_IN;
+    }
+    if (mask & WL_EVENT_WRITABLE) {
+        flags |= CURL_CSELECT_OUT;
+    }
+    if (mask & (WL_EVENT_HANGUP | WL_EVENT_ERROR)) {
+        flags |= CURL_CSELECT_ERR;
+    }
+
+    int running;
+    curl_multi_socket_action(engine->multi, fd, flags, &running);
+    flush_streams();
+    check_multi_info();
+
+    return 0;
+}
+
+static int
+handle_timer(void *data) {
+    int running;
+    curl_multi_socket_action(engine->multi, CURL_SOCKET_TIMEOUT, 0, &running);
+    flush_streams();
+    check_multi_info();
+
+    return 0;
+}
+
+static int
+socket_callback(CURL *curl, curl_socket_t fd, int what, void *userp, void *socketp) {
+    struct wl_event_source *src = socketp;
+
+    if (what == CURL_POLL_REMOVE) {
+        if (src) {
+            wl_event_source_remove(src);
+            curl_multi_assign(engine->multi, fd, NULL);
+        }
+        return 0;
+    }
+
+    uint32_t mask = 0;
+    if (what == CURL_POLL_IN || what == CURL_POLL_INOUT) {
+        mask |= WL_EVENT_READABLE;
+    }
+    if (what == CURL_POLL_OUT || what == CURL_POLL_INOUT) {
+        mask |= WL_EVENT_WRITABLE;
+    }
+
+    if (src) {
+        wl_event_source_fd_update(src, mask);
+    } else {
+        src = wl_event_loop_add_fd(engine->loop, fd, mask, handle_socket, NULL);
+        check_alloc(src);
+        curl_multi_assign(engine->multi, fd, src);
+    }
+
+    return 0;
+}
+
+static int
+timer_callback(CURLM *multi, long timeout_ms, void *userp) {
+    // A timeout of -1 means the timer should be disarmed. A timeout of 0 means curl wants to be
+    // called as soon as possible, but a delay of 0 would disarm the event loop timer.
+    int delay = timeout_ms < 0 ? 0 : (timeout_ms == 0 ? 1 : timeout_ms);
+    wl_event_source_timer_update(engine->timer, delay);
+
+    return 0;
+}
+
+static void
+request_free(struct http_request *req) {
+    // Any Lua references held by the request must have been released already, since this is also
+    // used for requests whose client is gone.
+    curl_easy_cleanup(req->curl);
+    curl_slist_free_all(req->headers);
+
+    free(req->response_headers.data);
+    free(req->response.data);
+    free(req->cached.data);
+    if (req->cache_path) {
+        str_free(req->cache_path);
+    }
+    if (req->doc) {
+        json_doc_destroy(req->doc);
+    }
+    free(req->build.frames);
+    free(req->url);
+    free(req);
+}
+
+static void
+request_destroy(struct http_request *req) {
+    lua_State *L = req->client->vm->L;
+
+    luaL_unref(L, LUA_REGISTRYINDEX, req->callback);
+    req->callback = LUA_NOREF;
+
+    wl_list_remove(&req->link);
+    wl_list_remove(&req->stream_link);
+    wl_list_init(&req->stream_link);
+
+    switch (req->state) {
+    case REQUEST_ACTIVE:
+        if (req->client->engine) {
+            curl_multi_remove_handle(req->client->engine->multi, req->curl);
+        }
+        break;
+    case REQUEST_WORKER:
+        // The worker thread may be using the request, so it is only marked as cancelled (by
+        // detaching it from its client) and is freed once the worker hands it back.
+        if (engine && engine->worker.running) {
+            req->client = NULL;
+            return;
+        }
+        wl_list_remove(&req->job_link);
+        break;
+    case REQUEST_BUILDING:
+        // Creating Lua values can run finalizers, which may close the client of the request being
+        // built. Its build thread must stay alive until the current step returns.
+        if (engine && engine->build_current == req) {
+            req->client = NULL;
+            return;
+        }
+        luaL_unref(L, LUA_REGISTRYINDEX, req->build.ref);
+        wl_list_remove(&req->job_link);
+        break;
+    }
+
+    request_free(req);
+}
+
+static int
+request_callback(struct http_request *req) {
+    return req->callback != LUA_NOREF ? req->callback : req->client->callback;
+}
+
 static bool
-response_queue_is_full(struct response_queue *q) {
-    return ((q->write_pos + 1) % MAX_QUEUED_RESPONSES) == q->read_pos;
+find_header(struct http_request *req, const char *name, const char **value, size_t *value_len) {
+    const char *data = req->response_headers.data;
+    size_t size = req->response_headers.size;
+    size_t name_len = strlen(name);
+
+    size_t pos = 0;
+    while (pos < size) {
+        const char *line = data + pos;
+        const char *eol = memchr(line, '\n', size - pos);
+        size_t len = eol ? (size_t)(eol - line) : size - pos;
+        pos += len + 1;
+
+        if (len <= name_len || line[name_len] != ':' || strncasecmp(line, name, name_len) != 0) {
+            continue;
+        }
+
+        const char *start = line + name_len + 1;
+        const char *end = line + len;
+        while (start < end && (*start == ' ' || *start == '\t')) {
+            start++;
+        }
+        while (end > start && (end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t')) {
+            end--;
+        }
+
+        *value = start;
+        *value_len = end - start;
+        return true;
+    }
+
+    return false;
 }
 
 static bool
-response_queue_is_empty(struct response_queue *q) {
-    return q->write_pos == q->read_pos;
+cache_entry_load(const char *path, const char *url, struct http_cache_entry *entry) {
+    size_t len;
+    char *data = util_cache_read(path, &len);
+    if (!data) {
+        return false;
+    }
+
+    struct http_cache_header header;
+    if (len < sizeof(header)) {
+        goto fail;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        header.version != CACHE_VERSION) {
+        goto fail;
+    }
+
+    // Each string is followed by a NUL terminator. The 32-bit lengths cannot overflow the sum, and
+    // the body length is checked against the remaining size rather than added to it.
+    uint64_t prefix = (uint64_t)sizeof(header) + header.url_len + header.etag_len +
+                      header.last_modified_len + header.headers_len + 5;
+    if (prefix > len || header.body_len != len - prefix) {
+        goto fail;
+    }
+
+    // Different URLs can hash to the same file, so the URL is stored to detect collisions.
+    const char *ptr = data + sizeof(header);
+    if (header.url_len != strlen(url) || memcmp(ptr, url, header.url_len) != 0) {
+        goto fail;
+    }
+    ptr += header.url_len + 1;
+
+    entry->etag = ptr;
+    ptr += header.etag_len + 1;
+    entry->last_modified = ptr;
+    ptr += header.last_modified_len + 1;
+    entry->headers = ptr;
+    entry->headers_len = header.headers_len;
+    ptr += header.headers_len + 1;
+    entry->body = ptr;
+    entry->body_len = header.body_len;
+
+    entry->data = data;
+    entry->len = len;
+    return true;
+
+fail:
+    free(data);
+    return false;
+}
+
+static void
+cache_entry_store(struct http_request *req) {
+    const char *etag = "", *last_modified = "", *cache_control = NULL;
+    size_t etag_len = 0, last_modified_len = 0, cache_control_len = 0;
+
+    bool has_etag = find_header(req, "etag", &etag, &etag_len);
+    bool has_last_modified = find_header(req, "last-modified", &last_modified, &last_modified_len);
+    find_header(req, "cache-control", &cache_control, &cache_control_len);
+
+    // Responses which cannot be revalidated would never produce a 304, so they are not stored.
+    bool no_store = false;
+    for (size_t i = 0; cache_control && i + 8 <= cache_control_len; i++) {
+        if (strncasecmp(cache_control + i, "no-store", 8) == 0) {
+            no_store = true;
+            break;
+        }
+    }
+    if ((!has_etag && !has_last_modified) || no_store) {
+        if (req->cached.data) {
+            unlink(req->cache_path);
+        }
+        return;
+    }
+
+    size_t url_len = strlen(req->url);
+    struct http_cache_header header = {
+        .version = CACHE_VERSION,
+        .url_len = url_len,
+        .etag_len = etag_len,
+        .last_modified_len = last_modified_len,
+        .headers_len = req->response_headers.size,
+        .body_len = req->response.size,
+    };
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+
+    size_t len = sizeof(header) + url_len + etag_len + last_modified_len +
+                 req->response_headers.size + req->response.size + 5;
+    char *data = malloc(len);
+    check_alloc(data);
+
+    char *ptr = data;
+    memcpy(ptr, &header, sizeof(header));
+    ptr += sizeof(header);
+
+    const struct {
+        const char *data;
+        size_t len;
+    } fields[] = {
+        {req->url, url_len},
+        {etag, etag_len},
+        {last_modified, last_modified_len},
+        {req->response_headers.data, req->response_headers.size},
+        {req->response.data, req->response.size},
+    };
+    for (size_t i = 0; i < STATIC_ARRLEN(fields); i++) {
+        if (fields[i].len > 0) {
+            memcpy(ptr, fields[i].data, fields[i].len);
+        }
+        ptr += fields[i].len;
+        *ptr++ = '\0';
+    }
+
+    util_cache_write(req->cache_path, data, len);
+    free(data);
 }
 
 static bool
-request_queue_is_full(struct Http_client *client) {
-    return ((client->request_write_pos + 1) % MAX_QUEUED_RESPONSES) == client->request_read_pos;
+cache_finish(struct http_request *req) {
+    // This is called on the worker thread.
+    if (req->status == 304 && req->cached.data) {
+        // The 304 carries no body and only some of the original headers, so the response is
+        // replaced with the stored one. The cached headers are copied out first, then the cached
+        // body is moved to the start of the entry's buffer, which becomes the response buffer.
+        req->response_headers.size = 0;
+        if (!buffer_append(&req->response_headers, req->cached.headers, req->cached.headers_len)) {
+            ww_log(LOG_ERROR, "failed to allocate cached HTTP headers");
+        }
+
+        free(req->response.data);
+        memmove(req->cached.data, req->cached.body, req->cached.body_len);
+        req->response.data = req->cached.data;
+        req->response.size = req->cached.body_len;
+        req->response.cap = req->cached.len;
+        req->cached.data = NULL;
+
+        req->status = 200;
+        return true;
+    }
+
+    if (req->status == 200) {
+        cache_entry_store(req);
+    }
+    return false;
+}
+
+static void
+push_body(lua_State *L, struct http_request *req) {
+    // The body is pushed straight from the request's buffer, which is the only copy made after
+    // curl hands the data over.
+    if (req->response.data) {
+        lua_pushlstring(L, req->response.data, req->response.size);
+    } else {
+        lua_pushstring(L, "");
+    }
 }
 
 static bool
-request_queue_is_empty(struct Http_client *client) {
-    return client->request_write_pos == client->request_read_pos;
+json_build_step(struct json_build *build, struct json_doc *doc, uint32_t budget) {
+    // The nodes are visited in document order. Each finished value is attached to the innermost
+    // unfinished container, which may in turn finish that container. Returns true once the root
+    // value has been built, at which point it is the only value on the build thread's stack.
+    lua_State *T = build->T;
+
+    for (uint32_t i = 0; i < budget; i++) {
+        // The parser limits nesting depth, so the stack never holds more than a key and a
+        // container for each level.
+        if (!lua_checkstack(T, 3)) {
+            ww_panic("failed to grow Lua stack");
+        }
+
+        struct json_node *node = &doc->nodes[build->idx++];
+        switch (node->type) {
+        case JSON_NULL:
+            lua_pushnil(T);
+            break;
+        case JSON_FALSE:
+        case JSON_TRUE:
+            lua_pushboolean(T, node->type == JSON_TRUE);
+            break;
+        case JSON_NUMBER:
+            lua_pushnumber(T, node->number);
+            break;
+        case JSON_STRING:
+            lua_pushlstring(T, doc->strings + node->string.offset, node->string.len);
+            break;
+        case JSON_ARRAY:
+        case JSON_OBJECT:
+            if (node->type == JSON_ARRAY) {
+                lua_createtable(T, node->container.count, 0);
+            } else {
+                lua_createtable(T, 0, node->container.count);
+            }
+            if (node->container.end != build->idx) {
+                build->frames[build->depth++] = (struct json_frame){
+                    .end = node->container.end,
+                    .object = node->type == JSON_OBJECT,
+                };
+                continue;
+            }
+            break;
+        }
+
+        for (;;) {
+            if (build->depth == 0) {
+                return true;
+            }
+
+            struct json_frame *frame = &build->frames[build->depth - 1];
+            if (!frame->object) {
+                lua_rawseti(T, -2, ++frame->n);
+            } else if (frame->n++ % 2 == 0) {
+                // This is a key, which stays on the stack until its value has been built.
+                break;
+            } else {
+                lua_rawset(T, -3);
+            }
+
+            if (frame->end != build->idx) {
+                break;
+            }
+            build->depth--;
+        }
+    }
+
+    return false;
 }
 
 static void
-response_queue_init(struct response_queue *q) {
-    if (!q)
-        return;
-    for (int i = 0; i < MAX_QUEUED_RESPONSES; i++) {
-        free(q->responses[i]);
-        q->responses[i] = NULL;
+wake_main(struct http_engine *engine) {
+    uint64_t val = 1;
+    if (write(engine->worker.fd, &val, sizeof(val)) != sizeof(val)) {
+        ww_log_errno(LOG_ERROR, "failed to signal HTTP worker eventfd");
     }
-    q->write_pos = 0;
-    q->read_pos = 0;
 }
 
 static void
-request_queue_init(struct Http_client *client) {
-    if (!client)
-        return;
-    for (int i = 0; i < MAX_QUEUED_RESPONSES; i++) {
-        free(client->pending_requests[i]);
-        client->pending_requests[i] = NULL;
+build_start(struct http_request *req) {
+    lua_State *L = req->client->vm->L;
+
+    // Building is driven by the worker eventfd, which is not otherwise signalled for requests
+    // which were parsed on the main thread (when the worker thread could not be started).
+    if (wl_list_empty(&engine->building)) {
+        wake_main(engine);
     }
-    client->request_write_pos = 0;
-    client->request_read_pos = 0;
+
+    req->state = REQUEST_BUILDING;
+    wl_list_insert(engine->building.prev, &req->job_link);
+
+    req->build.frames = zalloc(JSON_MAX_DEPTH + 1, sizeof(*req->build.frames));
+    engine->build_current = req;
+    req->build.T = lua_newthread(L);
+    req->build.ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    engine->build_current = NULL;
 }
 
 static void
-response_queue_push(struct Http_client *client, const char *response, size_t response_len,
-                    char *url) {
-    pthread_mutex_lock(&client->queue_mutex);
-    struct response_queue *q = &client->response_queue;
-
-    if (response_queue_is_full(q)) {
-        ww_log(LOG_WARN, "Response queue full for client %d. Dropping response.", client->index);
-        pthread_mutex_unlock(&client->queue_mutex);
+build_continue(void) {
+    // Only one step is taken per event loop iteration, across all requests, so that the worst-case
+    // delay added to the compositor is bounded regardless of how many large responses are pending.
+    if (wl_list_empty(&engine->building)) {
         return;
     }
 
-    struct queued_response *qr = malloc(sizeof(*qr));
-    if (!qr) {
-        ww_log(LOG_ERROR, "malloc failed for queued_response");
-        pthread_mutex_unlock(&client->queue_mutex);
-        return;
+    struct http_request *req = wl_container_of(engine->building.next, req, job_link);
+
+    engine->build_current = req;
+    bool done = req->client && json_build_step(&req->build, req->doc, JSON_BUILD_STEP);
+    engine->build_current = NULL;
+
+    wl_list_remove(&req->job_link);
+    if (!req->client) {
+        luaL_unref(req->build.T, LUA_REGISTRYINDEX, req->build.ref);
+        request_free(req);
+    } else if (done) {
+        deliver_response(req);
+    } else {
+        wl_list_insert(engine->building.prev, &req->job_link);
     }
 
-    qr->data = malloc(response_len);
-    if (!qr->data) {
-        ww_log(LOG_ERROR, "malloc failed for response data");
-        free(qr);
-        pthread_mutex_unlock(&client->queue_mutex);
-        return;
+    if (engine && !wl_list_empty(&engine->building)) {
+        wake_main(engine);
+    }
+}
+
+static void
+flush_streams(void) {
+    // Lua callbacks may destroy any request (including ones in this list), so the list is consumed
+    // from the front rather than iterated.
+    while (engine && !wl_list_empty(&engine->streams)) {
+        struct http_request *req = wl_container_of(engine->streams.next, req, stream_link);
+        struct Http_client *client = req->client;
+        lua_State *L = client->vm->L;
+
+        wl_list_remove(&req->stream_link);
+        wl_list_init(&req->stream_link);
+
+        lua_rawgeti(L, LUA_REGISTRYINDEX, request_callback(req));
+        push_body(L, req);
+        lua_pushstring(L, req->url);
+        lua_pushboolean(L, false);
+
+        req->response.size = 0;
+
+        config_vm_try_callback_argn(client->vm, 3);
     }
+}
 
-    memcpy(qr->data, response, response_len);
-    qr->size = response_len;
+static void
+push_headers(lua_State *L, struct http_request *req) {
+    lua_newtable(L);
+
+    char *data = req->response_headers.data;
+    size_t size = req->response_headers.size;
+
+    size_t pos = 0;
+    while (pos < size) {
+        char *line = data + pos;
+        char *eol = memchr(line, '\n', size - pos);
+        size_t len = eol ? (size_t)(eol - line) : size - pos;
+        pos += len + 1;
+
+        char *colon = memchr(line, ':', len);
+        if (!colon || colon == line) {
+            // Status lines and the blank line terminating the headers have no name.
+            continue;
+        }
 
-    qr->url = strdup(url);
+        // Header names are case-insensitive, so they are lowercased to give Lua a single key to
+        // look up. The buffer is not used again, so this is done in place.
+        for (char *c = line; c < colon; c++) {
+            *c = tolower((unsigned char)*c);
+        }
+        lua_pushlstring(L, line, colon - line);
 
-    q->responses[q->write_pos] = qr;
-    q->write_pos = (q->write_pos + 1) % MAX_QUEUED_RESPONSES;
+        const char *value = colon + 1;
+        const char *value_end = line + len;
+        while (value < value_end && isspace((unsigned char)*value)) {
+            value++;
+        }
+        while (value_end > value && isspace((unsigned char)value_end[-1])) {
+            value_end--;
+        }
 
-    pushed_count++;
+        // Repeated headers are combined into a comma-separated list, as permitted by RFC 9110.
+        lua_pushvalue(L, -1);
+        lua_rawget(L, -3);
+        if (lua_isstring(L, -1)) {
+            lua_pushstring(L, ", ");
+            lua_pushlstring(L, value, value_end - value);
+            lua_concat(L, 3);
+        } else {
+            lua_pop(L, 1);
+            lua_pushlstring(L, value, value_end - value);
+        }
+        lua_rawset(L, -3);
+    }
+}
 
-    pthread_mutex_unlock(&client->queue_mutex);
+static void
+push_timing(lua_State *L, CURL *curl) {
+    static const struct {
+        const char *name;
+        CURLINFO info;
+    } fields[] = {
+        {"dns", CURLINFO_NAMELOOKUP_TIME_T},  {"connect", CURLINFO_CONNECT_TIME_T},
+        {"tls", CURLINFO_APPCONNECT_TIME_T},  {"ttfb", CURLINFO_STARTTRANSFER_TIME_T},
+        {"total", CURLINFO_TOTAL_TIME_T},
+    };
+
+    // Each time is measured from the start of the request, in milliseconds.
+    lua_createtable(L, 0, STATIC_ARRLEN(fields));
+    for (size_t i = 0; i < STATIC_ARRLEN(fields); i++) {
+        curl_off_t us = 0;
+        curl_easy_getinfo(curl, fields[i].info, &us);
+        lua_pushnumber(L, (double)us / 1000.0);
+        lua_setfield(L, -2, fields[i].name);
+    }
 }
 
 static void
-request_queue_push(struct Http_client *client, const char *url) {
-    pthread_mutex_lock(&client->request_mutex);
+push_response_body(lua_State *L, struct http_request *req) {
+    // If the body was not valid JSON (or was too large to convert), the raw body is passed to Lua
+    // instead.
+    if (req->state == REQUEST_BUILDING) {
+        lua_xmove(req->build.T, L, 1);
+    } else {
+        push_body(L, req);
+    }
+}
 
-    if (request_queue_is_full(client)) {
-        ww_log(LOG_WARN, "Request queue full for client %d. Dropping request.", client->index);
-        pthread_mutex_unlock(&client->request_mutex);
-        return;
+static void
+deliver_response(struct http_request *req) {
+    struct Http_client *client = req->client;
+    struct config_vm *vm = client->vm;
+    lua_State *L = vm->L;
+    CURLcode result = req->result;
+    bool cached = req->from_cache;
+
+    // The request is detached from its client before the callback is invoked, since the callback
+    // may close the client.
+    wl_list_remove(&req->link);
+    wl_list_remove(&req->stream_link);
+    wl_list_init(&req->stream_link);
+
+    // A per-request callback is only used once, so its reference can be dropped as soon as the
+    // function is on the stack.
+    lua_rawgeti(L, LUA_REGISTRYINDEX, request_callback(req));
+    luaL_unref(L, LUA_REGISTRYINDEX, req->callback);
+
+    int nargs;
+    if (req->stream) {
+        // Streaming callbacks receive a third argument to indicate that the response is complete.
+        if (result != CURLE_OK) {
+            lua_pushstring(L, curl_easy_strerror(result));
+        } else {
+            push_body(L, req);
+        }
+        lua_pushstring(L, req->url);
+        lua_pushboolean(L, true);
+        nargs = 3;
+    } else if (req->callback != LUA_NOREF) {
+        // Responses served from the cache are reported as the 200 response they were stored from.
+        lua_createtable(L, 0, 7);
+        lua_pushstring(L, req->url);
+        lua_setfield(L, -2, "url");
+        lua_pushinteger(L, req->status);
+        lua_setfield(L, -2, "status");
+        push_headers(L, req);
+        lua_setfield(L, -2, "headers");
+        push_timing(L, req->curl);
+        lua_setfield(L, -2, "timing");
+        lua_pushboolean(L, cached);
+        lua_setfield(L, -2, "cached");
+        if (result != CURLE_OK) {
+            lua_pushstring(L, curl_easy_strerror(result));
+            lua_setfield(L, -2, "error");
+        } else {
+            push_response_body(L, req);
+            lua_setfield(L, -2, "body");
+        }
+        nargs = 1;
+    } else {
+        if (result != CURLE_OK) {
+            lua_pushstring(L, curl_easy_strerror(result));
+        } else {
+            push_response_body(L, req);
+        }
+        lua_pushstring(L, req->url);
+        nargs = 2;
     }
 
-    char *copy = strdup(url);
-    if (!copy) {
-        ww_log(LOG_ERROR, "strdup failed");
-        pthread_mutex_unlock(&client->request_mutex);
+    if (req->state == REQUEST_BUILDING) {
+        luaL_unref(L, LUA_REGISTRYINDEX, req->build.ref);
+    }
+    request_free(req);
+
+    if (!config_vm_try_callback_argn(vm, nargs)) {
+        ww_log(LOG_WARN, "HTTP callback did not consume response");
+    }
+}
+
+static void
+finish_parsed(struct http_request *req) {
+    // Called on the main thread once the worker has parsed the body.
+    if (!req->doc) {
+        deliver_response(req);
         return;
     }
 
-    client->pending_requests[client->request_write_pos] = copy;
-    client->request_write_pos = (client->request_write_pos + 1) % MAX_QUEUED_RESPONSES;
+    if (req->doc->len > JSON_MAX_NODES) {
+        ww_log(LOG_WARN, "JSON response from '%s' is too large to convert (%zu nodes)", req->url,
+               req->doc->len);
+        deliver_response(req);
+        return;
+    }
 
-    // Signal the worker thread that a new request is available
-    pthread_cond_signal(&client->request_cond);
-    pthread_mutex_unlock(&client->request_mutex);
+    build_start(req);
 }
 
-static char *
-request_queue_pop(struct Http_client *client) {
-    pthread_mutex_lock(&client->request_mutex);
+static bool
+request_start(struct http_request *req) {
+    struct Http_client *client = req->client;
+
+    if (req->cached.data) {
+        struct {
+            const char *name, *value;
+        } validators[] = {
+            {"If-None-Match: ", req->cached.etag},
+            {"If-Modified-Since: ", req->cached.last_modified},
+        };
+        for (size_t i = 0; i < STATIC_ARRLEN(validators); i++) {
+            if (!*validators[i].value) {
+                continue;
+            }
+
+            str header = str_new();
+            str_append(&header, validators[i].name);
+            str_append(&header, validators[i].value);
+
+            struct curl_slist *headers = curl_slist_append(req->headers, header);
+            check_alloc(headers);
+            req->headers = headers;
+            str_free(header);
+        }
 
-    while (request_queue_is_empty(client) && !client->should_exit) {
-        pthread_cond_wait(&client->request_cond, &client->request_mutex);
+        client->cache.revalidations++;
     }
 
-    if (client->should_exit) {
-        pthread_mutex_unlock(&client->request_mutex);
-        return NULL;
+    if (req->headers) {
+        curl_easy_setopt(req->curl, CURLOPT_HTTPHEADER, req->headers);
+    }
+
+    req->state = REQUEST_ACTIVE;
+    CURLMcode ret = curl_multi_add_handle(client->engine->multi, req->curl);
+    if (ret != CURLM_OK) {
+        ww_log(LOG_ERROR, "Failed to start HTTP request: %s", curl_multi_strerror(ret));
+        return false;
     }
 
-    char *url = client->pending_requests[client->request_read_pos];
-    client->pending_requests[client->request_read_pos] = NULL;
-    client->request_read_pos = (client->request_read_pos + 1) % MAX_QUEUED_RESPONSES;
+    return true;
+}
 
-    pthread_mutex_unlock(&client->request_mutex);
-    return url;
+static void
+job_run(struct http_request *req) {
+    // This is called on the worker thread, unless the worker could not be started. The main thread
+    // does not touch a request while it is on the worker thread, other than to detach it from its
+    // client.
+    switch (req->job) {
+    case JOB_LOAD:
+        cache_entry_load(req->cache_path, req->url, &req->cached);
+        break;
+    case JOB_FINISH:
+        if (req->cache_path) {
+            req->from_cache = cache_finish(req);
+        }
+        if (req->json) {
+            req->doc =
+                json_parse(req->response.data ? req->response.data : "", req->response.size);
+        }
+        break;
+    }
 }
 
 static void
-response_queue_cleanup(struct response_queue *q) {
-    if (!q)
-        return;
-    for (int i = 0; i < MAX_QUEUED_RESPONSES; i++) {
-        if (q->responses[i]) {
-            free(q->responses[i]->data);
-            free(q->responses[i]->url);
-            free(q->responses[i]);
-            q->responses[i] = NULL;
+job_done(struct http_request *req) {
+    // This is called on the main thread once job_run has returned.
+    switch (req->job) {
+    case JOB_LOAD:
+        if (!request_start(req)) {
+            request_destroy(req);
+        }
+        break;
+    case JOB_FINISH:
+        if (req->cache_path) {
+            if (req->from_cache) {
+                req->client->cache.hits++;
+            } else {
+                req->client->cache.misses++;
+            }
         }
+        finish_parsed(req);
+        break;
     }
-    q->write_pos = 0;
-    q->read_pos = 0;
 }
 
 static void
-request_queue_cleanup(struct Http_client *client) {
-    if (!client)
+worker_submit(struct http_request *req, enum http_job job) {
+    req->state = REQUEST_WORKER;
+    req->job = job;
+
+    if (!engine->worker.running) {
+        job_run(req);
+        job_done(req);
         return;
-    for (int i = 0; i < MAX_QUEUED_RESPONSES; i++) {
-        free(client->pending_requests[i]);
-        client->pending_requests[i] = NULL;
     }
-    client->request_write_pos = 0;
-    client->request_read_pos = 0;
+
+    pthread_mutex_lock(&engine->worker.mutex);
+    wl_list_insert(engine->worker.queue.prev, &req->job_link);
+    pthread_cond_signal(&engine->worker.cond);
+    pthread_mutex_unlock(&engine->worker.mutex);
 }
 
-static void *
-http_thread(void *arg) {
-    struct Http_client *client = arg;
-    if (!client || !client->curl) {
-        ww_log(LOG_ERROR, "Invalid client in HTTP thread");
-        return NULL;
+static void
+complete_request(struct http_request *req, CURLcode result) {
+    curl_multi_remove_handle(engine->multi, req->curl);
+    req->result = result;
+    curl_easy_getinfo(req->curl, CURLINFO_RESPONSE_CODE, &req->status);
+
+    if (result != CURLE_OK) {
+        ww_log(LOG_WARN, "HTTP request failed: %s", curl_easy_strerror(result));
+        deliver_response(req);
+        return;
     }
 
-    while (!client->should_exit) {
-        char *url = request_queue_pop(client);
-        if (!url)
+    if (req->cache_path || req->json) {
+        worker_submit(req, JOB_FINISH);
+    } else {
+        deliver_response(req);
+    }
+}
+
+static void
+check_multi_info(void) {
+    CURLMsg *msg;
+    int pending;
+
+    while (engine && (msg = curl_multi_info_read(engine->multi, &pending))) {
+        if (msg->msg != CURLMSG_DONE) {
+            continue;
+        }
+
+        struct http_request *req = NULL;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **)&req);
+        complete_request(req, msg->data.result);
+    }
+}
+
+static void *
+worker_run(void *data) {
+    struct http_engine *engine = data;
+
+    pthread_mutex_lock(&engine->worker.mutex);
+    for (;;) {
+        while (!engine->worker.should_exit && wl_list_empty(&engine->worker.queue)) {
+            pthread_cond_wait(&engine->worker.cond, &engine->worker.mutex);
+        }
+        if (engine->worker.should_exit) {
             break;
+        }
+
+        struct http_request *req = wl_container_of(engine->worker.queue.next, req, job_link);
+        wl_list_remove(&req->job_link);
+        pthread_mutex_unlock(&engine->worker.mutex);
 
-        struct response_buffer response = {0};
+        job_run(req);
 
-        // configure curl
-        curl_easy_setopt(client->curl, CURLOPT_URL, url);
-        curl_easy_setopt(client->curl, CURLOPT_WRITEFUNCTION, write_callback);
-        curl_easy_setopt(client->curl, CURLOPT_WRITEDATA, &response);
-        curl_easy_setopt(client->curl, CURLOPT_FOLLOWLOCATION, 1L);
-        curl_easy_setopt(client->curl, CURLOPT_TIMEOUT, 30L);
+        pthread_mutex_lock(&engine->worker.mutex);
+        wl_list_insert(engine->worker.done.prev, &req->job_link);
+        wake_main(engine);
+    }
+    pthread_mutex_unlock(&engine->worker.mutex);
+
+    return NULL;
+}
+
+static int
+handle_worker(int32_t fd, uint32_t mask, void *data) {
+    uint64_t val;
+    if (read(fd, &val, sizeof(val)) == -1 && errno != EAGAIN) {
+        ww_log_errno(LOG_ERROR, "failed to read HTTP worker eventfd");
+    }
+
+    struct wl_list done;
+    wl_list_init(&done);
+
+    pthread_mutex_lock(&engine->worker.mutex);
+    wl_list_insert_list(&done, &engine->worker.done);
+    wl_list_init(&engine->worker.done);
+    pthread_mutex_unlock(&engine->worker.mutex);
 
-        // make request
-        CURLcode res = curl_easy_perform(client->curl);
+    // Lua callbacks may close any client, including those of requests still in this list. Those
+    // requests are detached from their client rather than freed, so they can be freed here.
+    while (!wl_list_empty(&done)) {
+        struct http_request *req = wl_container_of(done.next, req, job_link);
+        wl_list_remove(&req->job_link);
+        wl_list_init(&req->job_link);
 
-        if (res != CURLE_OK) {
-            const char *error_msg = curl_easy_strerror(res);
-            response_queue_push(client, error_msg, strlen(error_msg), url);
-            ww_log(LOG_WARN, "HTTP request failed: %s", error_msg);
-        } else if (response.data && response.size > 0) {
-            response_queue_push(client, response.data, response.size, url);
+        if (!req->client) {
+            request_free(req);
         } else {
-            const char *empty = "";
-            response_queue_push(client, empty, 0, url);
+            job_done(req);
         }
+    }
 
-        if (response.data) {
-            free(response.data);
-            response.data = NULL;
+    if (engine) {
+        build_continue();
+    }
+    return 0;
+}
+
+static void
+worker_stop(void) {
+    if (!engine->worker.running) {
+        return;
+    }
+
+    // Each job is bounded by the size of a single response or cache entry, so this does not block
+    // for long.
+    pthread_mutex_lock(&engine->worker.mutex);
+    engine->worker.should_exit = true;
+    pthread_cond_signal(&engine->worker.cond);
+    pthread_mutex_unlock(&engine->worker.mutex);
+
+    pthread_join(engine->worker.thread, NULL);
+    engine->worker.running = false;
+
+    struct wl_list *lists[] = {&engine->worker.queue, &engine->worker.done};
+    for (size_t i = 0; i < STATIC_ARRLEN(lists); i++) {
+        struct http_request *req, *tmp;
+        wl_list_for_each_safe (req, tmp, lists[i], job_link) {
+            if (!req->client) {
+                wl_list_remove(&req->job_link);
+                request_free(req);
+            }
         }
-        free(url);
     }
+}
 
-    return NULL;
+static void
+engine_destroy(void) {
+    // The worker thread is stopped first so that the remaining requests can be destroyed
+    // regardless of their state.
+    worker_stop();
+
+    struct Http_client *client, *tmp_client;
+    wl_list_for_each_safe (client, tmp_client, &engine->clients, link) {
+        struct http_request *req, *tmp_req;
+        wl_list_for_each_safe (req, tmp_req, &client->requests, link) {
+            request_destroy(req);
+        }
+
+        wl_list_remove(&client->link);
+        wl_list_init(&client->link);
+        client->engine = NULL;
+    }
+
+    // curl may still call the socket and timer callbacks while cleaning up, so the timer must not
+    // be removed until afterwards.
+    curl_multi_cleanup(engine->multi);
+    wl_event_source_remove(engine->timer);
+    wl_list_remove(&engine->on_loop_destroy.link);
+
+    wl_event_source_remove(engine->worker.src);
+    close(engine->worker.fd);
+    pthread_mutex_destroy(&engine->worker.mutex);
+    pthread_cond_destroy(&engine->worker.cond);
+
+    if (engine->cache_dir) {
+        str_free(engine->cache_dir);
+    }
+    free(engine);
+    engine = NULL;
 }
 
-struct Http_client *
-http_client_create(int callback, lua_State *L) {
-    if (!L) {
-        ww_log(LOG_ERROR, "Invalid parameters for HTTP client creation");
-        return NULL;
+static void
+on_loop_destroy(struct wl_listener *listener, void *data) {
+    // Lua objects (and therefore HTTP clients) can outlive the event loop during shutdown, so the
+    // engine must release its event sources before the loop goes away.
+    engine_destroy();
+}
+
+static int
+engine_init(struct wl_event_loop *loop) {
+    if (engine) {
+        ww_assert(engine->loop == loop);
+        return 0;
     }
 
-    // Initialize curl globally if not already done
     static bool curl_global_init_done = false;
     if (!curl_global_init_done) {
-        curl_global_init(CURL_GLOBAL_DEFAULT);
+        if (curl_global_init(CURL_GLOBAL_DEFAULT) != 0) {
+            ww_log(LOG_ERROR, "failed to initialize curl");
+            return 1;
+        }
         curl_global_init_done = true;
     }
 
-    pthread_mutex_lock(&clients_mutex);
+    struct http_engine *new_engine = zalloc(1, sizeof(*new_engine));
 
-    if (client_count >= MAX_CLIENTS) {
-        ww_log(LOG_ERROR, "Too many HTTP clients (max %d)", MAX_CLIENTS);
-        pthread_mutex_unlock(&clients_mutex);
-        return NULL;
+    new_engine->multi = curl_multi_init();
+    if (!new_engine->multi) {
+        ww_log(LOG_ERROR, "failed to create curl multi handle");
+        free(new_engine);
+        return 1;
     }
 
-    int slot = -1;
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (!all_clients[i]) {
-            slot = i;
-            break;
-        }
+    new_engine->loop = loop;
+    new_engine->timer = wl_event_loop_add_timer(loop, handle_timer, NULL);
+    check_alloc(new_engine->timer);
+
+    new_engine->worker.fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (new_engine->worker.fd == -1) {
+        ww_log_errno(LOG_ERROR, "failed to create HTTP worker eventfd");
+        wl_event_source_remove(new_engine->timer);
+        curl_multi_cleanup(new_engine->multi);
+        free(new_engine);
+        return 1;
     }
-    if (slot == -1) {
-        ww_log(LOG_ERROR, "No free HTTP client slots");
-        pthread_mutex_unlock(&clients_mutex);
-        return NULL;
+    new_engine->worker.src = wl_event_loop_add_fd(loop, new_engine->worker.fd, WL_EVENT_READABLE,
+                                                  handle_worker, NULL);
+    check_alloc(new_engine->worker.src);
+
+    pthread_mutex_init(&new_engine->worker.mutex, NULL);
+    pthread_cond_init(&new_engine->worker.cond, NULL);
+    wl_list_init(&new_engine->worker.queue);
+    wl_list_init(&new_engine->worker.done);
+
+    new_engine->on_loop_destroy.notify = on_loop_destroy;
+    wl_event_loop_add_destroy_listener(loop, &new_engine->on_loop_destroy);
+
+    wl_list_init(&new_engine->clients);
+    wl_list_init(&new_engine->streams);
+    wl_list_init(&new_engine->building);
+
+    curl_multi_setopt(new_engine->multi, CURLMOPT_SOCKETFUNCTION, socket_callback);
+    curl_multi_setopt(new_engine->multi, CURLMOPT_TIMERFUNCTION, timer_callback);
+    curl_multi_setopt(new_engine->multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+    engine = new_engine;
+
+    // Without the worker thread, cache entries are read and written and JSON bodies are parsed on
+    // the main thread instead (see worker_submit).
+    if (pthread_create(&engine->worker.thread, NULL, worker_run, engine) != 0) {
+        ww_log(LOG_ERROR, "failed to start HTTP worker thread");
+    } else {
+        engine->worker.running = true;
     }
 
-    CURL *curl = curl_easy_init();
-    if (!curl) {
-        ww_log(LOG_ERROR, "Failed to initialize curl");
-        pthread_mutex_unlock(&clients_mutex);
+    return 0;
+}
+
+struct Http_client *
+http_client_create(struct wl_event_loop *loop, int callback, lua_State *L) {
+    if (!L) {
+        ww_log(LOG_ERROR, "Invalid parameters for HTTP client creation");
         return NULL;
     }
 
-    struct Http_client *client = calloc(1, sizeof(struct Http_client));
-    if (!client) {
-        curl_easy_cleanup(curl);
-        pthread_mutex_unlock(&clients_mutex);
+    if (engine_init(loop) != 0) {
         return NULL;
     }
 
-    client->curl = curl;
+    struct Http_client *client = zalloc(1, sizeof(*client));
+
+    client->engine = engine;
     client->callback = callback;
-    client->index = slot;
-    client->thread_running = false;
-    client->should_exit = false;
-    response_queue_init(&client->response_queue);
-    request_queue_init(client);
-    pthread_mutex_init(&client->queue_mutex, NULL);
-    pthread_mutex_init(&client->request_mutex, NULL);
-    pthread_cond_init(&client->request_cond, NULL);
     client->vm = config_vm_from(L);
+    wl_list_init(&client->requests);
 
-    all_clients[slot] = client;
-    client_count++;
-
-    if (pthread_create(&client->thread_id, NULL, http_thread, client) != 0) {
-        ww_log(LOG_ERROR, "Failed to create HTTP thread");
-        all_clients[slot] = NULL;
-        client_count--;
-        response_queue_cleanup(&client->response_queue);
-        request_queue_cleanup(client);
-        curl_easy_cleanup(curl);
-        pthread_mutex_destroy(&client->queue_mutex);
-        pthread_mutex_destroy(&client->request_mutex);
-        pthread_cond_destroy(&client->request_cond);
-        free(client);
-        pthread_mutex_unlock(&clients_mutex);
-        return NULL;
-    }
+    wl_list_insert(&engine->clients, &client->link);
 
-    client->thread_running = true;
-    pthread_mutex_unlock(&clients_mutex);
     return client;
 }
 
 void
-http_client_get(struct Http_client *client, const char *url) {
-    if (!client || !client->curl || !url) {
-        ww_log(LOG_WARN, "Invalid parameters for HTTP GET");
-        return;
-    }
+http_client_request(struct Http_client *client, const struct http_request_options *options) {
+    lua_State *L = client->vm->L;
 
-    if (!client->thread_running) {
+    if (!client->engine) {
         ww_log(LOG_WARN, "Cannot send request to stopped HTTP client");
+        luaL_unref(L, LUA_REGISTRYINDEX, options->callback);
         return;
     }
 
-    request_queue_push(client, url);
-}
-
-void
-http_client_destroy(struct Http_client *client) {
-    if (!client)
+    CURL *curl = curl_easy_init();
+    if (!curl) {
+        ww_log(LOG_ERROR, "Failed to initialize curl");
+        luaL_unref(L, LUA_REGISTRYINDEX, options->callback);
         return;
-
-    if (client->thread_running) {
-        // Signal the thread to exit
-        pthread_mutex_lock(&client->request_mutex);
-        client->should_exit = true;
-        pthread_cond_signal(&client->request_cond);
-        pthread_mutex_unlock(&client->request_mutex);
-
-        // Wait for thread to finish
-        pthread_join(client->thread_id, NULL);
-        client->thread_running = false;
     }
 
-    if (client->curl) {
-        curl_easy_cleanup(client->curl);
-        client->curl = NULL;
+    struct http_request *req = zalloc(1, sizeof(*req));
+    req->client = client;
+    req->curl = curl;
+    req->url = strdup(options->url);
+    check_alloc(req->url);
+    req->callback = options->callback;
+    req->stream = options->stream;
+    req->json = options->json && !options->stream;
+    wl_list_init(&req->stream_link);
+    wl_list_init(&req->job_link);
+    req->build.ref = LUA_NOREF;
+
+    if (options->cache) {
+        if (options->stream || options->body ||
+            (options->method && strcmp(options->method, "GET") != 0)) {
+            ww_log(LOG_WARN, "HTTP cache can only be used for non-streaming GET requests");
+        } else {
+            // The directory is only created once, and reading the entry is left to the worker.
+            if (!engine->cache_dir) {
+                engine->cache_dir = util_cache_dir("http");
+            }
+            if (engine->cache_dir) {
+                req->cache_path = util_cache_file(engine->cache_dir, req->url);
+            }
+        }
     }
 
-    response_queue_cleanup(&client->response_queue);
-    request_queue_cleanup(client);
-
-    pthread_mutex_destroy(&client->queue_mutex);
-    pthread_mutex_destroy(&client->request_mutex);
-    pthread_cond_destroy(&client->request_cond);
-
-    luaL_unref(client->vm->L, LUA_REGISTRYINDEX, client->callback);
+    for (size_t i = 0; i < options->headers_len; i++) {
+        struct curl_slist *headers = curl_slist_append(req->headers, options->headers[i]);
+        check_alloc(headers);
+        req->headers = headers;
+    }
 
-    pthread_mutex_lock(&clients_mutex);
-    if (client->index >= 0 && client->index < MAX_CLIENTS) {
-        all_clients[client->index] = NULL;
-        client_count--;
+    curl_easy_setopt(curl, CURLOPT_URL, req->url);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, req);
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, req);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS,
+                     options->timeout_ms > 0 ? options->timeout_ms : DEFAULT_TIMEOUT_MS);
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+
+    if (req->callback != LUA_NOREF || req->cache_path) {
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, req);
+    }
+    if (options->body) {
+        // Setting a body implicitly makes the request a POST unless another method is given.
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)options->body_len);
+        curl_easy_setopt(curl, CURLOPT_COPYPOSTFIELDS, options->body);
+    }
+    if (options->method) {
+        if (strcmp(options->method, "HEAD") == 0) {
+            curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+        } else if (strcmp(options->method, "GET") == 0 && !options->body) {
+            curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
+        } else {
+            curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, options->method);
+        }
     }
-    pthread_mutex_unlock(&clients_mutex);
 
-    free(client);
+    // The request is started once its cache entry has been read, if it has one.
+    wl_list_insert(client->requests.prev, &req->link);
+    if (req->cache_path) {
+        worker_submit(req, JOB_LOAD);
+    } else if (!request_start(req)) {
+        request_destroy(req);
+    }
 }
 
 void
-manage_new_responses() {
-    struct Http_client *clients_snapshot[MAX_CLIENTS];
-    int count = 0;
+http_client_destroy(struct Http_client *client) {
+    if (!client)
+        return;
 
-    pthread_mutex_lock(&clients_mutex);
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (all_clients[i]) {
-            clients_snapshot[count++] = all_clients[i];
-        }
+    struct http_request *req, *tmp;
+    wl_list_for_each_safe (req, tmp, &client->requests, link) {
+        request_destroy(req);
     }
-    pthread_mutex_unlock(&clients_mutex);
 
-    for (int i = 0; i < count; i++) {
-        struct Http_client *client = clients_snapshot[i];
-        pthread_mutex_lock(&client->queue_mutex);
-        struct response_queue *q = &client->response_queue;
-
-        while (!response_queue_is_empty(q)) {
-            struct queued_response *qr = q->responses[q->read_pos];
-            q->responses[q->read_pos] = NULL;
-            q->read_pos = (q->read_pos + 1) % MAX_QUEUED_RESPONSES; // Move read position
-
-            lua_rawgeti(client->vm->L, LUA_REGISTRYINDEX, client->callback);
-            lua_pushlstring(client->vm->L, qr->data, qr->size);
-            lua_pushstring(client->vm->L, qr->url);
-
-            bool consumed = config_vm_try_callback_args2(client->vm);
-
-            if (!consumed) {
-                ww_log(LOG_WARN, "HTTP callback did not consume response");
-            }
-
-            free(qr->data);
-            free(qr->url);
-            free(qr);
-            popped_count++;
-        }
+    luaL_unref(client->vm->L, LUA_REGISTRYINDEX, client->callback);
 
-        pthread_mutex_unlock(&client->queue_mutex);
-    }
+    wl_list_remove(&client->link);
+    free(client);
 }
@@ -4,6 +4,8 @@
 #include "server/ui.h"
 #include "server/wl_seat.h"
 #include "util/alloc.h"
+#include "util/cache.h"
+#include "util/debug.h"
 #include "util/log.h"
 #include "util/prelude.h"
 #include "util/str.h"
@@ -12,13 +14,52 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 
+/*
+ * The result of scanning each mod jar is stored in an index in the cache directory, one per mods
+ * directory. On later launches, only jars whose size or modification time has changed need to be
+ * opened again.
+ *
+ * Each index is laid out as follows:
+ *
+ *   struct mod_index_header
+ *   struct mod_index_entry, char name[entry.name_len] (repeated header.count times)
+ */
+
+#define MOD_INDEX_MAGIC 0x444D5757 // "WWMD"
+#define MOD_INDEX_VERSION 1
+
+struct mod_index_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+struct mod_index_entry {
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    int64_t size;
+    uint32_t name_len;
+    uint32_t stateoutput;
+};
+
+struct mod_index {
+    char *data;
+    size_t len, cap;
+    uint32_t count;
+};
+
 static inline int
 parse_percent(char data[static 3]) {
     int x = data[0] - '0';
@@ -80,18 +121,17 @@ process_mod_zip(const char *path, bool *stateoutput) {
         return 1;
     }
 
-    const char *filename;
-    while ((filename = zip_next(zip))) {
-        if (strcmp(filename, "me/voidxwalker/worldpreview/StateOutputHelper.class") == 0) {
-            // WorldPreview with state output (3.x - 4.x)
-            *stateoutput = true;
-            break;
-        } else if (strcmp(filename, "xyz/tildejustin/stateoutput/") == 0) {
-            // Legacy state-output
-            *stateoutput = true;
-            break;
-        } else if (strcmp(filename, "dev/tildejustin/stateoutput/") == 0) {
-            // state-output
+    static const char *markers[] = {
+        // WorldPreview with state output (3.x - 4.x)
+        "me/voidxwalker/worldpreview/StateOutputHelper.class",
+        // Legacy state-output
+        "xyz/tildejustin/stateoutput/",
+        // state-output
+        "dev/tildejustin/stateoutput/",
+    };
+
+    for (size_t i = 0; i < STATIC_ARRLEN(markers); i++) {
+        if (zip_contains(zip, markers[i])) {
             *stateoutput = true;
             break;
         }
@@ -101,8 +141,134 @@ process_mod_zip(const char *path, bool *stateoutput) {
     return 0;
 }
 
+static void
+mod_index_append(struct mod_index *index, const void *data, size_t len) {
+    if (index->len + len > index->cap) {
+        size_t cap = index->cap ? index->cap : 4096;
+        while (cap < index->len + len) {
+            cap *= 2;
+        }
+
+        index->data = realloc(index->data, cap);
+        check_alloc(index->data);
+        index->cap = cap;
+    }
+
+    memcpy(index->data + index->len, data, len);
+    index->len += len;
+}
+
+static void
+mod_index_add(struct mod_index *index, const char *name, const struct stat *stat,
+              bool stateoutput) {
+    if (index->len == 0) {
+        struct mod_index_header header = {0};
+        mod_index_append(index, &header, sizeof(header));
+    }
+
+    struct mod_index_entry entry = {
+        .mtime_sec = stat->st_mtim.tv_sec,
+        .mtime_nsec = stat->st_mtim.tv_nsec,
+        .size = stat->st_size,
+        .name_len = strlen(name),
+        .stateoutput = stateoutput,
+    };
+    mod_index_append(index, &entry, sizeof(entry));
+    mod_index_append(index, name, entry.name_len);
+
+    index->count++;
+}
+
+static void
+mod_index_load(struct mod_index *index, const char *path) {
+    size_t len;
+    char *data = util_cache_read(path, &len);
+    if (!data) {
+        return;
+    }
+
+    // Validate the whole index up front so that lookups do not need to.
+    struct mod_index_header header;
+    if (len < sizeof(header)) {
+        goto fail;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != MOD_INDEX_MAGIC || header.version != MOD_INDEX_VERSION) {
+        goto fail;
+    }
+
+    size_t offset = sizeof(header);
+    for (uint32_t i = 0; i < header.count; i++) {
+        struct mod_index_entry entry;
+        if (len - offset < sizeof(entry)) {
+            goto fail;
+        }
+        memcpy(&entry, data + offset, sizeof(entry));
+        offset += sizeof(entry);
+
+        if (len - offset < entry.name_len) {
+            goto fail;
+        }
+        offset += entry.name_len;
+    }
+    if (offset != len) {
+        goto fail;
+    }
+
+    index->data = data;
+    index->len = index->cap = len;
+    index->count = header.count;
+    return;
+
+fail:
+    ww_log(LOG_WARN, "ignoring invalid mod index '%s'", path);
+    free(data);
+}
+
+static int
+mod_index_find(struct mod_index *index, const char *name, const struct stat *stat) {
+    size_t name_len = strlen(name);
+    size_t offset = sizeof(struct mod_index_header);
+
+    for (uint32_t i = 0; i < index->count; i++) {
+        struct mod_index_entry entry;
+        memcpy(&entry, index->data + offset, sizeof(entry));
+        offset += sizeof(entry);
+
+        const char *entry_name = index->data + offset;
+        offset += entry.name_len;
+
+        bool match = entry.name_len == name_len && memcmp(entry_name, name, name_len) == 0 &&
+                     entry.mtime_sec == (int64_t)stat->st_mtim.tv_sec &&
+                     entry.mtime_nsec == (int64_t)stat->st_mtim.tv_nsec &&
+                     entry.size == (int64_t)stat->st_size;
+        if (match) {
+            return entry.stateoutput;
+        }
+    }
+
+    return -1;
+}
+
+static void
+mod_index_save(struct mod_index *index, const char *path) {
+    if (index->len == 0) {
+        struct mod_index_header header = {0};
+        mod_index_append(index, &header, sizeof(header));
+    }
+
+    struct mod_index_header header = {
+        .magic = MOD_INDEX_MAGIC,
+        .version = MOD_INDEX_VERSION,
+        .count = index->count,
+    };
+    memcpy(index->data, &header, sizeof(header));
+
+    util_cache_write(path, index->data, index->len);
+}
+
 static int
-get_mods(const char *dirname, bool *stateoutput) {
+get_mods(const char *dirname, atomic_bool *cancel, bool *stateoutput) {
     str dirpath = str_new();
     str_append(&dirpath, dirname);
     str_append(&dirpath, "/mods/");
@@ -113,8 +279,21 @@ get_mods(const char *dirname, bool *stateoutput) {
         goto fail_dir;
     }
 
+    // The index is rebuilt from scratch on every scan so that entries for removed jars are
+    // dropped. It is only written back if any jar had to be opened.
+    struct mod_index old_index = {0}, new_index = {0};
+    str index_path = util_cache_path("mods", dirpath);
+    if (index_path) {
+        mod_index_load(&old_index, index_path);
+    }
+    bool changed = false;
+
     struct dirent *dirent;
     while ((dirent = readdir(dir))) {
+        if (atomic_load(cancel)) {
+            goto fail_zip;
+        }
+
         if (dirent->d_name[0] == '.') {
             continue;
         }
@@ -128,19 +307,47 @@ get_mods(const char *dirname, bool *stateoutput) {
         str_append(&modpath, dirpath);
         str_append(&modpath, dirent->d_name);
 
-        if (process_mod_zip(modpath, stateoutput) != 0) {
+        struct stat stat_buf = {0};
+        if (stat(modpath, &stat_buf) != 0) {
+            ww_log_errno(LOG_ERROR, "failed to stat mod '%s'", modpath);
             str_free(modpath);
             goto fail_zip;
         }
 
+        int cached = mod_index_find(&old_index, dirent->d_name, &stat_buf);
+        bool mod_stateoutput = (cached == 1);
+        if (cached == -1) {
+            if (process_mod_zip(modpath, &mod_stateoutput) != 0) {
+                str_free(modpath);
+                goto fail_zip;
+            }
+            changed = true;
+        }
         str_free(modpath);
+
+        mod_index_add(&new_index, dirent->d_name, &stat_buf, mod_stateoutput);
+        *stateoutput = *stateoutput || mod_stateoutput;
+    }
+
+    if (index_path && (changed || new_index.count != old_index.count)) {
+        mod_index_save(&new_index, index_path);
     }
 
+    free(old_index.data);
+    free(new_index.data);
+    if (index_path) {
+        str_free(index_path);
+    }
     closedir(dir);
     str_free(dirpath);
     return 0;
 
 fail_zip:
+    free(old_index.data);
+    free(new_index.data);
+    if (index_path) {
+        str_free(index_path);
+    }
     closedir(dir);
 
 fail_dir:
@@ -165,8 +372,79 @@ open_state_file(const char *dir) {
     return fd;
 }
 
-struct instance *
-instance_create(struct server_view *view, struct inotify *inotify) {
+static void *
+detect_thread(void *data) {
+    struct instance_detect *detect = data;
+
+    detect->ret = get_mods(detect->dir, &detect->cancel, &detect->stateoutput);
+
+    uint64_t val = 1;
+    if (write(detect->done_fd, &val, sizeof(val)) != sizeof(val)) {
+        ww_log_errno(LOG_ERROR, "failed to signal instance detection eventfd");
+    }
+
+    return NULL;
+}
+
+static struct instance *
+detect_finish(struct instance_detect *detect) {
+    if (detect->ret != 0) {
+        return NULL;
+    }
+    if (!detect->stateoutput) {
+        ww_log(LOG_WARN, "instance does not have state output");
+        return NULL;
+    }
+
+    int state_fd = open_state_file(detect->dir);
+    if (state_fd == -1) {
+        return NULL;
+    }
+
+    struct instance *instance = zalloc(1, sizeof(*instance));
+
+    instance->dir = strdup(detect->dir);
+    check_alloc(instance->dir);
+
+    instance->pid = server_view_get_pid(detect->view);
+    instance->state_fd = state_fd;
+    instance->state_wd = -1;
+    instance->view = detect->view;
+
+    instance->state.screen = SCREEN_TITLE;
+
+    return instance;
+}
+
+static int
+handle_detect_done(int fd, uint32_t mask, void *data) {
+    struct instance_detect *detect = data;
+
+    uint64_t val;
+    if (read(fd, &val, sizeof(val)) == -1) {
+        ww_log_errno(LOG_ERROR, "failed to read instance detection eventfd");
+    }
+
+    pthread_join(detect->thread, NULL);
+    struct instance *instance = detect_finish(detect);
+
+    // Detection is complete at this point, so the detection state is freed before the callback
+    // takes ownership of the instance.
+    struct server_view *view = detect->view;
+    instance_detect_func_t func = detect->func;
+    void *func_data = detect->data;
+
+    wl_event_source_remove(detect->src);
+    close(detect->done_fd);
+    free(detect->dir);
+    free(detect);
+
+    func(view, instance, func_data);
+    return 0;
+}
+
+char *
+instance_get_dir(struct server_view *view) {
     static_assert(sizeof(pid_t) <= sizeof(int));
 
     pid_t pid = server_view_get_pid(view);
@@ -186,6 +464,14 @@ instance_create(struct server_view *view, struct inotify *inotify) {
     }
     dir[n] = '\0';
 
+    char *ret = strdup(dir);
+    check_alloc(ret);
+    return ret;
+}
+
+struct instance_detect *
+instance_detect_create(struct server_view *view, const char *dir, struct wl_event_loop *loop,
+                       instance_detect_func_t func, void *data) {
     // If this is a real Minecraft instance, it should have some normal directories. This does not
     // guarantee that it is actually an instance, but if you're trying to fool the detection then
     // it's your fault.
@@ -193,37 +479,61 @@ instance_create(struct server_view *view, struct inotify *inotify) {
         return NULL;
     }
 
-    bool stateoutput = false;
-    if (get_mods(dir, &stateoutput) != 0) {
-        return NULL;
-    }
-    if (!stateoutput) {
-        ww_log(LOG_WARN, "instance does not have state output");
-        return NULL;
-    }
+    // Large modpacks can take a while to scan, so the mods are scanned on a worker thread rather
+    // than delaying the first frame of the game.
+    struct instance_detect *detect = zalloc(1, sizeof(*detect));
 
-    int state_fd = open_state_file(dir);
-    if (state_fd == -1) {
-        return NULL;
+    detect->view = view;
+    detect->func = func;
+    detect->data = data;
+    atomic_init(&detect->cancel, false);
+
+    detect->dir = strdup(dir);
+    check_alloc(detect->dir);
+
+    detect->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (detect->done_fd == -1) {
+        ww_log_errno(LOG_ERROR, "failed to create instance detection eventfd");
+        goto fail_eventfd;
     }
 
-    struct instance *instance = zalloc(1, sizeof(*instance));
+    detect->src =
+        wl_event_loop_add_fd(loop, detect->done_fd, WL_EVENT_READABLE, handle_detect_done, detect);
+    check_alloc(detect->src);
 
-    instance->dir = strdup(dir);
-    check_alloc(instance->dir);
+    if (pthread_create(&detect->thread, NULL, detect_thread, detect) != 0) {
+        ww_log(LOG_ERROR, "failed to create instance detection thread");
+        goto fail_thread;
+    }
 
-    instance->pid = pid;
-    instance->state_fd = state_fd;
-    instance->state_wd = -1;
-    instance->view = view;
+    return detect;
 
-    instance->state.screen = SCREEN_TITLE;
+fail_thread:
+    wl_event_source_remove(detect->src);
+    close(detect->done_fd);
 
-    return instance;
+fail_eventfd:
+    free(detect->dir);
+    free(detect);
+    return NULL;
+}
+
+void
+instance_detect_destroy(struct instance_detect *detect) {
+    // The worker thread checks for cancellation between mods, so this only blocks until the
+    // current jar has been processed.
+    atomic_store(&detect->cancel, true);
+    pthread_join(detect->thread, NULL);
+
+    wl_event_source_remove(detect->src);
+    close(detect->done_fd);
+    free(detect->dir);
+    free(detect);
 }
 
 void
 instance_destroy(struct instance *instance) {
+    close(instance->state_fd);
     free(instance->dir);
     free(instance);
 }
@@ -237,23 +547,54 @@ instance_get_state_path(struct instance *instance) {
     return path;
 }
 
-void
+static bool
+state_equal(const struct instance_state *a, const struct instance_state *b) {
+    if (a->screen != b->screen) {
+        return false;
+    }
+
+    switch (a->screen) {
+    case SCREEN_GENERATING:
+    case SCREEN_PREVIEWING:
+        return a->data.percent == b->data.percent;
+    case SCREEN_INWORLD:
+        return a->data.inworld == b->data.inworld;
+    default:
+        return true;
+    }
+}
+
+size_t
+instance_get_history(struct instance *instance, const struct instance_transition **out,
+                     size_t max) {
+    uint64_t count = instance->history.count;
+    size_t n = count < INSTANCE_HISTORY_LEN ? count : INSTANCE_HISTORY_LEN;
+    if (n > max) {
+        n = max;
+    }
+
+    // Fill the output array from oldest to newest.
+    for (size_t i = 0; i < n; i++) {
+        out[i] = &instance->history.entries[(count - n + i) % INSTANCE_HISTORY_LEN];
+    }
+    return n;
+}
+
+bool
 instance_state_update(struct instance *instance) {
     // The longest state which can currently be held by wpstateout.txt is 22 characters long:
     // "inworld,gamescreenopen"
     char buf[24];
 
-    if (lseek(instance->state_fd, 0, SEEK_SET) == -1) {
-        ww_log_errno(LOG_ERROR, "failed to seek wpstateout.txt in '%s'", instance->dir);
-        return;
-    }
+    instance->stats.reads++;
+    WW_DEBUG(state.reads, instance->stats.reads);
 
-    ssize_t n = read(instance->state_fd, buf, STATIC_STRLEN(buf));
+    ssize_t n = pread(instance->state_fd, buf, STATIC_STRLEN(buf), 0);
     if (n == 0) {
-        return;
+        return false;
     } else if (n == -1) {
         ww_log_errno(LOG_ERROR, "failed to read wpstateout.txt in '%s'", instance->dir);
-        return;
+        return false;
     }
     buf[n] = '\0';
 
@@ -272,7 +613,7 @@ instance_state_update(struct instance *instance) {
             break;
         default:
             ww_log(LOG_ERROR, "cannot parse wpstateout.txt: '%s'", buf);
-            return;
+            return false;
         }
         break;
     case 'g': // generating,PERCENT
@@ -299,8 +640,26 @@ instance_state_update(struct instance *instance) {
         break;
     default:
         ww_log(LOG_ERROR, "cannot parse wpstateout.txt: '%s'", buf);
-        return;
+        return false;
+    }
+
+    if (state_equal(&instance->state, &next)) {
+        return false;
     }
 
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    struct instance_transition *transition =
+        &instance->history.entries[instance->history.count % INSTANCE_HISTORY_LEN];
+    transition->old = instance->state;
+    transition->new = next;
+    transition->time_ns = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    instance->history.count++;
+
+    instance->stats.changes++;
+    WW_DEBUG(state.changes, instance->stats.changes);
+
     instance->state = next;
+    return true;
 }
@@ -1,13 +1,23 @@
 #include "irc.h"
+#include "util/alloc.h"
 #include "util/log.h"
 #include <config/vm.h>
+#include <errno.h>
+#include <inttypes.h>
 #include <libircclient/libircclient.h>
 #include <lua.h>
 #include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <sys/select.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
 
 static struct Irc_client *all_clients[MAX_CLIENTS] = {0};
 static int client_count = 0;
@@ -18,67 +28,123 @@ static pthread_mutex_t clients_mutex =
 static irc_callbacks_t callbacks = {0};
 static bool callbacks_initialized = false;
 
-static int pushed_count = 0;
-static int popped_count = 0;
+LIST_DEFINE_IMPL(struct irc_filter *, list_irc_filter);
+
+static void client_finish(struct Irc_client *client);
+
+/*
+ * Messages are passed from the worker thread to the main thread in parsed form. Each message is a
+ * single allocation (the parameter array followed by all of the strings) so that it can be freed
+ * with a single call to free() by whichever thread discards it.
+ */
+struct irc_message {
+    const char *command;
+    const char *prefix; // NULL if the message has no prefix
+    unsigned int count;
+    const char *params[];
+};
+
+static struct irc_message *
+irc_message_create(const char *command, const char *prefix, const char **params,
+                   unsigned int count) {
+    size_t size = sizeof(struct irc_message) + count * sizeof(char *) + strlen(command) + 1;
+    if (prefix) {
+        size += strlen(prefix) + 1;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+        if (params[i]) {
+            size += strlen(params[i]) + 1;
+        }
+    }
 
-static bool
-queue_is_full(struct message_queue *q) {
-    return ((q->write_pos + 1) % MAX_QUEUED_MESSAGES) == q->read_pos;
-}
+    struct irc_message *msg = malloc(size);
+    if (!msg) {
+        return NULL;
+    }
 
-static bool
-queue_is_empty(struct message_queue *q) {
-    return q->write_pos == q->read_pos;
-}
+    char *ptr = (char *)&msg->params[count];
+    size_t len = strlen(command) + 1;
+    msg->command = memcpy(ptr, command, len);
+    ptr += len;
 
-static void
-queue_init(struct message_queue *q) {
-    if (!q)
-        return;
-    for (int i = 0; i < MAX_QUEUED_MESSAGES; i++) {
-        free(q->messages[i]);
-        q->messages[i] = NULL;
+    msg->prefix = NULL;
+    if (prefix) {
+        len = strlen(prefix) + 1;
+        msg->prefix = memcpy(ptr, prefix, len);
+        ptr += len;
     }
-    q->write_pos = 0;
-    q->read_pos = 0;
-}
 
-static void
-queue_push(struct Irc_client *client, const char *message) {
-    pthread_mutex_lock(&client->queue_mutex);
-    struct message_queue *q = &client->message_queue;
+    // Absent parameters are skipped, as they were when messages were formatted on the worker, so
+    // that they do not show up as empty strings (or stray spaces in the flattened line).
+    msg->count = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        if (!params[i]) {
+            continue;
+        }
 
-    if (queue_is_full(q)) {
-        ww_log(LOG_WARN, "Message queue full for client %d. Dropping message.", client->index);
-        pthread_mutex_unlock(&client->queue_mutex);
-        return;
+        len = strlen(params[i]) + 1;
+        msg->params[msg->count++] = memcpy(ptr, params[i], len);
+        ptr += len;
     }
 
-    char *copy = strdup(message);
-    if (!copy) {
-        ww_log(LOG_ERROR, "strdup failed");
-        pthread_mutex_unlock(&client->queue_mutex);
-        return;
+    return msg;
+}
+
+struct irc_outbound {
+    struct wl_list link; // Irc_client.outbound or Irc_client.completed
+
+    uint64_t id;
+    char *line;
+    char *coalesce_key; // NULL if this message cannot be replaced
+    int callback;       // LUA_NOREF if the outcome is not reported
+
+    const char *error; // static string, NULL if the message was sent
+};
+
+static void
+wake_main(struct Irc_client *client) {
+    uint64_t val = 1;
+    if (write(client->wake_fd, &val, sizeof(val)) != sizeof(val)) {
+        ww_log_errno(LOG_WARN, "failed to signal IRC eventfd for client %d", client->index);
     }
+}
 
-    q->messages[q->write_pos] = copy;
-    q->write_pos = (q->write_pos + 1) % MAX_QUEUED_MESSAGES;
+static void
+wake_worker(struct Irc_client *client) {
+    uint64_t val = 1;
+    if (write(client->send_fd, &val, sizeof(val)) != sizeof(val)) {
+        ww_log_errno(LOG_WARN, "failed to signal IRC send eventfd for client %d", client->index);
+    }
+}
 
-    pushed_count++;
+static void
+outbound_destroy(struct irc_outbound *msg) {
+    free(msg->coalesce_key);
+    free(msg->line);
+    free(msg);
+}
 
-    pthread_mutex_unlock(&client->queue_mutex);
+static void
+outbound_free(lua_State *L, struct irc_outbound *msg) {
+    luaL_unref(L, LUA_REGISTRYINDEX, msg->callback);
+    outbound_destroy(msg);
 }
 
 static void
-queue_cleanup(struct message_queue *q) {
-    if (!q)
+queue_push(struct Irc_client *client, const char *command, const char *prefix,
+           const char **params, unsigned int count) {
+    struct irc_message *msg = irc_message_create(command, prefix, params, count);
+    if (!msg) {
+        ww_log(LOG_ERROR, "failed to allocate IRC message");
         return;
-    for (int i = 0; i < MAX_QUEUED_MESSAGES; i++) {
-        free(q->messages[i]);
-        q->messages[i] = NULL;
     }
-    q->write_pos = 0;
-    q->read_pos = 0;
+
+    // The ring discards the oldest queued message when it is full, so the newest messages are
+    // always delivered.
+    spsc_ring_push(client->messages, msg);
+
+    // Wake up the main thread so that the message is delivered promptly.
+    wake_main(client);
 }
 
 static struct Irc_client *
@@ -95,6 +161,54 @@ find_client_by_session(irc_session_t *session) {
     return NULL;
 }
 
+static bool
+filters_match(struct Irc_client *client, const char *command, const char **params,
+              unsigned int count) {
+    pthread_mutex_lock(&client->filter_mutex);
+
+    bool match = (client->filters.len == 0);
+    for (ssize_t i = 0; i < client->filters.len && !match; i++) {
+        struct irc_filter *filter = client->filters.data[i];
+
+        if (filter->command && strcasecmp(filter->command, command) != 0) {
+            continue;
+        }
+        if (filter->channel) {
+            if (count < 1 || !params[0] || strcasecmp(filter->channel, params[0]) != 0) {
+                continue;
+            }
+        }
+        if (filter->has_pattern) {
+            const char *text = count > 0 ? params[count - 1] : NULL;
+            if (!text || regexec(&filter->pattern, text, 0, NULL, 0) != 0) {
+                continue;
+            }
+        }
+
+        match = true;
+    }
+
+    pthread_mutex_unlock(&client->filter_mutex);
+    return match;
+}
+
+static void
+queue_event(struct Irc_client *client, const char *command, const char *origin,
+            const char **params, unsigned int count) {
+    if (!filters_match(client, command, params, count)) {
+        client->filtered++;
+        return;
+    }
+
+    queue_push(client, command, origin, params, count);
+}
+
+static void
+queue_status(struct Irc_client *client, const char *command, const char *param) {
+    // Connection status messages are generated locally and are never filtered.
+    queue_push(client, command, NULL, &param, param ? 1 : 0);
+}
+
 static void
 format_irc_message(char *buf, size_t size, const char *prefix, const char *origin,
                    const char **params, unsigned int count) {
@@ -127,11 +241,9 @@ on_any_numeric(irc_session_t *session, unsigned int event, const char *origin, c
     if (!client)
         return;
 
-    char buf[MAX_MESSAGE_LENGTH];
     char ev_str[32];
     snprintf(ev_str, sizeof(ev_str), "%u", event);
-    format_irc_message(buf, sizeof(buf), ev_str, origin, params, count);
-    queue_push(client, buf);
+    queue_event(client, ev_str, origin, params, count);
 }
 
 void
@@ -141,34 +253,408 @@ on_any_event(irc_session_t *session, const char *event, const char *origin, cons
     if (!client || !event)
         return;
 
-    char buf[MAX_MESSAGE_LENGTH];
-    format_irc_message(buf, sizeof(buf), event, origin, params, count);
-    queue_push(client, buf);
+    // A successful registration resets the reconnection backoff.
+    if (strcmp(event, "CONNECT") == 0) {
+        client->registered = true;
+    }
+
+    queue_event(client, event, origin, params, count);
+}
+
+static void
+set_session(struct Irc_client *client, irc_session_t *session) {
+    // Lock order: clients_mutex, then client->mutex.
+    pthread_mutex_lock(&clients_mutex);
+    pthread_mutex_lock(&client->mutex);
+    client->session = session;
+    pthread_mutex_unlock(&client->mutex);
+    pthread_mutex_unlock(&clients_mutex);
+}
+
+static bool
+should_exit(struct Irc_client *client) {
+    pthread_mutex_lock(&client->mutex);
+    bool exit = client->should_exit;
+    pthread_mutex_unlock(&client->mutex);
+
+    return exit;
+}
+
+static long
+flush_outbound(struct Irc_client *client, irc_session_t *session) {
+    // Nothing is sent until the server has accepted the registration.
+    if (!client->registered) {
+        return -1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double elapsed = (double)(now.tv_sec - client->bucket.last.tv_sec) +
+                     (double)(now.tv_nsec - client->bucket.last.tv_nsec) / 1e9;
+    client->bucket.last = now;
+    client->bucket.tokens += elapsed * client->bucket.rate;
+    if (client->bucket.tokens > client->bucket.burst) {
+        client->bucket.tokens = client->bucket.burst;
+    }
+
+    long delay_us = -1;
+    bool sent = false;
+    for (;;) {
+        pthread_mutex_lock(&client->mutex);
+        if (wl_list_empty(&client->outbound)) {
+            pthread_mutex_unlock(&client->mutex);
+            break;
+        }
+        if (client->bucket.tokens < 1.0) {
+            pthread_mutex_unlock(&client->mutex);
+            delay_us = (long)((1.0 - client->bucket.tokens) / client->bucket.rate * 1e6) + 1;
+            break;
+        }
+
+        struct irc_outbound *msg = wl_container_of(client->outbound.next, msg, link);
+        wl_list_remove(&msg->link);
+        client->outbound_len--;
+        client->sending = msg;
+        pthread_mutex_unlock(&client->mutex);
+
+        client->bucket.tokens -= 1.0;
+        if (irc_send_raw(session, "%s", msg->line) != 0) {
+            msg->error = irc_strerror(irc_errno(session));
+        }
+
+        pthread_mutex_lock(&client->mutex);
+        wl_list_insert(client->completed.prev, &msg->link);
+        client->sending = NULL;
+        pthread_mutex_unlock(&client->mutex);
+        sent = true;
+    }
+
+    if (sent) {
+        wake_main(client);
+    }
+    return delay_us;
+}
+
+static const char *
+run_session(struct Irc_client *client, irc_session_t *session) {
+    // This is equivalent to irc_run, except that the worker also wakes up to write queued messages
+    // (when the rate limit allows) and to notice when the client is being destroyed.
+    while (irc_is_connected(session)) {
+        if (should_exit(client)) {
+            irc_disconnect(session);
+            return NULL;
+        }
+
+        long delay_us = flush_outbound(client, session);
+
+        fd_set in_set, out_set;
+        FD_ZERO(&in_set);
+        FD_ZERO(&out_set);
+
+        int maxfd = client->send_fd;
+        FD_SET(client->send_fd, &in_set);
+        irc_add_select_descriptors(session, &in_set, &out_set, &maxfd);
+
+        struct timeval tv = {.tv_sec = 0, .tv_usec = 250000};
+        if (delay_us >= 0 && delay_us < tv.tv_usec) {
+            tv.tv_usec = delay_us;
+        }
+
+        if (select(maxfd + 1, &in_set, &out_set, NULL, &tv) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ww_log_errno(LOG_ERROR, "select failed for IRC client %d", client->index);
+            return "select failed";
+        }
+
+        if (FD_ISSET(client->send_fd, &in_set)) {
+            uint64_t val;
+            if (read(client->send_fd, &val, sizeof(val)) == -1 && errno != EAGAIN) {
+                ww_log_errno(LOG_WARN, "failed to read IRC send eventfd");
+            }
+        }
+
+        if (irc_process_select_descriptors(session, &in_set, &out_set) != 0) {
+            return irc_strerror(irc_errno(session));
+        }
+    }
+
+    return NULL;
+}
+
+static bool
+wait_backoff(struct Irc_client *client, int seconds) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += seconds;
+
+    pthread_mutex_lock(&client->mutex);
+    while (!client->should_exit) {
+        if (pthread_cond_timedwait(&client->cond, &client->mutex, &deadline) != 0) {
+            break;
+        }
+    }
+    bool exit = client->should_exit;
+    pthread_mutex_unlock(&client->mutex);
+
+    return !exit;
 }
 
 static void *
 irc_thread(void *arg) {
     struct Irc_client *client = arg;
-    if (!client || !client->session) {
-        ww_log(LOG_ERROR, "Invalid client in IRC thread");
-        return NULL;
-    }
 
     ww_log(LOG_INFO, "IRC thread starting for client %d", client->index);
 
-    int ret = irc_run(client->session);
-    if (ret != 0)
-        ww_log(LOG_WARN, "irc_run() exited with error: %s",
-               irc_strerror(irc_errno(client->session)));
-    else
-        ww_log(LOG_INFO, "irc_run() exited normally");
+    // libircclient sessions cannot be reconnected once they have disconnected, so each connection
+    // attempt uses a new session.
+    int backoff = RECONNECT_MIN_SECONDS;
+    for (;;) {
+        queue_status(client, "CONNECTING", NULL);
+
+        irc_session_t *session = irc_create_session(&callbacks);
+        if (!session) {
+            ww_log(LOG_ERROR, "Failed to create IRC session");
+            queue_status(client, "DISCONNECTED", "failed to create session");
+            break;
+        }
+        set_session(client, session);
+
+        client->registered = false;
+        clock_gettime(CLOCK_MONOTONIC, &client->bucket.last);
+        client->bucket.tokens = client->bucket.burst;
+        const char *reason = "connection closed";
+
+        if (irc_connect(session, client->ip, client->port, client->pass, client->nick,
+                        client->nick, client->nick) == 0) {
+            const char *error = run_session(client, session);
+            if (error) {
+                reason = error;
+            }
+        } else {
+            reason = irc_strerror(irc_errno(session));
+        }
+
+        set_session(client, NULL);
+        irc_destroy_session(session);
+
+        if (should_exit(client)) {
+            break;
+        }
+
+        ww_log(LOG_WARN, "IRC client %d disconnected: %s", client->index, reason);
+        queue_status(client, "DISCONNECTED", reason);
+
+        if (client->registered) {
+            backoff = RECONNECT_MIN_SECONDS;
+        }
+
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%d", backoff);
+        queue_status(client, "RECONNECTING", buf);
+
+        if (!wait_backoff(client, backoff)) {
+            break;
+        }
+
+        backoff *= 2;
+        if (backoff > RECONNECT_MAX_SECONDS) {
+            backoff = RECONNECT_MAX_SECONDS;
+        }
+    }
 
     ww_log(LOG_INFO, "IRC thread ending for client %d", client->index);
+
+    // If the client was destroyed while this thread was running, the main thread has detached it
+    // and left the remaining state for this thread to free.
+    pthread_mutex_lock(&client->mutex);
+    client->thread_done = true;
+    bool detached = client->should_exit;
+    pthread_mutex_unlock(&client->mutex);
+
+    if (detached) {
+        client_finish(client);
+    }
     return NULL;
 }
 
+static int
+handle_wake(int32_t fd, uint32_t mask, void *data) {
+    struct Irc_client *client = data;
+
+    uint64_t val;
+    if (read(client->wake_fd, &val, sizeof(val)) == -1) {
+        return 0;
+    }
+
+    // The Lua callback may close this client, in which case no further messages can be delivered.
+    bool destroyed = false;
+    client->destroyed = &destroyed;
+
+    lua_State *L = client->vm->L;
+
+    struct irc_message *msg;
+    while ((msg = spsc_ring_pop(client->messages))) {
+        // push callback function and argument onto vm->L stack
+        lua_rawgeti(L, LUA_REGISTRYINDEX, client->callback);
+        if (client->parsed) {
+            lua_createtable(L, 0, 3);
+            lua_pushstring(L, msg->command);
+            lua_setfield(L, -2, "command");
+            if (msg->prefix) {
+                lua_pushstring(L, msg->prefix);
+                lua_setfield(L, -2, "prefix");
+            }
+            lua_createtable(L, msg->count, 0);
+            for (unsigned int i = 0; i < msg->count; i++) {
+                lua_pushstring(L, msg->params[i]);
+                lua_rawseti(L, -2, i + 1);
+            }
+            lua_setfield(L, -2, "params");
+        } else {
+            char buf[MAX_MESSAGE_LENGTH];
+            format_irc_message(buf, sizeof(buf), msg->command, msg->prefix, msg->params,
+                               msg->count);
+            lua_pushstring(L, buf);
+        }
+
+        bool consumed = config_vm_try_callback_arg(client->vm);
+
+        if (!consumed) {
+            ww_log(LOG_WARN, "IRC callback did not consume message");
+        }
+
+        free(msg);
+
+        if (destroyed) {
+            return 0;
+        }
+    }
+
+    // Report the outcome of sends which have been written (or coalesced) by the worker thread.
+    struct wl_list completed;
+    wl_list_init(&completed);
+
+    pthread_mutex_lock(&client->mutex);
+    wl_list_insert_list(&completed, &client->completed);
+    wl_list_init(&client->completed);
+    pthread_mutex_unlock(&client->mutex);
+
+    struct config_vm *vm = client->vm;
+    while (!wl_list_empty(&completed)) {
+        struct irc_outbound *out = wl_container_of(completed.next, out, link);
+        wl_list_remove(&out->link);
+
+        // Once the client has been closed, the remaining outcomes are discarded.
+        if (!destroyed && out->callback != LUA_NOREF) {
+            lua_rawgeti(L, LUA_REGISTRYINDEX, out->callback);
+            lua_pushinteger(L, out->id);
+            lua_pushboolean(L, !out->error);
+            if (out->error) {
+                lua_pushstring(L, out->error);
+            } else {
+                lua_pushnil(L);
+            }
+
+            if (!config_vm_try_callback_argn(vm, 3)) {
+                ww_log(LOG_WARN, "IRC send callback failed");
+            }
+        }
+
+        outbound_free(L, out);
+    }
+
+    if (!destroyed) {
+        client->destroyed = NULL;
+    }
+    return 0;
+}
+
+static void
+filter_destroy(struct irc_filter *filter) {
+    if (filter->has_pattern) {
+        regfree(&filter->pattern);
+    }
+    free(filter->command);
+    free(filter->channel);
+    free(filter);
+}
+
+static void
+client_free(struct Irc_client *client) {
+    // This may run on the worker thread, so the Lua references held by queued messages must have
+    // been released by the main thread already.
+    spsc_ring_destroy(client->messages);
+
+    struct wl_list *queues[] = {&client->outbound, &client->completed};
+    for (size_t i = 0; i < STATIC_ARRLEN(queues); i++) {
+        struct irc_outbound *out, *tmp;
+        wl_list_for_each_safe (out, tmp, queues[i], link) {
+            wl_list_remove(&out->link);
+            outbound_destroy(out);
+        }
+    }
+    if (client->send_fd != -1) {
+        close(client->send_fd);
+    }
+    if (client->wake_fd != -1) {
+        close(client->wake_fd);
+    }
+
+    for (ssize_t i = 0; i < client->filters.len; i++) {
+        filter_destroy(client->filters.data[i]);
+    }
+    list_irc_filter_destroy(&client->filters);
+    pthread_mutex_destroy(&client->filter_mutex);
+
+    pthread_mutex_destroy(&client->mutex);
+    pthread_cond_destroy(&client->cond);
+
+    free(client->ip);
+    free(client->nick);
+    free(client->pass);
+    free(client);
+}
+
+static void
+client_finish(struct Irc_client *client) {
+    struct spsc_stats stats = spsc_ring_stats(client->messages);
+    uint64_t filtered = client->filtered;
+    int index = client->index;
+
+    client_free(client);
+    ww_log(LOG_INFO,
+           "IRC client %d destroyed: %" PRIu64 " pushed, %" PRIu64 " popped, %" PRIu64
+           " dropped, %" PRIu64 " filtered.",
+           index, stats.pushed, stats.popped, stats.dropped, filtered);
+}
+
+static void
+wake_cleanup(struct Irc_client *client) {
+    // The eventfd itself is closed by client_free, since the worker thread may still write to it.
+    wl_list_remove(&client->on_loop_destroy.link);
+    if (client->src) {
+        wl_event_source_remove(client->src);
+        client->src = NULL;
+    }
+}
+
+static void
+on_loop_destroy(struct wl_listener *listener, void *data) {
+    struct Irc_client *client = wl_container_of(listener, client, on_loop_destroy);
+
+    // Lua objects (and therefore IRC clients) can outlive the event loop during shutdown.
+    wl_list_remove(&client->on_loop_destroy.link);
+    wl_list_init(&client->on_loop_destroy.link);
+
+    wl_event_source_remove(client->src);
+    client->src = NULL;
+}
+
 struct Irc_client *
-irc_client_create(const char *ip, long port, const char *nick, const char *pass, int callback,
+irc_client_create(struct wl_event_loop *loop, const char *ip, long port, const char *nick,
+                  const char *pass, int callback, const struct irc_client_options *options,
                   lua_State *L) {
     if (!ip || !nick || !L) {
         ww_log(LOG_ERROR, "Invalid parameters for IRC client creation");
@@ -179,6 +665,7 @@ irc_client_create(const char *ip, long port, const char *nick, const char *pass,
 
     if (client_count >= MAX_CLIENTS) {
         ww_log(LOG_ERROR, "Too many IRC clients (max %d)", MAX_CLIENTS);
+        pthread_mutex_unlock(&clients_mutex);
         return NULL;
     }
 
@@ -207,52 +694,72 @@ irc_client_create(const char *ip, long port, const char *nick, const char *pass,
         return NULL;
     }
 
-    irc_session_t *session = irc_create_session(&callbacks);
-    if (!session) {
-        ww_log(LOG_ERROR, "Failed to create IRC session");
-        pthread_mutex_unlock(&clients_mutex);
-        return NULL;
-    }
-
     struct Irc_client *client = calloc(1, sizeof(struct Irc_client));
     if (!client) {
-        irc_destroy_session(session);
         pthread_mutex_unlock(&clients_mutex);
         return NULL;
     }
 
-    client->session = session;
     client->callback = callback;
     client->index = slot;
     client->thread_running = false;
-    queue_init(&client->message_queue);
-    pthread_mutex_init(&client->queue_mutex, NULL);
+    client->wake_fd = -1;
+    client->messages = spsc_ring_create(MAX_QUEUED_MESSAGES, SPSC_DROP_OLDEST, free);
     client->vm = config_vm_from(L);
+    client->parsed = options->parsed;
+
+    wl_list_init(&client->outbound);
+    wl_list_init(&client->completed);
+    client->bucket.burst = options->send_limit;
+    client->bucket.rate = options->send_limit / options->send_period;
+
+    pthread_mutex_init(&client->filter_mutex, NULL);
+    client->filters = list_irc_filter_create();
+
+    client->ip = strdup(ip);
+    client->nick = strdup(nick);
+    client->pass = pass ? strdup(pass) : NULL;
+    client->port = port;
+    check_alloc(client->ip);
+    check_alloc(client->nick);
+
+    pthread_mutex_init(&client->mutex, NULL);
+    pthread_cond_init(&client->cond, NULL);
+
+    client->send_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (client->send_fd == -1) {
+        ww_log_errno(LOG_ERROR, "Failed to create IRC eventfd");
+        client_free(client);
+        pthread_mutex_unlock(&clients_mutex);
+        return NULL;
+    }
 
-    all_clients[slot] = client;
-    client_count++;
-
-    if (irc_connect(session, ip, port, pass, nick, nick, nick) != 0) {
-        ww_log(LOG_ERROR, "IRC connection failed: %s", irc_strerror(irc_errno(session)));
-        all_clients[slot] = NULL;
-        client_count--;
-        queue_cleanup(&client->message_queue);
-        irc_destroy_session(session);
-        pthread_mutex_destroy(&client->queue_mutex);
-        free(client);
+    client->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (client->wake_fd == -1) {
+        ww_log_errno(LOG_ERROR, "Failed to create IRC eventfd");
+        client_free(client);
         pthread_mutex_unlock(&clients_mutex);
         return NULL;
     }
 
+    client->src =
+        wl_event_loop_add_fd(loop, client->wake_fd, WL_EVENT_READABLE, handle_wake, client);
+    check_alloc(client->src);
+
+    client->on_loop_destroy.notify = on_loop_destroy;
+    wl_event_loop_add_destroy_listener(loop, &client->on_loop_destroy);
+
+    all_clients[slot] = client;
+    client_count++;
+
+    // The connection is established by the worker thread so that DNS resolution and the TCP
+    // handshake do not block the compositor.
     if (pthread_create(&client->thread_id, NULL, irc_thread, client) != 0) {
         ww_log(LOG_ERROR, "Failed to create IRC thread");
-        irc_disconnect(session);
         all_clients[slot] = NULL;
         client_count--;
-        queue_cleanup(&client->message_queue);
-        irc_destroy_session(session);
-        pthread_mutex_destroy(&client->queue_mutex);
-        free(client);
+        wake_cleanup(client);
+        client_free(client);
         pthread_mutex_unlock(&clients_mutex);
         return NULL;
     }
@@ -263,23 +770,110 @@ irc_client_create(const char *ip, long port, const char *nick, const char *pass,
     return client;
 }
 
-void
-irc_client_send(struct Irc_client *client, const char *message) {
-    if (!client || !client->session || !message) {
-        ww_log(LOG_WARN, "Invalid parameters for IRC send");
-        return;
+int
+irc_client_add_filter(struct Irc_client *client, const struct irc_filter_options *options) {
+    struct irc_filter *filter = zalloc(1, sizeof(*filter));
+
+    if (options->pattern) {
+        int ret = regcomp(&filter->pattern, options->pattern, REG_EXTENDED | REG_NOSUB);
+        if (ret != 0) {
+            char buf[256];
+            regerror(ret, &filter->pattern, buf, sizeof(buf));
+            ww_log(LOG_ERROR, "invalid IRC filter pattern '%s': %s", options->pattern, buf);
+            free(filter);
+            return -1;
+        }
+        filter->has_pattern = true;
     }
 
-    if (!client->thread_running) {
-        ww_log(LOG_WARN, "Cannot send to disconnected IRC client");
-        return;
+    if (options->command) {
+        filter->command = strdup(options->command);
+        check_alloc(filter->command);
+    }
+    if (options->channel) {
+        filter->channel = strdup(options->channel);
+        check_alloc(filter->channel);
+    }
+
+    pthread_mutex_lock(&client->filter_mutex);
+    filter->id = client->next_filter_id++;
+    list_irc_filter_append(&client->filters, filter);
+    pthread_mutex_unlock(&client->filter_mutex);
+
+    return filter->id;
+}
+
+bool
+irc_client_remove_filter(struct Irc_client *client, int id) {
+    struct irc_filter *filter = NULL;
+
+    pthread_mutex_lock(&client->filter_mutex);
+    for (ssize_t i = 0; i < client->filters.len; i++) {
+        if (client->filters.data[i]->id == id) {
+            filter = client->filters.data[i];
+            list_irc_filter_remove(&client->filters, i);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&client->filter_mutex);
+
+    if (filter) {
+        filter_destroy(filter);
+    }
+    return filter != NULL;
+}
+
+uint64_t
+irc_client_send(struct Irc_client *client, const char *message, const char *coalesce_key,
+                int callback) {
+    struct irc_outbound *msg = zalloc(1, sizeof(*msg));
+    msg->id = ++client->next_send_id;
+    msg->line = strdup(message);
+    check_alloc(msg->line);
+    if (coalesce_key) {
+        msg->coalesce_key = strdup(coalesce_key);
+        check_alloc(msg->coalesce_key);
+    }
+    msg->callback = callback;
+
+    pthread_mutex_lock(&client->mutex);
+
+    // A queued message with the same coalescing key is superseded by this one, so it is never
+    // sent and does not count against the rate limit.
+    struct irc_outbound *old = NULL;
+    if (coalesce_key) {
+        struct irc_outbound *out;
+        wl_list_for_each (out, &client->outbound, link) {
+            if (out->coalesce_key && strcmp(out->coalesce_key, coalesce_key) == 0) {
+                old = out;
+                break;
+            }
+        }
+    }
+
+    if (old) {
+        old->error = "coalesced";
+        wl_list_remove(&old->link);
+        wl_list_insert(client->completed.prev, &old->link);
+        client->outbound_len--;
+    } else if (client->outbound_len >= MAX_QUEUED_SENDS) {
+        pthread_mutex_unlock(&client->mutex);
+        ww_log(LOG_WARN, "IRC send queue for client %d is full", client->index);
+        outbound_free(client->vm->L, msg);
+        return 0;
     }
 
-    int ret = irc_send_raw(client->session, message);
-    if (ret != 0) {
-        ww_log(LOG_WARN, "Failed to send IRC message: %s",
-               irc_strerror(irc_errno(client->session)));
+    wl_list_insert(client->outbound.prev, &msg->link);
+    client->outbound_len++;
+
+    pthread_mutex_unlock(&client->mutex);
+
+    wake_worker(client);
+    if (old) {
+        wake_main(client);
     }
+
+    return msg->id;
 }
 
 void
@@ -289,23 +883,17 @@ irc_client_destroy(struct Irc_client *client) {
 
     ww_log(LOG_INFO, "Destroying IRC client %d", client->index);
 
-    if (client->thread_running && client->session) {
-        irc_disconnect(client->session);
-        pthread_join(client->thread_id, NULL);
-        client->thread_running = false;
-    }
+    wake_cleanup(client);
 
-    if (client->session) {
-        irc_destroy_session(client->session);
-        client->session = NULL;
+    if (client->destroyed) {
+        *client->destroyed = true;
     }
 
-    queue_cleanup(&client->message_queue);
-
-    pthread_mutex_destroy(&client->queue_mutex);
-
-    luaL_unref(client->vm->L, LUA_REGISTRYINDEX, client->callback);
+    lua_State *L = client->vm->L;
+    luaL_unref(L, LUA_REGISTRYINDEX, client->callback);
 
+    // Free the slot now so that a new client can take it while the worker thread shuts down. Any
+    // events from the old session are dropped since its session can no longer be found.
     pthread_mutex_lock(&clients_mutex);
     if (client->index >= 0 && client->index < MAX_CLIENTS) {
         all_clients[client->index] = NULL;
@@ -313,51 +901,42 @@ irc_client_destroy(struct Irc_client *client) {
     }
     pthread_mutex_unlock(&clients_mutex);
 
-    free(client);
-    ww_log(LOG_INFO, "IRC client destroyed");
-    ww_log(LOG_INFO, "%d pushed, %d popped.", pushed_count, popped_count);
-}
-
-void
-manage_new_messages() {
-    struct Irc_client *clients_snapshot[MAX_CLIENTS];
-    int count = 0;
+    if (!client->thread_running) {
+        client_finish(client);
+        return;
+    }
 
-    pthread_mutex_lock(&clients_mutex);
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (all_clients[i]) {
-            clients_snapshot[count++] = all_clients[i];
+    // The worker thread may be blocked in DNS resolution or irc_connect, so it is not joined here.
+    // Every Lua reference is released before the worker is told to exit, after which the client
+    // belongs to whichever thread sees that the other is done with it.
+    pthread_mutex_lock(&client->mutex);
+
+    struct wl_list *queues[] = {&client->outbound, &client->completed};
+    for (size_t i = 0; i < STATIC_ARRLEN(queues); i++) {
+        struct irc_outbound *out, *tmp;
+        wl_list_for_each_safe (out, tmp, queues[i], link) {
+            wl_list_remove(&out->link);
+            outbound_free(L, out);
         }
     }
-    pthread_mutex_unlock(&clients_mutex);
-
-    for (int i = 0; i < count; i++) {
-        struct Irc_client *client = clients_snapshot[i];
-        pthread_mutex_lock(&client->queue_mutex);
-        struct message_queue *q = &client->message_queue;
-
-        while (!queue_is_empty(q)) {
-            char *msg = q->messages[q->read_pos];
-            q->messages[q->read_pos] = NULL;
-            q->read_pos = (q->read_pos + 1) % MAX_QUEUED_MESSAGES;
-
-            pthread_mutex_unlock(&client->queue_mutex);
-
-            // push callback function and argument onto vm->L stack
-            lua_rawgeti(client->vm->L, LUA_REGISTRYINDEX, client->callback);
-            lua_pushstring(client->vm->L, msg);
-
-            bool consumed = config_vm_try_callback_arg(client->vm);
+    client->outbound_len = 0;
+    if (client->sending) {
+        luaL_unref(L, LUA_REGISTRYINDEX, client->sending->callback);
+        client->sending->callback = LUA_NOREF;
+    }
 
-            if (!consumed) {
-                ww_log(LOG_WARN, "IRC callback did not consume message");
-            }
+    client->should_exit = true;
+    pthread_cond_signal(&client->cond);
+    wake_worker(client);
 
-            free(msg);
-            popped_count++;
-            pthread_mutex_lock(&client->queue_mutex);
-        }
+    bool thread_done = client->thread_done;
+    pthread_t thread_id = client->thread_id;
+    pthread_mutex_unlock(&client->mutex);
 
-        pthread_mutex_unlock(&client->queue_mutex);
+    if (thread_done) {
+        pthread_join(thread_id, NULL);
+        client_finish(client);
+    } else {
+        pthread_detach(thread_id);
     }
 }
@@ -6,12 +6,13 @@
 
 local priv = _G.priv_waywall
 
-local function event_handler(name)
+local function event_handler(name, get_args)
     local listeners = {}
 
     priv.register(name, function()
+        local args = get_args and { get_args() } or {}
         for listener, _ in pairs(listeners) do
-            local ok, result = pcall(listener)
+            local ok, result = pcall(listener, unpack(args))
             if not ok then
                 priv.log_error("failed to call event listener (" .. name .. "): " .. result)
             end
@@ -35,8 +36,18 @@ local function event_handler(name)
 end
 
 local events = {
+    ["frame"] = event_handler("frame"),
     ["resolution"] = event_handler("resolution"),
-    ["state"] = event_handler("state"),
+    ["state"] = event_handler("state", function()
+        -- The event is signalled once per transition, so the latest transition is the new one.
+        local transition = priv.state_history(1)[1]
+        return transition.old, transition.new, transition.time
+    end),
+    ["instance_state"] = event_handler("instance_state", function()
+        local index = priv.last_transition()
+        local transition = priv.state_history(1, index)[1]
+        return index, transition.old, transition.new, transition.time
+    end),
 }
 
 local M = {}
@@ -57,6 +68,10 @@ end
     C API wrappers
 ]]
 
+--- Get the index of the active Minecraft instance.
+-- @return index The index of the active instance, or nil if there is none.
+M.active_instance = priv.active_instance
+
 --- Get the current resolution of Minecraft.
 -- @return width The width of the Minecraft window, or 0 if none has been set.
 -- @return height The height of the Minecraft window, or 0 if none has been set.
@@ -65,37 +80,81 @@ M.active_res = priv.active_res
 --- Get the current time, in milliseconds, with an arbitrary epoch.
 M.current_time = priv.current_time
 
---- Forks and executes the given command.
--- The command will be run using fork() and execvp(). Arguments will be split by
+--- Calls the given function repeatedly at a fixed interval.
+-- The interval is measured from when the callback was first scheduled, so it
+-- does not drift over time. If waywall falls behind, missed calls are skipped.
+-- @param ms The interval between calls, in milliseconds.
+-- @param callback The function to call. It receives the current time, in
+-- milliseconds (see current_time).
+-- @return handle An object with a `cancel` method to stop future calls.
+M.every = priv.every
+
+--- Executes the given command as a subprocess.
+-- The command will be run using posix_spawnp(). Arguments will be split by
 -- spaces; no further processing of arguments will happen.
 --
 -- It is recommended that you use this function instead of io.popen(), which will
 -- cause waywall to freeze if the configuration is reloaded while a subprocess is
 -- still running.
 --
+-- If options.on_output is given, it is called with each line the subprocess
+-- writes and the name of the stream ("stdout" or "stderr"). If options.on_exit
+-- is given, it is called with the exit code (or nil) and the terminating signal
+-- (or nil) once the subprocess exits and its output has been delivered.
+--
 -- A maximum of 63 arguments may be provided.
 -- @param command The command to run.
+-- @param options An optional table with on_output and on_exit callbacks.
 M.exec = priv.exec
 
 --- Returns whether or not floating windows are currently visible.
 -- @return shown Whether floating windows are shown.
 M.floating_shown = priv.floating_shown
 
+--- Calls the given function before each frame is drawn.
+-- Changes made to the scene (e.g. text or images) from within the callback
+-- will be visible in the frame which is about to be drawn.
+-- @param callback The function to call.
+-- @return unregister A function which can be used to remove the callback.
+M.on_frame = function(callback)
+    return events["frame"](callback)
+end
+
 --- Creates an image object which displays a PNG image from the filesystem.
 -- @param path The filepath to the image.
 -- @param options The options to create the image with.
 -- @return image The image object.
 M.image = priv.image
 
---- Creates a "mirror" object which mirrors part of the Minecraft window.
+--- Get the indices of all Minecraft instances, in ascending order.
+-- Indices start at 1 and do not change while an instance is open.
+-- @return indices A list of instance indices.
+M.instances = priv.instances
+
+--- Creates a "mirror" object which mirrors part of the Minecraft window. If
+-- options.instance is set, the mirror always shows that instance rather than
+-- the active one.
 -- @param options The options to create the mirror with.
 -- @return mirror The mirror object.
 M.mirror = priv.mirror
 
 --- Press and immediately release the given key in the Minecraft window.
 -- @param key The name of the key to press.
+-- @param instance The index of the instance to send the key to (optional,
+-- defaults to the active instance).
 M.press_key = priv.press_key
 
+--- Sends a sequence of key events to the Minecraft window.
+-- The sequence is executed by waywall without re-entering Lua, so the timing
+-- between steps is much more precise than with press_key and sleep.
+-- @param steps A list of steps. Each step is a table containing the name of the
+-- key (`key`), whether the key should be pressed or released (`down`, omit to
+-- press and release the key), and the delay before the step in microseconds
+-- (`delay_us`, defaults to 0).
+-- @param instance The index of the instance to send the keys to (optional,
+-- defaults to the active instance).
+M.press_keys = priv.press_keys
+
 --- Returns the current state of a key on the keyboard.
 -- @param key The name of the key to press.
 -- @return pressed (boolean) Whether the key is currently pressed.
@@ -105,6 +164,21 @@ M.get_key = priv.get_key
 -- @return The current profile, or nil if the default profile is active.
 M.profile = priv.profile
 
+--- Makes another Minecraft instance visible and gives it input focus. The
+-- previously active instance keeps running in the background.
+-- @param index The index of the instance to activate.
+M.set_active_instance = priv.set_active_instance
+
+--- Moves a Minecraft instance into one of the configured CPU groups.
+-- @param group The name of the group, or nil for automatic group selection.
+-- @param instance The index of the instance, or nil for the active instance.
+M.set_cpu_group = priv.set_cpu_group
+
+--- Limits how often a Minecraft instance is allowed to draw new frames.
+-- @param fps The maximum frame rate, or 0 to remove the limit.
+-- @param instance The index of the instance, or nil for the active instance.
+M.set_fps = priv.set_fps
+
 --- Attempts to update the current keymap to one with the specified settings.
 -- @param keymap The keymap options (layout, model, rules, variants, and options
 -- are valid keys.)
@@ -139,9 +213,18 @@ M.sleep = priv.sleep
 --- Gets the state of the Minecraft instance.
 -- StateOutput must be present and enabled on the instance for an accurate
 -- result.
+-- @param instance The index of the instance (optional, defaults to the active
+-- instance).
 -- @return state A table containing information about the instance state.
 M.state = priv.state
 
+--- Gets the most recent state transitions of the Minecraft instance.
+-- @param count The maximum number of transitions to return (optional).
+-- @param instance The index of the instance (optional, defaults to the active
+-- instance).
+-- @return history A list of { old, new, time } tables, from oldest to newest.
+M.state_history = priv.state_history
+
 --- Creates a "text" object which displays arbitrary text.
 -- @param options The options to create the text with.
 -- @return text The text object.
@@ -150,17 +233,48 @@ M.text = priv.text
 --- Toggle the Waywall window between fullscreen and not
 M.toggle_fullscreen = priv.toggle_fullscreen
 
+--- Creates a "wall" object which shows every Minecraft instance in a grid.
+-- The instance with index N is drawn in the Nth tile, counting left to right
+-- and then top to bottom.
+-- @param options The options to create the wall with.
+-- @return wall The wall object.
+M.wall = priv.wall
+
 --- Creates a irc client
 -- @param ip The ip to connect to.
 -- @param port The port to connect on.
 -- @param user The user/nickname to provide
 -- @param token The token/password to provide.
 -- @param callback The function that will be called on each message received.
+-- @param options An optional table. If options.parsed is true, the callback receives tables of the
+-- form { command, prefix, params } instead of strings. At most options.send_limit messages (default
+-- 20) are sent in any options.send_period seconds (default 30).
 -- @return irc-client The irc client object, can be used to close the connection and send messages.
+-- client:filter{command, channel, pattern} adds a filter and returns its ID, which can be passed
+-- to client:remove_filter. Once any filters exist, only server messages matching at least one of
+-- them are delivered. The pattern is a POSIX extended regular expression matched against the last
+-- parameter (the message text). Connection status messages are always delivered.
+-- client:send(message, {coalesce, callback}) queues a message and returns its ID, or nil if the
+-- queue is full. A queued message is replaced by a later one with the same coalesce key. The
+-- callback receives (id, ok, error) once the message has been sent or replaced.
 M.irc_client_create = priv.irc_client_create
 
 --- Creates a http client
--- @param callback The function that will be called when the message is recieved.
+-- @param callback The function that will be called when the message is recieved. This is
+-- optional if every request is made with client:request and its own callback.
+--
+-- client:request{url, method, headers, body, timeout, json, stream, callback} sends a request
+-- with the given method (default GET, or POST if a body is given), table of headers, body string
+-- and timeout in milliseconds (at most one day). The callback receives a table with the url,
+-- status, headers (lowercased names), body (or error) and timing (dns, connect, tls, ttfb and
+-- total, in milliseconds since the request started). With json = true, the body is decoded into
+-- a table (or left as a string if it is not valid JSON, or has more than about a million values).
+-- Large documents are decoded over several frames, so their callback may run slightly later.
+--
+-- GET requests made with cache = true are revalidated against an on-disk copy of the last
+-- response using ETag/Last-Modified, and unchanged responses are answered from the cache (with
+-- cached = true in the response table). client:cache_stats() returns the hits, revalidations and
+-- misses counts.
 M.http_client_create = priv.http_client_create
 
 --- Creates a atlas which can be used to store images
@@ -81,6 +81,17 @@ else
 end
 package.path = package.path .. ";" .. path .. "?.lua"
 
+-- Modules from the configuration directory are loaded through a bytecode cache
+-- so that reloading the configuration does not need to reparse unchanged files.
+table.insert(package.loaders, 2, function(name)
+    local file = package.searchpath(name, path .. "?.lua")
+    if not file then
+        return "\n\tno file in waywall configuration directory"
+    end
+
+    return priv.load_module(file)
+end)
+
 -- Run the user's configuration file.
 local user_config = require(priv.profile() or "init")
 
@@ -98,6 +98,7 @@ cmd_wrap(const char *profile, char **argv) {
     if (config_load(ww.cfg, profile) != 0) {
         goto fail_config_populate;
     }
+    config_apply_env(ww.cfg);
 
     util_debug_enabled = ww.cfg->experimental.debug;
 
@@ -116,13 +117,16 @@ cmd_wrap(const char *profile, char **argv) {
     }
 
     ww.timer = ww_timer_create(ww.server);
+    if (!ww.timer) {
+        goto fail_timer;
+    }
 
     ww.wrap = wrap_create(ww.server, ww.inotify, ww.timer, ww.cfg);
     if (!ww.wrap) {
         goto fail_wrap;
     }
 
-    ww.reload = reload_create(ww.inotify, ww.timer, profile, handle_reload, &ww);
+    ww.reload = reload_create(loop, ww.inotify, ww.timer, profile, handle_reload, &ww);
     if (!ww.reload) {
         goto fail_reload;
     }
@@ -186,6 +190,8 @@ fail_reload:
 
 fail_wrap:
     ww_timer_destroy(ww.timer);
+
+fail_timer:
     inotify_destroy(ww.inotify);
 
 fail_inotify:
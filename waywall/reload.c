@@ -7,10 +7,15 @@
 #include "util/log.h"
 #include "util/prelude.h"
 #include <dirent.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/inotify.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
 
 static const struct timespec RELOAD_DEBOUNCE_TIME = {
     .tv_nsec = 100 * 1000000 // 100 milliseconds
@@ -36,6 +41,94 @@ reload_timer_destroy(void *data) {
     rl->timer_entry = NULL;
 }
 
+static void *
+worker_run(void *data) {
+    struct reload *rl = data;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // The new configuration gets its own Lua state, so parsing and running the user's code does not
+    // touch any state owned by the main thread. Anything which requires the compositor (images,
+    // shaders, etc.) is unavailable during startup anyway and is only applied by `rl->func`.
+    struct config *cfg = config_create();
+    if (config_load(cfg, rl->profile) != 0) {
+        config_destroy(cfg);
+        cfg = NULL;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    rl->worker.cfg = cfg;
+    rl->worker.elapsed_ms =
+        (double)(end.tv_sec - start.tv_sec) * 1000.0 + (double)(end.tv_nsec - start.tv_nsec) / 1e6;
+
+    uint64_t val = 1;
+    if (write(rl->worker.fd, &val, sizeof(val)) != sizeof(val)) {
+        ww_log_errno(LOG_ERROR, "failed to signal reload completion");
+    }
+
+    return NULL;
+}
+
+static void
+worker_start(struct reload *rl) {
+    ww_assert(!rl->worker.running);
+
+    rl->worker.cfg = NULL;
+    if (pthread_create(&rl->worker.thread, NULL, worker_run, rl) != 0) {
+        ww_log(LOG_ERROR, "failed to start configuration reload thread");
+        return;
+    }
+
+    rl->worker.running = true;
+}
+
+static struct config *
+worker_join(struct reload *rl) {
+    ww_assert(rl->worker.running);
+
+    pthread_join(rl->worker.thread, NULL);
+    rl->worker.running = false;
+
+    struct config *cfg = rl->worker.cfg;
+    rl->worker.cfg = NULL;
+    return cfg;
+}
+
+static int
+handle_worker(int32_t fd, uint32_t mask, void *data) {
+    struct reload *rl = data;
+
+    uint64_t val;
+    if (read(fd, &val, sizeof(val)) != sizeof(val)) {
+        ww_log_errno(LOG_ERROR, "failed to read reload eventfd");
+        return 0;
+    }
+
+    if (!rl->worker.running) {
+        return 0;
+    }
+
+    struct config *cfg = worker_join(rl);
+    if (cfg) {
+        config_apply_env(cfg);
+        rl->func(cfg, rl->data);
+        ww_log(LOG_INFO, "configuration reloaded (compiled in %.1f ms)", rl->worker.elapsed_ms);
+    } else {
+        ww_log(LOG_ERROR, "failed to load new config");
+    }
+
+    // If the configuration changed again while it was being compiled, the result is already stale
+    // and another reload is needed.
+    if (rl->worker.pending) {
+        rl->worker.pending = false;
+        worker_start(rl);
+    }
+
+    return 0;
+}
+
 static void
 reload_timer_fire(void *data) {
     struct reload *rl = data;
@@ -43,15 +136,12 @@ reload_timer_fire(void *data) {
     ww_timer_entry_destroy(rl->timer_entry);
     rl->timer_entry = NULL;
 
-    struct config *cfg = config_create();
-    if (config_load(cfg, rl->profile) != 0) {
-        ww_log(LOG_ERROR, "failed to load new config");
-        config_destroy(cfg);
+    if (rl->worker.running) {
+        rl->worker.pending = true;
         return;
     }
 
-    rl->func(cfg, rl->data);
-    ww_log(LOG_INFO, "configuration reloaded");
+    worker_start(rl);
 }
 
 static void
@@ -142,8 +232,8 @@ rm_config_watch(struct reload *rl, int wd) {
 }
 
 struct reload *
-reload_create(struct inotify *inotify, struct ww_timer *timer, const char *profile,
-              reload_func_t callback, void *data) {
+reload_create(struct wl_event_loop *loop, struct inotify *inotify, struct ww_timer *timer,
+              const char *profile, reload_func_t callback, void *data) {
     ww_assert(callback);
 
     struct reload *rl = zalloc(1, sizeof(*rl));
@@ -153,6 +243,16 @@ reload_create(struct inotify *inotify, struct ww_timer *timer, const char *profi
     rl->func = callback;
     rl->data = data;
 
+    rl->worker.fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (rl->worker.fd == -1) {
+        ww_log_errno(LOG_ERROR, "failed to create reload eventfd");
+        goto fail_eventfd;
+    }
+
+    rl->worker.src =
+        wl_event_loop_add_fd(loop, rl->worker.fd, WL_EVENT_READABLE, handle_worker, rl);
+    check_alloc(rl->worker.src);
+
     rl->config_path = str_new();
 
     const char *env = getenv("XDG_CONFIG_HOME");
@@ -214,6 +314,10 @@ fail_opendir:
 fail_watchdir:
 fail_path:
     str_free(rl->config_path);
+    wl_event_source_remove(rl->worker.src);
+    close(rl->worker.fd);
+
+fail_eventfd:
     free(rl);
     return NULL;
 }
@@ -225,6 +329,18 @@ reload_destroy(struct reload *rl) {
     }
     list_int_destroy(&rl->config_wd);
     str_free(rl->config_path);
+
+    // A configuration which is still being compiled cannot be cancelled, so wait for it and throw
+    // away the result.
+    if (rl->worker.running) {
+        struct config *cfg = worker_join(rl);
+        if (cfg) {
+            config_destroy(cfg);
+        }
+    }
+    wl_event_source_remove(rl->worker.src);
+    close(rl->worker.fd);
+
     free(rl);
 }
 
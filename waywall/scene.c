@@ -5,6 +5,7 @@
 
 #include "scene.h"
 #include "server/gl.h"
+#include "server/server.h"
 #include "server/ui.h"
 #include "util/alloc.h"
 #include "util/debug.h"
@@ -37,6 +38,7 @@ enum scene_object_type {
     SCENE_OBJECT_IMAGE,
     SCENE_OBJECT_MIRROR,
     SCENE_OBJECT_TEXT,
+    SCENE_OBJECT_WALL,
 };
 
 struct scene_object {
@@ -66,6 +68,7 @@ struct scene_mirror {
     struct scene *parent;
 
     size_t shader_index;
+    struct server_gl_capture *capture; // may be NULL
 
     GLuint vbo;
 
@@ -85,6 +88,30 @@ struct scene_text {
     uint32_t font_size;
 };
 
+/*
+ * A wall draws the latest capture of every instance into a grid, with the instance with index N
+ * in the Nth tile. All tiles are drawn from one vertex buffer with a single shader, followed by
+ * the lock and progress overlays in one more draw call.
+ */
+struct scene_wall {
+    struct scene_object object;
+    struct scene *parent;
+
+    size_t shader_index;
+
+    GLuint vbo;
+
+    struct box dst;
+    int32_t rows, cols, gap;
+    float lock_rgba[4], progress_rgba[4];
+    bool locked[SCENE_WALL_MAX_TILES];
+
+    // Scratch space reused each frame. Each tile has up to 3 rectangles (the capture and both
+    // overlays) of 6 vertices each.
+    struct vtx_shader vertices[SCENE_WALL_MAX_TILES * 3 * 6];
+    GLuint textures[SCENE_WALL_MAX_TILES];
+};
+
 static void object_add(struct scene *scene, struct scene_object *object,
                        enum scene_object_type type);
 static void object_list_destroy(struct wl_list *list);
@@ -95,12 +122,15 @@ static void object_sort(struct scene *scene, struct scene_object *object);
 static void draw_debug_text(struct scene *scene);
 static void draw_frame(struct scene *scene);
 static void draw_vertex_list(struct scene_shader *shader, size_t num_vertices);
+static void vertex_attribs_bind(void);
+static void vertex_attribs_unbind(void);
 static void rect_build(struct vtx_shader out[static 6], const struct box *src,
                        const struct box *dst, const float src_rgba[static 4],
                        const float dst_rgba[static 4]);
 static inline struct scene_image *scene_image_from_object(struct scene_object *object);
 static inline struct scene_mirror *scene_mirror_from_object(struct scene_object *object);
 static inline struct scene_text *scene_text_from_object(struct scene_object *object);
+static inline struct scene_wall *scene_wall_from_object(struct scene_object *object);
 
 static void
 image_build(struct scene_image *out, struct scene *scene, const struct scene_image_options *options,
@@ -199,6 +229,11 @@ mirror_release(struct scene_object *object) {
         server_gl_with(mirror->parent->gl, false) {
             glDeleteBuffers(1, &mirror->vbo);
         }
+
+        if (mirror->capture) {
+            server_gl_capture_unref(mirror->capture);
+            mirror->capture = NULL;
+        }
     }
 
     mirror->parent = NULL;
@@ -211,13 +246,18 @@ mirror_render(struct scene_object *object) {
     struct scene_mirror *mirror = scene_mirror_from_object(object);
     struct scene *scene = mirror->parent;
 
-    GLuint capture_texture = server_gl_get_capture(scene->gl);
+    struct server_gl_capture *capture = mirror->capture ? mirror->capture : scene->gl->capture;
+    if (!capture) {
+        return;
+    }
+
+    GLuint capture_texture = server_gl_capture_get_texture(capture);
     if (capture_texture == 0) {
         return;
     }
 
     int32_t width, height;
-    server_gl_get_capture_size(scene->gl, &width, &height);
+    server_gl_capture_get_size(capture, &width, &height);
 
     server_gl_shader_use(scene->shaders.data[mirror->shader_index].shader);
     glUniform2f(scene->shaders.data[mirror->shader_index].shader_u_dst_size, scene->ui->width,
@@ -733,15 +773,211 @@ text_render(struct scene_object *object) {
         }
     }
 }
+static void
+wall_release(struct scene_object *object) {
+    struct scene_wall *wall = scene_wall_from_object(object);
+
+    if (wall->parent) {
+        server_gl_with(wall->parent->gl, false) {
+            glDeleteBuffers(1, &wall->vbo);
+        }
+    }
+
+    wall->parent = NULL;
+}
+
+static struct box
+wall_tile(struct scene_wall *wall, int slot) {
+    int32_t width = (wall->dst.width - wall->gap * (wall->cols - 1)) / wall->cols;
+    int32_t height = (wall->dst.height - wall->gap * (wall->rows - 1)) / wall->rows;
+
+    return (struct box){
+        .x = wall->dst.x + (slot % wall->cols) * (width + wall->gap),
+        .y = wall->dst.y + (slot / wall->cols) * (height + wall->gap),
+        .width = width,
+        .height = height,
+    };
+}
+
+static void
+wall_render(struct scene_object *object) {
+    // The OpenGL context must be current.
+
+    struct scene_wall *wall = scene_wall_from_object(object);
+    struct scene *scene = wall->parent;
+
+    static const float WHITE[4] = {1, 1, 1, 1};
+    static const float NONE[4] = {0, 0, 0, 0};
+
+    const struct box unit = {0, 0, 1, 1};
+    int slots = wall->rows * wall->cols;
+
+    // Build the vertices for each visible tile. Texture coordinates are normalized so that the
+    // instances do not need to have the same size.
+    size_t num_tiles = 0;
+    for (size_t i = 0; i < scene->instances.len; i++) {
+        struct scene_instance *instance = &scene->instances.data[i];
+        if (instance->index < 1 || instance->index > slots) {
+            continue;
+        }
+
+        GLuint texture = server_gl_capture_get_texture(instance->capture);
+        if (texture == 0) {
+            continue;
+        }
+
+        struct box tile = wall_tile(wall, instance->index - 1);
+        rect_build(wall->vertices + num_tiles * 6, &unit, &tile, NONE, NONE);
+        wall->textures[num_tiles++] = texture;
+    }
+
+    // Overlays are drawn with the 1x1 white texture, which the color key in the default shader
+    // replaces with the overlay color.
+    size_t num_overlays = 0;
+    for (size_t i = 0; i < scene->instances.len; i++) {
+        struct scene_instance *instance = &scene->instances.data[i];
+        if (instance->index < 1 || instance->index > slots) {
+            continue;
+        }
+
+        struct box tile = wall_tile(wall, instance->index - 1);
+        struct vtx_shader *out = wall->vertices + (num_tiles + num_overlays) * 6;
+
+        if (wall->locked[instance->index - 1] && wall->lock_rgba[3] > 0) {
+            rect_build(out, &unit, &tile, WHITE, wall->lock_rgba);
+            out += 6;
+            num_overlays++;
+        }
+
+        if (instance->percent >= 0 && wall->progress_rgba[3] > 0) {
+            int32_t bar_height = tile.height / 32 > 2 ? tile.height / 32 : 2;
+            struct box bar = {
+                .x = tile.x,
+                .y = tile.y + tile.height - bar_height,
+                .width = tile.width * instance->percent / 100,
+                .height = bar_height,
+            };
+
+            rect_build(out, &unit, &bar, WHITE, wall->progress_rgba);
+            num_overlays++;
+        }
+    }
+
+    if (num_tiles == 0 && num_overlays == 0) {
+        return;
+    }
+
+    struct scene_shader *shader = &scene->shaders.data[wall->shader_index];
+
+    gl_using_buffer(GL_ARRAY_BUFFER, wall->vbo) {
+        glBufferData(GL_ARRAY_BUFFER, sizeof(*wall->vertices) * (num_tiles + num_overlays) * 6,
+                     wall->vertices, GL_STREAM_DRAW);
+        vertex_attribs_bind();
+
+        server_gl_shader_use(shader->shader);
+        glUniform2f(shader->shader_u_dst_size, scene->ui->width, scene->ui->height);
+        glUniform2f(shader->shader_u_src_size, 1, 1);
+
+        for (size_t i = 0; i < num_tiles; i++) {
+            glBindTexture(GL_TEXTURE_2D, wall->textures[i]);
+            glDrawArrays(GL_TRIANGLES, i * 6, 6);
+        }
+
+        if (num_overlays > 0) {
+            if (wall->shader_index != 0) {
+                shader = &scene->shaders.data[0];
+                server_gl_shader_use(shader->shader);
+                glUniform2f(shader->shader_u_dst_size, scene->ui->width, scene->ui->height);
+                glUniform2f(shader->shader_u_src_size, 1, 1);
+            }
+
+            glBindTexture(GL_TEXTURE_2D, scene->white_texture);
+            glDrawArrays(GL_TRIANGLES, num_tiles * 6, num_overlays * 6);
+        }
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+        vertex_attribs_unbind();
+    }
+}
+
 static void
 on_gl_frame(struct wl_listener *listener, void *data) {
     struct scene *scene = wl_container_of(listener, scene, on_gl_frame);
 
+    // Any pending redraw is covered by this frame.
+    if (scene->redraw_idle) {
+        wl_event_source_remove(scene->redraw_idle);
+        scene->redraw_idle = NULL;
+    }
+
+    // Listeners are notified before drawing so that any changes they make to the scene are visible
+    // in this frame.
+    wl_signal_emit_mutable(&scene->events.frame, NULL);
+
     server_gl_with(scene->gl, true) {
         draw_frame(scene);
     }
 }
 
+static bool
+capture_is_drawn(struct scene *scene, struct server_gl_capture *capture) {
+    bool in_instances = false;
+    for (size_t i = 0; i < scene->instances.len; i++) {
+        if (scene->instances.data[i].capture == capture) {
+            in_instances = true;
+            break;
+        }
+    }
+
+    struct wl_list *lists[] = {&scene->objects.sorted, &scene->objects.unsorted_mirrors,
+                               &scene->objects.unsorted_walls};
+    for (size_t i = 0; i < STATIC_ARRLEN(lists); i++) {
+        struct scene_object *object;
+        wl_list_for_each (object, lists[i], link) {
+            if (!object->enabled) {
+                continue;
+            }
+
+            if (object->type == SCENE_OBJECT_WALL && in_instances) {
+                return true;
+            }
+            if (object->type == SCENE_OBJECT_MIRROR &&
+                scene_mirror_from_object(object)->capture == capture) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static void
+handle_redraw_idle(void *data) {
+    struct scene *scene = data;
+    scene->redraw_idle = NULL;
+
+    // This is not a frame of the active instance, so the frame event is not signalled.
+    server_gl_with(scene->gl, true) {
+        draw_frame(scene);
+    }
+}
+
+static void
+on_gl_capture_commit(struct wl_listener *listener, void *data) {
+    struct scene *scene = wl_container_of(listener, scene, on_gl_capture_commit);
+    struct server_gl_capture *capture = data;
+
+    // Commits from other captures (e.g. hidden instances shown on a wall) are coalesced into at
+    // most one redraw per event loop iteration, and only if the capture is drawn at all.
+    if (scene->redraw_idle || !capture_is_drawn(scene, capture)) {
+        return;
+    }
+
+    struct wl_event_loop *loop = wl_display_get_event_loop(scene->gl->server->display);
+    scene->redraw_idle = wl_event_loop_add_idle(loop, handle_redraw_idle, scene);
+    check_alloc(scene->redraw_idle);
+}
+
 static void
 object_add(struct scene *scene, struct scene_object *object, enum scene_object_type type) {
     object->parent = scene;
@@ -773,6 +1009,9 @@ object_release(struct scene_object *object) {
     case SCENE_OBJECT_TEXT:
         text_release(object);
         break;
+    case SCENE_OBJECT_WALL:
+        wall_release(object);
+        break;
     }
 }
 
@@ -788,6 +1027,9 @@ object_render(struct scene_object *object) {
     case SCENE_OBJECT_TEXT:
         text_render(object);
         break;
+    case SCENE_OBJECT_WALL:
+        wall_render(object);
+        break;
     }
 }
 
@@ -804,6 +1046,9 @@ object_sort(struct scene *scene, struct scene_object *object) {
         case SCENE_OBJECT_TEXT:
             wl_list_insert(&scene->objects.unsorted_text, &object->link);
             break;
+        case SCENE_OBJECT_WALL:
+            wl_list_insert(&scene->objects.unsorted_walls, &object->link);
+            break;
         }
 
         return;
@@ -925,7 +1170,8 @@ should_draw_frame(struct scene *scene) {
     return util_debug_enabled || wl_list_length(&scene->objects.sorted) ||
            wl_list_length(&scene->objects.unsorted_text) ||
            wl_list_length(&scene->objects.unsorted_mirrors) ||
-           wl_list_length(&scene->objects.unsorted_images);
+           wl_list_length(&scene->objects.unsorted_images) ||
+           wl_list_length(&scene->objects.unsorted_walls);
 }
 
 static void
@@ -966,6 +1212,11 @@ draw_frame(struct scene *scene) {
     }
     glDisable(GL_STENCIL_TEST);
 
+    // Walls cover most of the window, so they are drawn before the other objects at depth 0.
+    wl_list_for_each (object, &scene->objects.unsorted_walls, link) {
+        if (object->enabled)
+            wall_render(object);
+    }
     wl_list_for_each (object, &scene->objects.unsorted_mirrors, link) {
         if (object->enabled)
             mirror_render(object);
@@ -998,6 +1249,16 @@ draw_vertex_list(struct scene_shader *shader, size_t num_vertices) {
     // The OpenGL context must be current, a texture must be bound to copy from, a vertex buffer
     // with data must be bound, and a valid shader must be in use.
 
+    vertex_attribs_bind();
+    glDrawArrays(GL_TRIANGLES, 0, num_vertices);
+    vertex_attribs_unbind();
+}
+
+static void
+vertex_attribs_bind(void) {
+    // The OpenGL context must be current and a vertex buffer must be bound. Every shader uses the
+    // same attribute locations, so the attributes stay valid when switching shaders.
+
     glVertexAttribPointer(SHADER_SRC_POS_ATTRIB_LOC, 2, GL_FLOAT, GL_FALSE,
                           sizeof(struct vtx_shader),
                           (const void *)offsetof(struct vtx_shader, src_pos));
@@ -1015,9 +1276,10 @@ draw_vertex_list(struct scene_shader *shader, size_t num_vertices) {
     glEnableVertexAttribArray(SHADER_DST_POS_ATTRIB_LOC);
     glEnableVertexAttribArray(SHADER_SRC_RGBA_ATTRIB_LOC);
     glEnableVertexAttribArray(SHADER_DST_RGBA_ATTRIB_LOC);
+}
 
-    glDrawArrays(GL_TRIANGLES, 0, num_vertices);
-
+static void
+vertex_attribs_unbind(void) {
     glDisableVertexAttribArray(SHADER_SRC_POS_ATTRIB_LOC);
     glDisableVertexAttribArray(SHADER_DST_POS_ATTRIB_LOC);
     glDisableVertexAttribArray(SHADER_SRC_RGBA_ATTRIB_LOC);
@@ -1070,6 +1332,12 @@ scene_text_from_object(struct scene_object *object) {
     return (struct scene_text *)object;
 }
 
+static inline struct scene_wall *
+scene_wall_from_object(struct scene_object *object) {
+    ww_assert(object->type == SCENE_OBJECT_WALL);
+    return (struct scene_wall *)object;
+}
+
 static bool
 image_load(struct scene_image *out, struct scene *scene, const char *path) {
     struct util_png png = util_png_decode(path, scene->image_max_size);
@@ -1169,6 +1437,14 @@ scene_create(struct config *cfg, struct server_gl *gl, struct server_ui *ui) {
         glGenBuffers(1, &scene->buffers.debug);
         glGenBuffers(1, &scene->buffers.stencil_rect);
 
+        glGenTextures(1, &scene->white_texture);
+        gl_using_texture(GL_TEXTURE_2D, scene->white_texture) {
+            static const uint8_t white[4] = {0xFF, 0xFF, 0xFF, 0xFF};
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        }
+
         // Initialize freetype
         if (FT_Init_FreeType(&scene->font.ft)) {
             ww_log(LOG_ERROR, "Failed to init freetype.");
@@ -1184,10 +1460,16 @@ scene_create(struct config *cfg, struct server_gl *gl, struct server_ui *ui) {
     scene->on_gl_frame.notify = on_gl_frame;
     wl_signal_add(&gl->events.frame, &scene->on_gl_frame);
 
+    scene->on_gl_capture_commit.notify = on_gl_capture_commit;
+    wl_signal_add(&gl->events.capture_commit, &scene->on_gl_capture_commit);
+
+    wl_signal_init(&scene->events.frame);
+
     wl_list_init(&scene->objects.sorted);
     wl_list_init(&scene->objects.unsorted_images);
     wl_list_init(&scene->objects.unsorted_mirrors);
     wl_list_init(&scene->objects.unsorted_text);
+    wl_list_init(&scene->objects.unsorted_walls);
 
     return scene;
 
@@ -1203,6 +1485,12 @@ scene_destroy(struct scene *scene) {
     object_list_destroy(&scene->objects.unsorted_images);
     object_list_destroy(&scene->objects.unsorted_mirrors);
     object_list_destroy(&scene->objects.unsorted_text);
+    object_list_destroy(&scene->objects.unsorted_walls);
+
+    for (size_t i = 0; i < scene->instances.len; i++) {
+        server_gl_capture_unref(scene->instances.data[i].capture);
+    }
+    free(scene->instances.data);
 
     server_gl_with(scene->gl, false) {
         for (size_t i = 0; i < scene->shaders.count; i++) {
@@ -1211,10 +1499,15 @@ scene_destroy(struct scene *scene) {
         }
 
         glDeleteBuffers(2, (GLuint[]){scene->buffers.debug, scene->buffers.stencil_rect});
+        glDeleteTextures(1, &scene->white_texture);
     }
     free(scene->shaders.data);
 
     wl_list_remove(&scene->on_gl_frame.link);
+    wl_list_remove(&scene->on_gl_capture_commit.link);
+    if (scene->redraw_idle) {
+        wl_event_source_remove(scene->redraw_idle);
+    }
 
     FT_Done_Face(scene->font.face);
     FT_Done_FreeType(scene->font.ft);
@@ -1297,6 +1590,10 @@ scene_add_mirror(struct scene *scene, const struct scene_mirror_options *options
     // Find correct shader for this mirror
     mirror->shader_index = shader_find_index(scene, options->shader_name);
 
+    if (options->capture) {
+        mirror->capture = server_gl_capture_ref(options->capture);
+    }
+
     mirror_build(mirror, options, scene);
 
     mirror->object.depth = options->depth;
@@ -1337,6 +1634,58 @@ scene_add_text(struct scene *scene, const char *data, const struct scene_text_op
     return text;
 }
 
+struct scene_wall *
+scene_add_wall(struct scene *scene, const struct scene_wall_options *options) {
+    ww_assert(options->rows > 0 && options->cols > 0);
+    ww_assert(options->rows * options->cols <= SCENE_WALL_MAX_TILES);
+
+    struct scene_wall *wall = zalloc(1, sizeof(*wall));
+
+    wall->parent = scene;
+    wall->dst = options->dst;
+    wall->rows = options->rows;
+    wall->cols = options->cols;
+    wall->gap = options->gap;
+    memcpy(wall->lock_rgba, options->lock_rgba, sizeof(wall->lock_rgba));
+    memcpy(wall->progress_rgba, options->progress_rgba, sizeof(wall->progress_rgba));
+
+    wall->shader_index = shader_find_index(scene, options->shader_name);
+
+    // The vertex buffer is filled on every frame, since the tiles change whenever an instance
+    // opens, closes or resizes.
+    server_gl_with(scene->gl, false) {
+        glGenBuffers(1, &wall->vbo);
+        ww_assert(wall->vbo != 0);
+    }
+
+    wall->object.depth = options->depth;
+    object_add(scene, (struct scene_object *)wall, SCENE_OBJECT_WALL);
+
+    wall->object.enabled = true;
+
+    return wall;
+}
+
+int
+scene_wall_set_locked(struct scene_wall *wall, int index, bool locked) {
+    if (index < 1 || index > wall->rows * wall->cols) {
+        return 1;
+    }
+
+    wall->locked[index - 1] = locked;
+    return 0;
+}
+
+int
+scene_wall_get_locked(struct scene_wall *wall, int index, bool *locked) {
+    if (index < 1 || index > wall->rows * wall->cols) {
+        return 1;
+    }
+
+    *locked = wall->locked[index - 1];
+    return 0;
+}
+
 struct Custom_atlas *
 scene_create_atlas(struct scene *scene, const uint32_t width, const char *data, size_t len) {
     struct Custom_atlas *atlas = malloc(sizeof(struct Custom_atlas));
@@ -1522,3 +1871,47 @@ scene_object_set_depth(struct scene_object *object, int32_t depth) {
     wl_list_remove(&object->link);
     object_sort(object->parent, object);
 }
+
+void
+scene_set_instance(struct scene *scene, int index, struct server_gl_capture *capture,
+                   int percent) {
+    for (size_t i = 0; i < scene->instances.len; i++) {
+        struct scene_instance *instance = &scene->instances.data[i];
+        if (instance->index != index) {
+            continue;
+        }
+
+        if (instance->capture != capture) {
+            server_gl_capture_unref(instance->capture);
+            instance->capture = server_gl_capture_ref(capture);
+        }
+        instance->percent = percent;
+        return;
+    }
+
+    struct scene_instance *data = realloc(
+        scene->instances.data, sizeof(*scene->instances.data) * (scene->instances.len + 1));
+    check_alloc(data);
+
+    data[scene->instances.len++] = (struct scene_instance){
+        .index = index,
+        .capture = server_gl_capture_ref(capture),
+        .percent = percent,
+    };
+    scene->instances.data = data;
+}
+
+void
+scene_remove_instance(struct scene *scene, int index) {
+    for (size_t i = 0; i < scene->instances.len; i++) {
+        if (scene->instances.data[i].index != index) {
+            continue;
+        }
+
+        server_gl_capture_unref(scene->instances.data[i].capture);
+        memmove(&scene->instances.data[i], &scene->instances.data[i + 1],
+                sizeof(*scene->instances.data) * (scene->instances.len - i - 1));
+        scene->instances.len--;
+        return;
+    }
+}
@@ -102,7 +102,7 @@
     util_log(lvl, "[%s:%d] " fmt ": %s", __FILE__, __LINE__, ##__VA_ARGS__, egl_strerror())
 
 struct gl_buffer {
-    struct wl_list link; // server_gl.capture.buffers
+    struct wl_list link; // server_gl_capture.buffers
     struct server_gl *gl;
 
     struct server_buffer *parent;
@@ -180,53 +180,91 @@ static const char *egl_strerror();
 static bool gl_checkerr(const char *msg);
 
 static void gl_buffer_destroy(struct gl_buffer *gl_buffer);
-static struct gl_buffer *gl_buffer_import(struct server_gl *gl, struct server_buffer *buffer);
+static struct gl_buffer *gl_buffer_import(struct server_gl *gl, struct wl_list *buffers,
+                                          struct server_buffer *buffer);
 
 static void
-on_surface_commit(struct wl_listener *listener, void *data) {
-    struct server_gl *gl = wl_container_of(listener, gl, on_surface_commit);
+capture_release_surface(struct server_gl_capture *capture) {
+    if (!capture->surface) {
+        return;
+    }
+
+    wl_list_remove(&capture->on_surface_commit.link);
+    wl_list_remove(&capture->on_surface_destroy.link);
+    capture->surface = NULL;
+
+    struct gl_buffer *gl_buffer, *gl_buffer_tmp;
+    wl_list_for_each_safe (gl_buffer, gl_buffer_tmp, &capture->buffers, link) {
+        gl_buffer_destroy(gl_buffer);
+    }
+    capture->current = NULL;
+}
+
+static void
+capture_destroy(struct server_gl_capture *capture) {
+    capture_release_surface(capture);
+
+    if (capture->gl->capture == capture) {
+        capture->gl->capture = NULL;
+    }
 
-    wl_signal_emit_mutable(&gl->events.frame, NULL);
+    wl_list_remove(&capture->link);
+    free(capture);
+}
+
+static void
+on_capture_surface_commit(struct wl_listener *listener, void *data) {
+    struct server_gl_capture *capture = wl_container_of(listener, capture, on_surface_commit);
+    struct server_gl *gl = capture->gl;
 
-    struct server_buffer *buffer = server_surface_next_buffer(gl->capture.surface);
+    // Only the active capture drives the frame rate of the scene. Other captures (e.g. hidden
+    // instances) may commit at a different rate, and listeners decide whether they need a redraw.
+    if (capture == gl->capture) {
+        wl_signal_emit_mutable(&gl->events.frame, NULL);
+    } else {
+        wl_signal_emit_mutable(&gl->events.capture_commit, capture);
+    }
+
+    struct server_buffer *buffer = server_surface_next_buffer(capture->surface);
     if (!buffer) {
-        gl->capture.current = NULL;
+        capture->current = NULL;
         return;
     }
 
     // Check if the committed wl_buffer has already been imported.
     struct gl_buffer *gl_buffer;
-    wl_list_for_each (gl_buffer, &gl->capture.buffers, link) {
+    wl_list_for_each (gl_buffer, &capture->buffers, link) {
         if (gl_buffer->parent == buffer) {
-            gl->capture.current = gl_buffer;
+            capture->current = gl_buffer;
             return;
         }
     }
 
     // If the given wl_buffer has not yet been imported, try to import it.
-    gl_buffer = gl_buffer_import(gl, buffer);
+    gl_buffer = gl_buffer_import(gl, &capture->buffers, buffer);
     if (!gl_buffer) {
-        gl->capture.current = NULL;
+        capture->current = NULL;
         return;
     }
 
     // If there are too many cached buffers, remove the oldest one.
-    if (wl_list_length(&gl->capture.buffers) > MAX_CACHED_DMABUF) {
+    if (wl_list_length(&capture->buffers) > MAX_CACHED_DMABUF) {
         struct gl_buffer *buffer;
-        wl_list_for_each_reverse (buffer, &gl->capture.buffers, link) {
+        wl_list_for_each_reverse (buffer, &capture->buffers, link) {
             gl_buffer_destroy(buffer);
             break;
         }
     }
 
-    gl->capture.current = gl_buffer;
+    capture->current = gl_buffer;
 }
 
 static void
-on_surface_destroy(struct wl_listener *listener, void *data) {
-    struct server_gl *gl = wl_container_of(listener, gl, on_surface_destroy);
+on_capture_surface_destroy(struct wl_listener *listener, void *data) {
+    struct server_gl_capture *capture = wl_container_of(listener, capture, on_surface_destroy);
 
-    gl->capture.current = NULL;
+    // Any scene objects still holding a reference to this capture will draw nothing from now on.
+    capture_release_surface(capture);
 }
 
 static void
@@ -350,7 +388,7 @@ gl_buffer_destroy(struct gl_buffer *gl_buffer) {
 }
 
 static struct gl_buffer *
-gl_buffer_import(struct server_gl *gl, struct server_buffer *buffer) {
+gl_buffer_import(struct server_gl *gl, struct wl_list *buffers, struct server_buffer *buffer) {
     if (strcmp(buffer->impl->name, SERVER_BUFFER_DMABUF) != 0) {
         ww_log(LOG_ERROR, "cannot create server_gl_surface for non-DMABUF buffer");
         return NULL;
@@ -428,7 +466,7 @@ gl_buffer_import(struct server_gl *gl, struct server_buffer *buffer) {
         }
     }
 
-    wl_list_insert(&gl->capture.buffers, &gl_buffer->link);
+    wl_list_insert(buffers, &gl_buffer->link);
 
     return gl_buffer;
 
@@ -615,9 +653,10 @@ server_gl_create(struct server *server) {
         egl_print_sysinfo(gl);
     }
 
-    wl_list_init(&gl->capture.buffers);
+    wl_list_init(&gl->captures);
 
     wl_signal_init(&gl->events.frame);
+    wl_signal_init(&gl->events.capture_commit);
 
     return gl;
 
@@ -648,15 +687,14 @@ void
 server_gl_destroy(struct server_gl *gl) {
     eglMakeCurrent(gl->egl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, gl->egl.ctx);
 
-    // Destroy capture resources.
-    if (gl->capture.surface) {
-        wl_list_remove(&gl->on_surface_commit.link);
-        wl_list_remove(&gl->on_surface_destroy.link);
-    }
-
-    struct gl_buffer *gl_buffer, *gl_buffer_tmp;
-    wl_list_for_each_safe (gl_buffer, gl_buffer_tmp, &gl->capture.buffers, link) {
-        gl_buffer_destroy(gl_buffer);
+    // Destroy capture resources. Every scene object should have released its captures by now, but
+    // any remaining references are dropped regardless.
+    struct server_gl_capture *capture, *capture_tmp;
+    wl_list_for_each_safe (capture, capture_tmp, &gl->captures, link) {
+        if (capture->refcount > 0) {
+            ww_log(LOG_WARN, "capture still has %d references on destroy", capture->refcount);
+        }
+        capture_destroy(capture);
     }
 
     // Destroy surface resources.
@@ -724,32 +762,26 @@ fail_vert:
 
 GLuint
 server_gl_get_capture(struct server_gl *gl) {
-    if (!gl->capture.current) {
+    if (!gl->capture) {
         return 0;
     }
 
-    return gl->capture.current->texture;
+    return server_gl_capture_get_texture(gl->capture);
 }
 
 void
 server_gl_get_capture_size(struct server_gl *gl, int32_t *width, int32_t *height) {
-    ww_assert(gl->capture.current);
-    server_buffer_get_size(gl->capture.current->parent, width, height);
+    ww_assert(gl->capture);
+    server_gl_capture_get_size(gl->capture, width, height);
 }
 
 void
-server_gl_set_capture(struct server_gl *gl, struct server_surface *surface) {
-    if (gl->capture.surface) {
-        ww_panic("cannot overwrite capture surface");
-    }
-
-    gl->capture.surface = surface;
+server_gl_set_capture(struct server_gl *gl, struct server_gl_capture *capture) {
+    ww_assert(!capture || capture->gl == gl);
 
-    gl->on_surface_commit.notify = on_surface_commit;
-    wl_signal_add(&surface->events.commit, &gl->on_surface_commit);
-
-    gl->on_surface_destroy.notify = on_surface_destroy;
-    wl_signal_add(&surface->events.destroy, &gl->on_surface_destroy);
+    // The active capture is not referenced by the server_gl. Its owner must switch to another
+    // capture (or NULL) before releasing it, otherwise it is cleared on destruction.
+    gl->capture = capture;
 }
 
 void
@@ -758,6 +790,56 @@ server_gl_swap_buffers(struct server_gl *gl) {
     eglSwapBuffers(gl->egl.display, gl->surface.egl);
 }
 
+struct server_gl_capture *
+server_gl_capture_create(struct server_gl *gl, struct server_surface *surface) {
+    struct server_gl_capture *capture = zalloc(1, sizeof(*capture));
+
+    capture->gl = gl;
+    capture->refcount = 1;
+    capture->surface = surface;
+    wl_list_init(&capture->buffers);
+
+    capture->on_surface_commit.notify = on_capture_surface_commit;
+    wl_signal_add(&surface->events.commit, &capture->on_surface_commit);
+
+    capture->on_surface_destroy.notify = on_capture_surface_destroy;
+    wl_signal_add(&surface->events.destroy, &capture->on_surface_destroy);
+
+    wl_list_insert(&gl->captures, &capture->link);
+
+    return capture;
+}
+
+struct server_gl_capture *
+server_gl_capture_ref(struct server_gl_capture *capture) {
+    capture->refcount++;
+    return capture;
+}
+
+void
+server_gl_capture_unref(struct server_gl_capture *capture) {
+    ww_assert(capture->refcount > 0);
+
+    if (--capture->refcount == 0) {
+        capture_destroy(capture);
+    }
+}
+
+GLuint
+server_gl_capture_get_texture(struct server_gl_capture *capture) {
+    if (!capture->current) {
+        return 0;
+    }
+
+    return capture->current->texture;
+}
+
+void
+server_gl_capture_get_size(struct server_gl_capture *capture, int32_t *width, int32_t *height) {
+    ww_assert(capture->current);
+    server_buffer_get_size(capture->current->parent, width, height);
+}
+
 void
 server_gl_shader_destroy(struct server_gl_shader *shader) {
     // The OpenGL context must be current.
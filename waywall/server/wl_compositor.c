@@ -8,6 +8,7 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <time.h>
 #include <wayland-client-protocol.h>
 #include <wayland-server-protocol.h>
 
@@ -18,17 +19,28 @@ struct server_surface_damage {
 };
 
 struct server_surface_frame {
+    struct wl_list link; // server_surface.throttle.pending, server_surface.throttle.ready
     struct wl_resource *resource; // wl_callback
 
     struct server_surface *surface;
-    struct wl_callback *remote;
+    struct wl_callback *remote; // NULL if throttled
 };
 
+static int64_t
+now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
 static void
 surface_frame_resource_destroy(struct wl_resource *resource) {
     struct server_surface_frame *frame = wl_resource_get_user_data(resource);
 
-    wl_callback_destroy(frame->remote);
+    wl_list_remove(&frame->link);
+    if (frame->remote) {
+        wl_callback_destroy(frame->remote);
+    }
     free(frame);
 }
 
@@ -36,13 +48,47 @@ static void
 on_surface_frame_done(void *data, struct wl_callback *wl, uint32_t callback_data) {
     struct server_surface_frame *frame = data;
 
+    // wl_callback.done is a destructor event, so the resource must be destroyed after sending it.
     wl_callback_send_done(frame->resource, callback_data);
+    wl_resource_destroy(frame->resource);
 }
 
 static const struct wl_callback_listener surface_frame_listener = {
     .done = on_surface_frame_done,
 };
 
+static void
+throttle_send_done(struct server_surface *surface) {
+    surface->throttle.last_done = now_ms();
+
+    struct server_surface_frame *frame, *tmp;
+    wl_list_for_each_safe (frame, tmp, &surface->throttle.ready, link) {
+        wl_callback_send_done(frame->resource, (uint32_t)surface->throttle.last_done);
+        wl_resource_destroy(frame->resource);
+    }
+}
+
+static int
+handle_throttle_timer(void *data) {
+    struct server_surface *surface = data;
+
+    throttle_send_done(surface);
+    return 0;
+}
+
+static void
+throttle_schedule(struct server_surface *surface) {
+    if (wl_list_empty(&surface->throttle.ready)) {
+        return;
+    }
+
+    // A delay of 0 would disarm the timer, so callbacks which are already due are completed after
+    // 1ms instead.
+    int64_t interval = 1000 / surface->throttle.fps;
+    int64_t delay = surface->throttle.last_done + interval - now_ms();
+    wl_event_source_timer_update(surface->throttle.timer, delay > 0 ? delay : 1);
+}
+
 static void
 surface_state_reset(struct server_surface_state *state) {
     wl_array_release(&state->damage);
@@ -94,6 +140,21 @@ surface_resource_destroy(struct wl_resource *resource) {
 
     wl_signal_emit_mutable(&surface->events.destroy, surface);
 
+    // Any throttled frame callbacks which have not been completed yet will be destroyed by the
+    // client later, so they must not reference the surface anymore.
+    struct server_surface_frame *frame, *tmp;
+    wl_list_for_each_safe (frame, tmp, &surface->throttle.pending, link) {
+        wl_list_remove(&frame->link);
+        wl_list_init(&frame->link);
+    }
+    wl_list_for_each_safe (frame, tmp, &surface->throttle.ready, link) {
+        wl_list_remove(&frame->link);
+        wl_list_init(&frame->link);
+    }
+    if (surface->throttle.timer) {
+        wl_event_source_remove(surface->throttle.timer);
+    }
+
     if (surface->role && surface->role_resource) {
         surface->role->destroy(surface->role_resource);
     }
@@ -185,6 +246,14 @@ surface_commit(struct wl_client *client, struct wl_resource *resource) {
 
     surface_state_reset(&surface->pending);
     wl_surface_commit(surface->remote);
+
+    // Frame callbacks only become active once the surface is committed.
+    if (!wl_list_empty(&surface->throttle.pending)) {
+        wl_list_insert_list(surface->throttle.ready.prev, &surface->throttle.pending);
+        wl_list_init(&surface->throttle.pending);
+
+        throttle_schedule(surface);
+    }
 }
 
 static void
@@ -232,6 +301,14 @@ surface_frame(struct wl_client *client, struct wl_resource *resource, uint32_t i
     check_alloc(frame->resource);
     wl_resource_set_implementation(frame->resource, NULL, frame, surface_frame_resource_destroy);
 
+    frame->surface = surface;
+
+    if (surface->throttle.fps > 0) {
+        wl_list_insert(surface->throttle.pending.prev, &frame->link);
+        return;
+    }
+    wl_list_init(&frame->link);
+
     frame->remote = wl_surface_frame(surface->remote);
     check_alloc(frame->remote);
     wl_callback_add_listener(frame->remote, &surface_frame_listener, frame);
@@ -341,6 +418,9 @@ compositor_create_surface(struct wl_client *client, struct wl_resource *resource
 
     surface->parent = compositor;
 
+    wl_list_init(&surface->throttle.pending);
+    wl_list_init(&surface->throttle.ready);
+
     wl_signal_init(&surface->events.commit);
     wl_signal_init(&surface->events.destroy);
 
@@ -440,3 +520,37 @@ server_surface_set_role(struct server_surface *surface, const struct server_surf
     surface->role_resource = role_resource;
     return 0;
 }
+
+void
+server_surface_set_frame_rate(struct server_surface *surface, int32_t fps) {
+    ww_assert(fps >= 0);
+
+    if (surface->throttle.fps == fps) {
+        return;
+    }
+    surface->throttle.fps = fps;
+
+    if (fps == 0) {
+        // Complete any callbacks which were being held back. Callbacks which are still pending
+        // (requested but not yet committed) are completed right away as well, since the client
+        // will commit soon and there is no remote callback to wait for.
+        wl_list_insert_list(surface->throttle.ready.prev, &surface->throttle.pending);
+        wl_list_init(&surface->throttle.pending);
+        throttle_send_done(surface);
+
+        if (surface->throttle.timer) {
+            wl_event_source_timer_update(surface->throttle.timer, 0);
+        }
+        return;
+    }
+
+    if (!surface->throttle.timer) {
+        struct wl_client *client = wl_resource_get_client(surface->resource);
+        struct wl_event_loop *loop = wl_display_get_event_loop(wl_client_get_display(client));
+
+        surface->throttle.timer = wl_event_loop_add_timer(loop, handle_throttle_timer, surface);
+        check_alloc(surface->throttle.timer);
+    }
+
+    throttle_schedule(surface);
+}
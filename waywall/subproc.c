@@ -3,17 +3,144 @@
 #include "util/alloc.h"
 #include "util/list.h"
 #include "util/log.h"
+#include "util/prelude.h"
 #include "util/syscall.h"
+#include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <wayland-server-core.h>
 
+// The number of reads performed to drain a stream once its subprocess has exited. This prevents a
+// grandchild which inherited the pipe and keeps writing to it from stalling the event loop.
+#define MAX_DRAIN_READS 64
+
 LIST_DEFINE_IMPL(struct subproc_entry, list_subproc_entry);
 
+extern char **environ;
+
 static void destroy_entry(struct subproc *subproc, ssize_t index);
 
+static void
+stream_emit(struct subproc *subproc, ssize_t index, int stream_idx, bool flush) {
+    // The output callback may spawn another subprocess, which can reallocate the list of entries.
+    // The entry is looked up again after every callback. The line buffer itself does not move.
+    struct subproc_entry *entry = &subproc->entries.data[index];
+    char *buf = entry->streams[stream_idx].buf;
+    size_t len = entry->streams[stream_idx].len;
+
+    size_t start = 0;
+    while (start < len) {
+        char *newline = memchr(buf + start, '\n', len - start);
+
+        size_t line_len;
+        if (newline) {
+            line_len = newline - (buf + start);
+        } else if (flush || (start == 0 && len == SUBPROC_MAX_LINE)) {
+            line_len = len - start;
+        } else {
+            break;
+        }
+
+        entry = &subproc->entries.data[index];
+        if (entry->capture.output) {
+            entry->capture.output(entry->capture.data, stream_idx == 1, buf + start, line_len);
+        }
+
+        start += line_len + (newline ? 1 : 0);
+    }
+
+    entry = &subproc->entries.data[index];
+    memmove(buf, buf + start, len - start);
+    entry->streams[stream_idx].len = len - start;
+}
+
+static int
+stream_read(struct subproc *subproc, ssize_t index, int stream_idx) {
+    struct subproc_stream *stream = &subproc->entries.data[index].streams[stream_idx];
+
+    ssize_t n;
+    do {
+        n = read(stream->fd, stream->buf + stream->len, SUBPROC_MAX_LINE - stream->len);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1) {
+        if (errno != EAGAIN) {
+            ww_log_errno(LOG_ERROR, "failed to read output of child process %jd",
+                         (intmax_t)subproc->entries.data[index].pid);
+        }
+        return n;
+    }
+
+    stream->len += n;
+    stream_emit(subproc, index, stream_idx, false);
+    return n;
+}
+
+static void
+stream_close(struct subproc *subproc, ssize_t index, int stream_idx, bool flush) {
+    struct subproc_stream *stream = &subproc->entries.data[index].streams[stream_idx];
+    if (stream->fd == -1) {
+        return;
+    }
+
+    if (flush) {
+        stream_emit(subproc, index, stream_idx, true);
+        stream = &subproc->entries.data[index].streams[stream_idx];
+    }
+
+    wl_event_source_remove(stream->src);
+    close(stream->fd);
+    free(stream->buf);
+
+    stream->fd = -1;
+    stream->src = NULL;
+    stream->buf = NULL;
+    stream->len = 0;
+}
+
+static ssize_t
+find_stream(struct subproc *subproc, int fd, int *stream_idx) {
+    for (ssize_t i = 0; i < subproc->entries.len; i++) {
+        for (size_t j = 0; j < STATIC_ARRLEN(subproc->entries.data[i].streams); j++) {
+            if (subproc->entries.data[i].streams[j].fd == fd) {
+                *stream_idx = j;
+                return i;
+            }
+        }
+    }
+
+    return -1;
+}
+
+static int
+handle_stream(int32_t fd, uint32_t mask, void *data) {
+    struct subproc *subproc = data;
+
+    int stream_idx;
+    ssize_t entry_index = find_stream(subproc, fd, &stream_idx);
+    ww_assert(entry_index >= 0);
+
+    // Only one read is performed per event so that a subprocess with a lot of output cannot starve
+    // the rest of the event loop. The pipe is level triggered, so any remaining data is read on the
+    // next iteration.
+    if (mask & WL_EVENT_READABLE) {
+        ssize_t n = stream_read(subproc, entry_index, stream_idx);
+        if (n > 0 || (n == -1 && errno == EAGAIN)) {
+            return 0;
+        }
+    }
+
+    stream_close(subproc, entry_index, stream_idx, true);
+    return 0;
+}
+
 static int
 handle_pidfd(int32_t fd, uint32_t mask, void *data) {
     struct subproc *subproc = data;
@@ -28,8 +155,10 @@ handle_pidfd(int32_t fd, uint32_t mask, void *data) {
     ww_assert(entry_index >= 0);
 
     struct subproc_entry *entry = &subproc->entries.data[entry_index];
-    if (waitpid(entry->pid, NULL, 0) != entry->pid) {
+    int status = -1;
+    if (waitpid(entry->pid, &status, 0) != entry->pid) {
         ww_log_errno(LOG_ERROR, "failed to waitpid on child process %jd", (intmax_t)entry->pid);
+        status = -1;
     }
     if (pidfd_send_signal(entry->pidfd, SIGKILL, NULL, 0) != 0) {
         if (errno != ESRCH) {
@@ -37,6 +166,25 @@ handle_pidfd(int32_t fd, uint32_t mask, void *data) {
         }
     }
 
+    // Any output which the subprocess wrote before exiting is still in the pipes, and it must be
+    // delivered before the exit status.
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < MAX_DRAIN_READS; j++) {
+            if (subproc->entries.data[entry_index].streams[i].fd == -1) {
+                break;
+            }
+            if (stream_read(subproc, entry_index, i) <= 0) {
+                break;
+            }
+        }
+        stream_close(subproc, entry_index, i, true);
+    }
+
+    entry = &subproc->entries.data[entry_index];
+    if (entry->capture.exit) {
+        entry->capture.exit(entry->capture.data, status);
+    }
+
     destroy_entry(subproc, entry_index);
     return 0;
 }
@@ -45,12 +193,37 @@ static void
 destroy_entry(struct subproc *subproc, ssize_t index) {
     struct subproc_entry *entry = &subproc->entries.data[index];
 
+    for (size_t i = 0; i < STATIC_ARRLEN(entry->streams); i++) {
+        stream_close(subproc, index, i, false);
+    }
+
     wl_event_source_remove(entry->pidfd_src);
     close(entry->pidfd);
 
     list_subproc_entry_remove(&subproc->entries, index);
 }
 
+static int
+create_pipe(int fds[static 2]) {
+    if (pipe(fds) != 0) {
+        ww_log_errno(LOG_ERROR, "failed to create pipe for child process");
+        return 1;
+    }
+
+    // Only the read end is non-blocking. The child's end of the pipe is duplicated onto its
+    // stdout or stderr, which clears FD_CLOEXEC for the duplicate only.
+    bool ok = fcntl(fds[0], F_SETFD, FD_CLOEXEC) == 0 && fcntl(fds[1], F_SETFD, FD_CLOEXEC) == 0 &&
+              fcntl(fds[0], F_SETFL, O_NONBLOCK) == 0;
+    if (!ok) {
+        ww_log_errno(LOG_ERROR, "failed to set pipe flags for child process");
+        close(fds[0]);
+        close(fds[1]);
+        return 1;
+    }
+
+    return 0;
+}
+
 struct subproc *
 subproc_create(struct server *server) {
     struct subproc *subproc = zalloc(1, sizeof(*subproc));
@@ -70,6 +243,13 @@ subproc_destroy(struct subproc *subproc) {
             }
         }
 
+        for (size_t j = 0; j < STATIC_ARRLEN(entry->streams); j++) {
+            stream_close(subproc, i, j, false);
+        }
+        if (entry->capture.exit) {
+            entry->capture.exit(entry->capture.data, -1);
+        }
+
         wl_event_source_remove(entry->pidfd_src);
         close(entry->pidfd);
     }
@@ -79,38 +259,162 @@ subproc_destroy(struct subproc *subproc) {
 }
 
 void
-subproc_exec(struct subproc *subproc, char *cmd[static 64]) {
-    pid_t pid = fork();
-    if (pid == 0) {
-        // Child process
-        int out = open("/dev/null", O_WRONLY);
-        if (out == -1) {
-            ww_log_errno(LOG_ERROR, "failed to open /dev/null in child process");
-            exit(EXIT_FAILURE);
-        }
-        if (dup2(out, STDOUT_FILENO) == -1) {
-            ww_log_errno(LOG_ERROR, "failed to duplicate /dev/null to stdout in child process");
-            exit(EXIT_FAILURE);
-        }
-
-        execvp(cmd[0], cmd);
-        ww_log_errno(LOG_ERROR, "failed to execvp() in child porcess");
-        exit(EXIT_FAILURE);
-    } else if (pid == -1) {
-        // Parent process (error)
-        ww_log_errno(LOG_ERROR, "failed to fork() child process");
-        return;
+subproc_detach(struct subproc *subproc, pid_t pid) {
+    for (ssize_t i = 0; i < subproc->entries.len; i++) {
+        struct subproc_entry *entry = &subproc->entries.data[i];
+
+        // The pipes are still read until the subprocess exits so that it does not block on a full
+        // pipe, but its output is discarded.
+        if (entry->pid == pid) {
+            entry->capture = (struct subproc_capture){0};
+            return;
+        }
+    }
+}
+
+static pid_t
+get_ppid(pid_t pid) {
+    char path[64];
+    snprintf(path, STATIC_ARRLEN(path), "/proc/%jd/stat", (intmax_t)pid);
+
+    FILE *file = fopen(path, "re");
+    if (!file) {
+        return -1;
     }
 
+    char buf[512];
+    size_t n = fread(buf, 1, STATIC_ARRLEN(buf) - 1, file);
+    fclose(file);
+    buf[n] = '\0';
+
+    // The process name is in parentheses and may itself contain spaces or parentheses, so the
+    // fields are parsed from the last closing parenthesis: ") <state> <ppid> ...".
+    char *end = strrchr(buf, ')');
+    long ppid;
+    if (!end || sscanf(end + 1, " %*c %ld", &ppid) != 1) {
+        return -1;
+    }
+    return (pid_t)ppid;
+}
+
+bool
+subproc_owns(struct subproc *subproc, pid_t pid) {
+    // The chain of parents is followed up to waywall (or init, for processes which were not
+    // started by waywall), so that programs started through a shell are found as well.
+    pid_t self = getpid();
+    for (size_t depth = 0; pid > 1 && pid != self && depth < 64; depth++) {
+        for (ssize_t i = 0; i < subproc->entries.len; i++) {
+            if (subproc->entries.data[i].pid == pid) {
+                return true;
+            }
+        }
+
+        pid = get_ppid(pid);
+    }
+
+    return false;
+}
+
+pid_t
+subproc_exec(struct subproc *subproc, char *cmd[static 64],
+             const struct subproc_capture *capture) {
+    int pipes[2][2] = {{-1, -1}, {-1, -1}};
+    bool capture_output = capture && capture->output;
+
+    // posix_spawn is used rather than fork so that the page tables of the compositor (which has
+    // large GL, LuaJIT, and buffer mappings) do not need to be copied for every child. glibc
+    // implements it with CLONE_VM | CLONE_VFORK and reports exec failures back to the caller.
+    posix_spawn_file_actions_t actions;
+    if (posix_spawn_file_actions_init(&actions) != 0) {
+        ww_log(LOG_ERROR, "failed to initialize spawn file actions");
+        return -1;
+    }
+
+    posix_spawnattr_t attr;
+    if (posix_spawnattr_init(&attr) != 0) {
+        ww_log(LOG_ERROR, "failed to initialize spawn attributes");
+        goto fail_attr;
+    }
+
+    if (capture_output) {
+        if (create_pipe(pipes[0]) != 0 || create_pipe(pipes[1]) != 0) {
+            goto fail_setup;
+        }
+
+        int ret = posix_spawn_file_actions_adddup2(&actions, pipes[0][1], STDOUT_FILENO);
+        if (ret == 0) {
+            ret = posix_spawn_file_actions_adddup2(&actions, pipes[1][1], STDERR_FILENO);
+        }
+        if (ret != 0) {
+            errno = ret;
+            ww_log_errno(LOG_ERROR, "failed to add pipe redirection for child process");
+            goto fail_setup;
+        }
+    } else {
+        int ret =
+            posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+        if (ret != 0) {
+            errno = ret;
+            ww_log_errno(LOG_ERROR, "failed to add /dev/null redirection for child process");
+            goto fail_setup;
+        }
+    }
+
+    // The event loop blocks the signals it handles (e.g. SIGINT) so that it can receive them with a
+    // signalfd. The child should not inherit that signal mask.
+    sigset_t mask;
+    sigemptyset(&mask);
+    if (posix_spawnattr_setsigmask(&attr, &mask) != 0 ||
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK) != 0) {
+        ww_log(LOG_ERROR, "failed to set spawn attributes");
+        goto fail_setup;
+    }
+
+    pid_t pid;
+    int ret = posix_spawnp(&pid, cmd[0], &actions, &attr, cmd, environ);
+    if (ret != 0) {
+        errno = ret;
+        ww_log_errno(LOG_ERROR, "failed to spawn child process '%s'", cmd[0]);
+        goto fail_setup;
+    }
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+
+    // The write ends belong to the child now. Keeping them open would prevent the read ends from
+    // ever reaching EOF.
+    for (size_t i = 0; i < STATIC_ARRLEN(pipes); i++) {
+        if (pipes[i][1] != -1) {
+            close(pipes[i][1]);
+        }
+    }
+
+    struct wl_event_loop *loop = wl_display_get_event_loop(subproc->server->display);
+
     int pidfd = pidfd_open(pid, 0);
     if (pidfd == -1) {
         ww_log_errno(LOG_ERROR, "failed to open pidfd for subprocess %jd", (intmax_t)pid);
-        return;
+        for (size_t i = 0; i < STATIC_ARRLEN(pipes); i++) {
+            if (pipes[i][0] != -1) {
+                close(pipes[i][0]);
+            }
+        }
+
+        // Without a pidfd, the exit of the subprocess cannot be observed. A captured subprocess
+        // is killed and reaped rather than left running with callbacks that would never be called.
+        if (capture) {
+            if (kill(pid, SIGKILL) != 0) {
+                ww_log_errno(LOG_ERROR, "failed to kill child process %jd", (intmax_t)pid);
+            }
+            while (waitpid(pid, NULL, 0) == -1 && errno == EINTR) {
+            }
+            return -1;
+        }
+        return pid;
     }
 
     struct wl_event_source *src =
-        wl_event_loop_add_fd(wl_display_get_event_loop(subproc->server->display), pidfd,
-                             WL_EVENT_READABLE, handle_pidfd, subproc);
+        wl_event_loop_add_fd(loop, pidfd, WL_EVENT_READABLE, handle_pidfd, subproc);
     check_alloc(src);
 
     struct subproc_entry entry = {0};
@@ -119,5 +423,38 @@ subproc_exec(struct subproc *subproc, char *cmd[static 64]) {
     entry.pidfd = pidfd;
     entry.pidfd_src = src;
 
+    if (capture) {
+        entry.capture = *capture;
+    }
+
+    for (size_t i = 0; i < STATIC_ARRLEN(entry.streams); i++) {
+        entry.streams[i].fd = pipes[i][0];
+        if (entry.streams[i].fd == -1) {
+            continue;
+        }
+
+        entry.streams[i].src = wl_event_loop_add_fd(loop, entry.streams[i].fd, WL_EVENT_READABLE,
+                                                    handle_stream, subproc);
+        check_alloc(entry.streams[i].src);
+
+        entry.streams[i].buf = malloc(SUBPROC_MAX_LINE);
+        check_alloc(entry.streams[i].buf);
+    }
+
     list_subproc_entry_append(&subproc->entries, entry);
+    return pid;
+
+fail_setup:
+    for (size_t i = 0; i < STATIC_ARRLEN(pipes); i++) {
+        for (size_t j = 0; j < STATIC_ARRLEN(pipes[i]); j++) {
+            if (pipes[i][j] != -1) {
+                close(pipes[i][j]);
+            }
+        }
+    }
+    posix_spawnattr_destroy(&attr);
+
+fail_attr:
+    posix_spawn_file_actions_destroy(&actions);
+    return -1;
 }
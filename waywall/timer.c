@@ -1,17 +1,235 @@
 #include "timer.h"
 #include "server/server.h"
 #include "util/alloc.h"
+#include "util/list.h"
 #include "util/log.h"
+#include "util/prelude.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <sys/timerfd.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 #include <wayland-server-core.h>
 
+/*
+ * All timer entries share a single timerfd, which is always armed to the earliest deadline of any
+ * scheduled entry. Scheduled entries are kept in a binary min-heap so that adding, rescheduling,
+ * and removing an entry are O(log n) and only require a syscall when the earliest deadline changes.
+ */
+
+LIST_DEFINE_IMPL(struct ww_timer_entry *, list_timer_entry);
+
+static int
+timespec_cmp(struct timespec a, struct timespec b) {
+    if (a.tv_sec != b.tv_sec) {
+        return a.tv_sec < b.tv_sec ? -1 : 1;
+    }
+    if (a.tv_nsec != b.tv_nsec) {
+        return a.tv_nsec < b.tv_nsec ? -1 : 1;
+    }
+    return 0;
+}
+
+static struct timespec
+timespec_add(struct timespec a, struct timespec b) {
+    struct timespec ret = {
+        .tv_sec = a.tv_sec + b.tv_sec,
+        .tv_nsec = a.tv_nsec + b.tv_nsec,
+    };
+
+    // Either operand may carry a negative or oversized tv_nsec, which timerfd_settime rejects.
+    ret.tv_sec += ret.tv_nsec / 1000000000;
+    ret.tv_nsec %= 1000000000;
+    if (ret.tv_nsec < 0) {
+        ret.tv_sec -= 1;
+        ret.tv_nsec += 1000000000;
+    }
+
+    return ret;
+}
+
+static int64_t
+timespec_to_ns(struct timespec ts) {
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static struct timespec
+ns_to_timespec(int64_t ns) {
+    return (struct timespec){
+        .tv_sec = ns / 1000000000,
+        .tv_nsec = ns % 1000000000,
+    };
+}
+
+static struct timespec
+now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now;
+}
+
+static inline bool
+heap_less(struct ww_timer *timer, ssize_t a, ssize_t b) {
+    return timespec_cmp(timer->heap.data[a]->deadline, timer->heap.data[b]->deadline) < 0;
+}
+
+static void
+heap_swap(struct ww_timer *timer, ssize_t a, ssize_t b) {
+    struct ww_timer_entry *tmp = timer->heap.data[a];
+
+    timer->heap.data[a] = timer->heap.data[b];
+    timer->heap.data[b] = tmp;
+
+    timer->heap.data[a]->heap_index = a;
+    timer->heap.data[b]->heap_index = b;
+}
+
+static void
+heap_sift_up(struct ww_timer *timer, ssize_t i) {
+    while (i > 0) {
+        ssize_t parent = (i - 1) / 2;
+        if (!heap_less(timer, i, parent)) {
+            return;
+        }
+
+        heap_swap(timer, i, parent);
+        i = parent;
+    }
+}
+
+static void
+heap_sift_down(struct ww_timer *timer, ssize_t i) {
+    for (;;) {
+        ssize_t left = 2 * i + 1, right = 2 * i + 2, min = i;
+
+        if (left < timer->heap.len && heap_less(timer, left, min)) {
+            min = left;
+        }
+        if (right < timer->heap.len && heap_less(timer, right, min)) {
+            min = right;
+        }
+        if (min == i) {
+            return;
+        }
+
+        heap_swap(timer, i, min);
+        i = min;
+    }
+}
+
+static void
+heap_push(struct ww_timer *timer, struct ww_timer_entry *entry) {
+    ww_assert(entry->heap_index == -1);
+
+    entry->heap_index = timer->heap.len;
+    list_timer_entry_append(&timer->heap, entry);
+    heap_sift_up(timer, entry->heap_index);
+}
+
+static void
+heap_remove(struct ww_timer *timer, struct ww_timer_entry *entry) {
+    ssize_t i = entry->heap_index;
+    ww_assert(i >= 0 && i < timer->heap.len);
+
+    ssize_t last = timer->heap.len - 1;
+    if (i != last) {
+        heap_swap(timer, i, last);
+    }
+
+    timer->heap.len--;
+    entry->heap_index = -1;
+
+    if (i != last) {
+        heap_sift_up(timer, i);
+        heap_sift_down(timer, i);
+    }
+}
+
+static void
+rearm(struct ww_timer *timer) {
+    // Entries added or rescheduled from within a fire callback are picked up once the timer
+    // handler finishes processing expired entries.
+    if (timer->firing) {
+        return;
+    }
+
+    struct timespec deadline = {0};
+    if (timer->heap.len > 0) {
+        deadline = timer->heap.data[0]->deadline;
+
+        // A deadline at or before the start of the clock would either disarm the timerfd or be
+        // rejected by it. Clamp it so that the entry fires immediately instead.
+        if (deadline.tv_sec < 0 || (deadline.tv_sec == 0 && deadline.tv_nsec == 0)) {
+            deadline = (struct timespec){.tv_nsec = 1};
+        }
+    }
+
+    if (timespec_cmp(deadline, timer->armed) == 0) {
+        return;
+    }
+
+    // A zero it_value disarms the timerfd, which is the desired behavior when there are no
+    // scheduled entries.
+    struct itimerspec its = {
+        .it_value = deadline,
+        .it_interval = {0},
+    };
+    if (timerfd_settime(timer->fd, TFD_TIMER_ABSTIME, &its, NULL) != 0) {
+        ww_log_errno(LOG_ERROR, "failed to set timerfd");
+        return;
+    }
+
+    timer->armed = deadline;
+}
+
+static void
+advance_periodic(struct ww_timer_entry *entry, struct timespec current) {
+    // Periodic entries are rescheduled relative to their previous deadline rather than the current
+    // time so that they do not drift. If the event loop was blocked for longer than the interval,
+    // any missed ticks are skipped instead of being fired in a burst.
+    int64_t interval = timespec_to_ns(entry->interval);
+    int64_t deadline = timespec_to_ns(entry->deadline);
+    int64_t behind = timespec_to_ns(current) - deadline;
+
+    deadline += (behind / interval + 1) * interval;
+    entry->deadline = ns_to_timespec(deadline);
+}
+
 static int
 handle_timerfd(int32_t fd, uint32_t mask, void *data) {
-    struct ww_timer_entry *entry = data;
-    entry->fire(entry->data);
+    struct ww_timer *timer = data;
+
+    uint64_t expirations;
+    if (read(timer->fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+        ww_log_errno(LOG_ERROR, "failed to read timerfd");
+    }
+
+    // The timerfd is no longer armed after it has expired.
+    timer->armed = (struct timespec){0};
+    timer->firing = true;
+
+    // Entries are removed from the heap before their fire callback is invoked, since the callback
+    // is free to reschedule or destroy the entry.
+    struct timespec current = now();
+    while (timer->heap.len > 0) {
+        struct ww_timer_entry *entry = timer->heap.data[0];
+        if (timespec_cmp(entry->deadline, current) > 0) {
+            break;
+        }
+
+        heap_remove(timer, entry);
+        if (timespec_to_ns(entry->interval) > 0) {
+            advance_periodic(entry, current);
+            heap_push(timer, entry);
+        }
+
+        entry->fire(entry->data);
+    }
+
+    timer->firing = false;
+    rearm(timer);
 
     return 0;
 }
@@ -22,8 +240,24 @@ ww_timer_create(struct server *server) {
     timer->server = server;
 
     wl_list_init(&timer->entries);
+    timer->heap = list_timer_entry_create();
+
+    timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (timer->fd == -1) {
+        ww_log_errno(LOG_ERROR, "failed to create timerfd");
+        goto fail_timerfd;
+    }
+
+    timer->src = wl_event_loop_add_fd(wl_display_get_event_loop(server->display), timer->fd,
+                                      WL_EVENT_READABLE, handle_timerfd, timer);
+    check_alloc(timer->src);
 
     return timer;
+
+fail_timerfd:
+    list_timer_entry_destroy(&timer->heap);
+    free(timer);
+    return NULL;
 }
 
 void
@@ -34,68 +268,69 @@ ww_timer_destroy(struct ww_timer *timer) {
         ww_timer_entry_destroy(entry);
     }
 
+    wl_event_source_remove(timer->src);
+    close(timer->fd);
+
+    list_timer_entry_destroy(&timer->heap);
     free(timer);
 }
 
 struct ww_timer_entry *
 ww_timer_add_entry(struct ww_timer *timer, struct timespec duration, ww_timer_func_t fire,
                    ww_timer_func_t destroy, void *data) {
-    int timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
-    if (timerfd == -1) {
-        ww_log_errno(LOG_ERROR, "failed to create timerfd");
-        return NULL;
-    }
-
-    struct itimerspec its = {
-        .it_value = duration,
-        .it_interval = {0},
-    };
-    if (timerfd_settime(timerfd, 0, &its, NULL) != 0) {
-        ww_log_errno(LOG_ERROR, "failed to set timerfd");
-        goto fail_settime;
-        return NULL;
-    }
-
     struct ww_timer_entry *entry = zalloc(1, sizeof(*entry));
 
-    entry->src = wl_event_loop_add_fd(wl_display_get_event_loop(timer->server->display), timerfd,
-                                      WL_EVENT_READABLE, handle_timerfd, entry);
-    check_alloc(entry->src);
-
-    entry->fd = timerfd;
+    entry->parent = timer;
+    entry->heap_index = -1;
+    entry->deadline = timespec_add(now(), duration);
     entry->fire = fire;
     entry->destroy = destroy;
     entry->data = data;
 
     wl_list_insert(&timer->entries, &entry->link);
 
-    return entry;
+    heap_push(timer, entry);
+    rearm(timer);
 
-fail_settime:
-    close(timerfd);
-    return NULL;
+    return entry;
 }
 
 void
 ww_timer_entry_destroy(struct ww_timer_entry *entry) {
-    wl_event_source_remove(entry->src);
-    close(entry->fd);
+    struct ww_timer *timer = entry->parent;
+
+    if (entry->heap_index >= 0) {
+        heap_remove(timer, entry);
+        rearm(timer);
+    }
 
     wl_list_remove(&entry->link);
     free(entry);
 }
 
 int
-ww_timer_entry_set_duration(struct ww_timer_entry *entry, struct timespec duration) {
-    struct itimerspec its = {
-        .it_value = duration,
-        .it_interval = {0},
-    };
+ww_timer_entry_set_deadline(struct ww_timer_entry *entry, struct timespec deadline) {
+    struct ww_timer *timer = entry->parent;
 
-    if (timerfd_settime(entry->fd, 0, &its, NULL) != 0) {
-        ww_log_errno(LOG_ERROR, "failed to set timerfd");
-        return -1;
+    entry->deadline = deadline;
+
+    if (entry->heap_index >= 0) {
+        heap_sift_up(timer, entry->heap_index);
+        heap_sift_down(timer, entry->heap_index);
+    } else {
+        heap_push(timer, entry);
     }
 
+    rearm(timer);
     return 0;
 }
+
+int
+ww_timer_entry_set_duration(struct ww_timer_entry *entry, struct timespec duration) {
+    return ww_timer_entry_set_deadline(entry, timespec_add(now(), duration));
+}
+
+void
+ww_timer_entry_set_interval(struct ww_timer_entry *entry, struct timespec interval) {
+    entry->interval = interval;
+}
@@ -0,0 +1,193 @@
+#include "util/cache.h"
+#include "util/alloc.h"
+#include "util/log.h"
+#include "util/prelude.h"
+#include "util/str.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint64_t
+hash_key(const char *key) {
+    // FNV-1a
+    uint64_t hash = 0xCBF29CE484222325;
+    for (const char *c = key; *c; c++) {
+        hash ^= (unsigned char)*c;
+        hash *= 0x100000001B3;
+    }
+    return hash;
+}
+
+static int
+make_dirs(str path) {
+    // Create each directory along the path in turn, similar to `mkdir -p`.
+    for (char *c = path + 1; *c; c++) {
+        if (*c != '/') {
+            continue;
+        }
+
+        *c = '\0';
+        int ret = mkdir(path, 0755);
+        *c = '/';
+
+        if (ret != 0 && errno != EEXIST) {
+            ww_log_errno(LOG_ERROR, "failed to create cache directory '%s'", path);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+str
+util_cache_dir(const char *subdir) {
+    str path = str_new();
+
+    const char *env = getenv("XDG_CACHE_HOME");
+    if (env) {
+        str_append(&path, env);
+        str_append(&path, "/waywall/");
+    } else {
+        env = getenv("HOME");
+        if (!env) {
+            ww_log(LOG_ERROR, "no XDG_CACHE_HOME or HOME environment variables");
+            str_free(path);
+            return NULL;
+        }
+
+        str_append(&path, env);
+        str_append(&path, "/.cache/waywall/");
+    }
+
+    str_append(&path, subdir);
+    str_append(&path, "/");
+
+    if (make_dirs(path) != 0) {
+        str_free(path);
+        return NULL;
+    }
+
+    return path;
+}
+
+str
+util_cache_file(const char *dir, const char *key) {
+    // Unlike util_cache_dir, this does not touch the environment or the filesystem, so it can be
+    // used from any thread.
+    str path = str_new();
+    str_append(&path, dir);
+
+    char name[17];
+    snprintf(name, STATIC_ARRLEN(name), "%016" PRIx64, hash_key(key));
+    str_append(&path, name);
+
+    return path;
+}
+
+str
+util_cache_path(const char *subdir, const char *key) {
+    str dir = util_cache_dir(subdir);
+    if (!dir) {
+        return NULL;
+    }
+
+    str path = util_cache_file(dir, key);
+    str_free(dir);
+    return path;
+}
+
+char *
+util_cache_read(const char *path, size_t *len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno != ENOENT) {
+            ww_log_errno(LOG_WARN, "failed to open cache file '%s'", path);
+        }
+        return NULL;
+    }
+
+    struct stat stat = {0};
+    if (fstat(fd, &stat) != 0) {
+        ww_log_errno(LOG_WARN, "failed to stat cache file '%s'", path);
+        goto fail_stat;
+    }
+
+    char *data = malloc(stat.st_size > 0 ? stat.st_size : 1);
+    check_alloc(data);
+
+    size_t n = 0;
+    while (n < (size_t)stat.st_size) {
+        ssize_t ret = read(fd, data + n, stat.st_size - n);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        } else if (ret <= 0) {
+            ww_log_errno(LOG_WARN, "failed to read cache file '%s'", path);
+            goto fail_read;
+        }
+        n += ret;
+    }
+
+    close(fd);
+
+    *len = n;
+    return data;
+
+fail_read:
+    free(data);
+
+fail_stat:
+    close(fd);
+    return NULL;
+}
+
+int
+util_cache_write(const char *path, const void *data, size_t len) {
+    // Write the cache entry to a temporary file and rename it into place so that readers never
+    // observe a partially written entry.
+    str tmp_path = str_new();
+    str_append(&tmp_path, path);
+    str_append(&tmp_path, ".XXXXXX");
+
+    int fd = mkstemp(tmp_path);
+    if (fd == -1) {
+        ww_log_errno(LOG_WARN, "failed to create cache file '%s'", tmp_path);
+        goto fail_mkstemp;
+    }
+
+    size_t n = 0;
+    while (n < len) {
+        ssize_t ret = write(fd, (const char *)data + n, len - n);
+        if (ret == -1 && errno == EINTR) {
+            continue;
+        } else if (ret == -1) {
+            ww_log_errno(LOG_WARN, "failed to write cache file '%s'", tmp_path);
+            goto fail_write;
+        }
+        n += ret;
+    }
+
+    close(fd);
+
+    if (rename(tmp_path, path) != 0) {
+        ww_log_errno(LOG_WARN, "failed to rename cache file '%s'", tmp_path);
+        unlink(tmp_path);
+        goto fail_mkstemp;
+    }
+
+    str_free(tmp_path);
+    return 0;
+
+fail_write:
+    close(fd);
+    unlink(tmp_path);
+
+fail_mkstemp:
+    str_free(tmp_path);
+    return 1;
+}
@@ -48,6 +48,25 @@ dbg_ui() {
     fprintf(debug_file, "  fullscreen: %s\n", util_debug_data.ui.fullscreen ? "yes" : "no");
 }
 
+static void
+dbg_macro() {
+    fprintf(debug_file, "macro:\n");
+    fprintf(debug_file, "  active:           %d\n", util_debug_data.macro.active);
+    fprintf(debug_file, "  steps:            %" PRIu64 "\n", util_debug_data.macro.steps);
+    fprintf(debug_file, "  last_lateness_us: %" PRIi64 "\n",
+            util_debug_data.macro.last_lateness_us);
+    fprintf(debug_file, "  max_lateness_us:  %" PRIi64 "\n",
+            util_debug_data.macro.max_lateness_us);
+}
+
+static void
+dbg_state() {
+    fprintf(debug_file, "state:\n");
+    fprintf(debug_file, "  events:  %" PRIu64 "\n", util_debug_data.state.events);
+    fprintf(debug_file, "  reads:   %" PRIu64 "\n", util_debug_data.state.reads);
+    fprintf(debug_file, "  changes: %" PRIu64 "\n", util_debug_data.state.changes);
+}
+
 bool
 util_debug_init() {
     debug_file = fmemopen(debug_buf, STATIC_STRLEN(debug_buf), "wb");
@@ -68,6 +87,8 @@ util_debug_str() {
     dbg_keyboard();
     dbg_pointer();
     dbg_ui();
+    dbg_macro();
+    dbg_state();
     fwrite("\0", 1, 1, debug_file);
 
     ww_assert(fflush(debug_file) == 0);
@@ -0,0 +1,453 @@
+#include "util/json.h"
+#include "util/alloc.h"
+#include "util/log.h"
+#include "util/prelude.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * This is a single-pass recursive descent parser. Strings are unescaped into a shared arena and
+ * numbers are validated against the JSON grammar before being handed to strtod.
+ */
+
+struct parser {
+    const char *data;
+    size_t len, pos;
+
+    struct json_doc *doc;
+    int depth;
+
+    const char *error;
+};
+
+static bool parse_value(struct parser *p);
+
+static inline void
+skip_ws(struct parser *p) {
+    while (p->pos < p->len) {
+        char c = p->data[p->pos];
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+            return;
+        }
+        p->pos++;
+    }
+}
+
+static inline bool
+fail(struct parser *p, const char *error) {
+    if (!p->error) {
+        p->error = error;
+    }
+    return false;
+}
+
+static size_t
+push_node(struct parser *p, enum json_type type) {
+    struct json_doc *doc = p->doc;
+
+    if (doc->len == doc->cap) {
+        doc->cap *= 2;
+        doc->nodes = realloc(doc->nodes, sizeof(*doc->nodes) * doc->cap);
+        check_alloc(doc->nodes);
+    }
+
+    doc->nodes[doc->len] = (struct json_node){.type = type};
+    return doc->len++;
+}
+
+static void
+reserve_strings(struct json_doc *doc, size_t n) {
+    if (doc->strings_len + n <= doc->strings_cap) {
+        return;
+    }
+
+    while (doc->strings_len + n > doc->strings_cap) {
+        doc->strings_cap *= 2;
+    }
+    doc->strings = realloc(doc->strings, doc->strings_cap);
+    check_alloc(doc->strings);
+}
+
+static inline int
+hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+static bool
+parse_hex4(struct parser *p, uint32_t *out) {
+    if (p->len - p->pos < 4) {
+        return fail(p, "truncated unicode escape");
+    }
+
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        int digit = hex_value(p->data[p->pos++]);
+        if (digit < 0) {
+            return fail(p, "invalid unicode escape");
+        }
+        value = (value << 4) | digit;
+    }
+
+    *out = value;
+    return true;
+}
+
+static void
+append_utf8(struct json_doc *doc, uint32_t cp) {
+    reserve_strings(doc, 4);
+    char *out = doc->strings + doc->strings_len;
+
+    if (cp < 0x80) {
+        out[0] = cp;
+        doc->strings_len += 1;
+    } else if (cp < 0x800) {
+        out[0] = 0xC0 | (cp >> 6);
+        out[1] = 0x80 | (cp & 0x3F);
+        doc->strings_len += 2;
+    } else if (cp < 0x10000) {
+        out[0] = 0xE0 | (cp >> 12);
+        out[1] = 0x80 | ((cp >> 6) & 0x3F);
+        out[2] = 0x80 | (cp & 0x3F);
+        doc->strings_len += 3;
+    } else {
+        out[0] = 0xF0 | (cp >> 18);
+        out[1] = 0x80 | ((cp >> 12) & 0x3F);
+        out[2] = 0x80 | ((cp >> 6) & 0x3F);
+        out[3] = 0x80 | (cp & 0x3F);
+        doc->strings_len += 4;
+    }
+}
+
+static bool
+parse_escape(struct parser *p) {
+    if (p->pos >= p->len) {
+        return fail(p, "truncated escape sequence");
+    }
+
+    char c = p->data[p->pos++];
+    char out;
+    switch (c) {
+    case '"':
+    case '\\':
+    case '/':
+        out = c;
+        break;
+    case 'b':
+        out = '\b';
+        break;
+    case 'f':
+        out = '\f';
+        break;
+    case 'n':
+        out = '\n';
+        break;
+    case 'r':
+        out = '\r';
+        break;
+    case 't':
+        out = '\t';
+        break;
+    case 'u': {
+        uint32_t cp;
+        if (!parse_hex4(p, &cp)) {
+            return false;
+        }
+
+        // Characters outside of the BMP are encoded as a UTF-16 surrogate pair.
+        if (cp >= 0xD800 && cp <= 0xDBFF) {
+            uint32_t low;
+            if (p->len - p->pos < 2 || p->data[p->pos] != '\\' || p->data[p->pos + 1] != 'u') {
+                return fail(p, "unpaired surrogate");
+            }
+            p->pos += 2;
+            if (!parse_hex4(p, &low)) {
+                return false;
+            }
+            if (low < 0xDC00 || low > 0xDFFF) {
+                return fail(p, "invalid surrogate pair");
+            }
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+        } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+            return fail(p, "unpaired surrogate");
+        }
+
+        append_utf8(p->doc, cp);
+        return true;
+    }
+    default:
+        return fail(p, "invalid escape sequence");
+    }
+
+    reserve_strings(p->doc, 1);
+    p->doc->strings[p->doc->strings_len++] = out;
+    return true;
+}
+
+static bool
+parse_string(struct parser *p) {
+    // The opening quote has already been consumed.
+    struct json_doc *doc = p->doc;
+    size_t idx = push_node(p, JSON_STRING);
+    size_t start = doc->strings_len;
+
+    for (;;) {
+        // Copy runs of unescaped characters in bulk.
+        size_t run = p->pos;
+        while (run < p->len) {
+            unsigned char c = p->data[run];
+            if (c == '"' || c == '\\' || c < 0x20) {
+                break;
+            }
+            run++;
+        }
+
+        size_t n = run - p->pos;
+        if (n > 0) {
+            reserve_strings(doc, n);
+            memcpy(doc->strings + doc->strings_len, p->data + p->pos, n);
+            doc->strings_len += n;
+            p->pos = run;
+        }
+
+        if (p->pos >= p->len) {
+            return fail(p, "unterminated string");
+        }
+
+        char c = p->data[p->pos++];
+        if (c == '"') {
+            break;
+        } else if (c == '\\') {
+            if (!parse_escape(p)) {
+                return false;
+            }
+        } else {
+            return fail(p, "control character in string");
+        }
+    }
+
+    if (doc->strings_len - start > UINT32_MAX || start > UINT32_MAX) {
+        return fail(p, "string too large");
+    }
+
+    doc->nodes[idx].string.offset = start;
+    doc->nodes[idx].string.len = doc->strings_len - start;
+    return true;
+}
+
+static bool
+parse_number(struct parser *p) {
+    size_t start = p->pos;
+
+    // Validate the number against the JSON grammar, which is stricter than strtod.
+    if (p->pos < p->len && p->data[p->pos] == '-') {
+        p->pos++;
+    }
+
+    if (p->pos < p->len && p->data[p->pos] == '0') {
+        p->pos++;
+    } else if (p->pos < p->len && p->data[p->pos] >= '1' && p->data[p->pos] <= '9') {
+        while (p->pos < p->len && p->data[p->pos] >= '0' && p->data[p->pos] <= '9') {
+            p->pos++;
+        }
+    } else {
+        return fail(p, "invalid number");
+    }
+
+    if (p->pos < p->len && p->data[p->pos] == '.') {
+        p->pos++;
+        size_t digits = p->pos;
+        while (p->pos < p->len && p->data[p->pos] >= '0' && p->data[p->pos] <= '9') {
+            p->pos++;
+        }
+        if (p->pos == digits) {
+            return fail(p, "invalid number");
+        }
+    }
+
+    if (p->pos < p->len && (p->data[p->pos] == 'e' || p->data[p->pos] == 'E')) {
+        p->pos++;
+        if (p->pos < p->len && (p->data[p->pos] == '+' || p->data[p->pos] == '-')) {
+            p->pos++;
+        }
+        size_t digits = p->pos;
+        while (p->pos < p->len && p->data[p->pos] >= '0' && p->data[p->pos] <= '9') {
+            p->pos++;
+        }
+        if (p->pos == digits) {
+            return fail(p, "invalid number");
+        }
+    }
+
+    // The input is not NUL-terminated, so the number is copied before being converted.
+    size_t n = p->pos - start;
+    char buf[64];
+    char *str = n < sizeof(buf) ? buf : malloc(n + 1);
+    check_alloc(str);
+
+    memcpy(str, p->data + start, n);
+    str[n] = '\0';
+
+    size_t idx = push_node(p, JSON_NUMBER);
+    p->doc->nodes[idx].number = strtod(str, NULL);
+
+    if (str != buf) {
+        free(str);
+    }
+    return true;
+}
+
+static bool
+parse_literal(struct parser *p, const char *literal, enum json_type type) {
+    size_t n = strlen(literal);
+    if (p->len - p->pos < n || memcmp(p->data + p->pos, literal, n) != 0) {
+        return fail(p, "invalid literal");
+    }
+
+    p->pos += n;
+    push_node(p, type);
+    return true;
+}
+
+static bool
+parse_container(struct parser *p, enum json_type type) {
+    // The opening bracket has already been consumed.
+    if (++p->depth > JSON_MAX_DEPTH) {
+        return fail(p, "nesting too deep");
+    }
+
+    const char close = (type == JSON_ARRAY) ? ']' : '}';
+    size_t idx = push_node(p, type);
+    uint32_t count = 0;
+
+    skip_ws(p);
+    if (p->pos < p->len && p->data[p->pos] == close) {
+        p->pos++;
+        goto done;
+    }
+
+    for (;;) {
+        if (type == JSON_OBJECT) {
+            skip_ws(p);
+            if (p->pos >= p->len || p->data[p->pos] != '"') {
+                return fail(p, "expected object key");
+            }
+            p->pos++;
+            if (!parse_string(p)) {
+                return false;
+            }
+
+            skip_ws(p);
+            if (p->pos >= p->len || p->data[p->pos] != ':') {
+                return fail(p, "expected ':'");
+            }
+            p->pos++;
+        }
+
+        if (!parse_value(p)) {
+            return false;
+        }
+        count++;
+
+        skip_ws(p);
+        if (p->pos >= p->len) {
+            return fail(p, "unterminated container");
+        }
+
+        char c = p->data[p->pos++];
+        if (c == close) {
+            break;
+        } else if (c != ',') {
+            return fail(p, type == JSON_ARRAY ? "expected ',' or ']'" : "expected ',' or '}'");
+        }
+    }
+
+done:
+    p->depth--;
+    p->doc->nodes[idx].container.count = count;
+    p->doc->nodes[idx].container.end = p->doc->len;
+    return true;
+}
+
+static bool
+parse_value(struct parser *p) {
+    skip_ws(p);
+    if (p->pos >= p->len) {
+        return fail(p, "unexpected end of input");
+    }
+
+    switch (p->data[p->pos]) {
+    case '{':
+        p->pos++;
+        return parse_container(p, JSON_OBJECT);
+    case '[':
+        p->pos++;
+        return parse_container(p, JSON_ARRAY);
+    case '"':
+        p->pos++;
+        return parse_string(p);
+    case 't':
+        return parse_literal(p, "true", JSON_TRUE);
+    case 'f':
+        return parse_literal(p, "false", JSON_FALSE);
+    case 'n':
+        return parse_literal(p, "null", JSON_NULL);
+    default:
+        return parse_number(p);
+    }
+}
+
+struct json_doc *
+json_parse(const char *data, size_t len) {
+    struct json_doc *doc = zalloc(1, sizeof(*doc));
+
+    // A rough estimate of the number of nodes avoids most reallocations for typical documents.
+    doc->cap = len / 8 + 16;
+    doc->nodes = zalloc(doc->cap, sizeof(*doc->nodes));
+    doc->strings_cap = len / 2 + 16;
+    doc->strings = zalloc(doc->strings_cap, 1);
+
+    struct parser p = {
+        .data = data,
+        .len = len,
+        .doc = doc,
+    };
+
+    if (!parse_value(&p)) {
+        goto fail;
+    }
+
+    skip_ws(&p);
+    if (p.pos != p.len) {
+        fail(&p, "trailing data after document");
+        goto fail;
+    }
+
+    if (doc->len > UINT32_MAX) {
+        fail(&p, "document too large");
+        goto fail;
+    }
+
+    return doc;
+
+fail:
+    ww_log(LOG_WARN, "failed to parse JSON at offset %zu: %s", p.pos, p.error);
+    json_doc_destroy(doc);
+    return NULL;
+}
+
+void
+json_doc_destroy(struct json_doc *doc) {
+    free(doc->nodes);
+    free(doc->strings);
+    free(doc);
+}
@@ -0,0 +1,194 @@
+#include "util/spsc.h"
+#include "util/alloc.h"
+#include "util/prelude.h"
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * The ring stores pointers in a power-of-two sized array, indexed by free-running head and tail
+ * counters. Only the producer writes `head`, and it publishes each item with a release store so
+ * that the consumer observes the item's contents before the new index.
+ *
+ * With SPSC_DROP_OLDEST, the producer may also advance `tail` to discard the oldest item. Both
+ * threads therefore advance `tail` with a compare-and-swap, and whichever thread wins the swap owns
+ * the item in that slot.
+ */
+
+#define BLOCK_BACKOFF_MIN_NS 1000
+#define BLOCK_BACKOFF_MAX_NS 1000000
+
+static size_t
+round_pow2(size_t n) {
+    size_t ret = 1;
+    while (ret < n) {
+        ret <<= 1;
+    }
+    return ret;
+}
+
+struct spsc_ring *
+spsc_ring_create(size_t capacity, enum spsc_policy policy, spsc_drop_func_t drop) {
+    ww_assert(capacity > 0);
+
+    struct spsc_ring *ring = aligned_alloc(alignof(struct spsc_ring), sizeof(*ring));
+    check_alloc(ring);
+
+    capacity = round_pow2(capacity);
+
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->mask = capacity - 1;
+    ring->policy = policy;
+    ring->drop = drop;
+    ring->slots = zalloc(capacity, sizeof(*ring->slots));
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(&ring->slots[i], NULL);
+    }
+
+    atomic_init(&ring->closed, false);
+    atomic_init(&ring->stats.pushed, 0);
+    atomic_init(&ring->stats.popped, 0);
+    atomic_init(&ring->stats.dropped, 0);
+    atomic_init(&ring->stats.blocked, 0);
+
+    return ring;
+}
+
+void
+spsc_ring_destroy(struct spsc_ring *ring) {
+    // The caller must ensure that neither thread is still using the ring.
+    void *item;
+    while ((item = spsc_ring_pop(ring))) {
+        if (ring->drop) {
+            ring->drop(item);
+        }
+    }
+
+    free(ring->slots);
+    free(ring);
+}
+
+void
+spsc_ring_close(struct spsc_ring *ring) {
+    atomic_store_explicit(&ring->closed, true, memory_order_release);
+}
+
+void *
+spsc_ring_pop(struct spsc_ring *ring) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    for (;;) {
+        size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail == head) {
+            return NULL;
+        }
+
+        void *item = atomic_load_explicit(&ring->slots[tail & ring->mask], memory_order_relaxed);
+
+        // If the producer discarded this item in the meantime, `tail` is reloaded and the next
+        // item is tried instead.
+        if (atomic_compare_exchange_weak_explicit(&ring->tail, &tail, tail + 1,
+                                                  memory_order_acq_rel, memory_order_relaxed)) {
+            atomic_fetch_add_explicit(&ring->stats.popped, 1, memory_order_relaxed);
+            return item;
+        }
+    }
+}
+
+static bool
+drop_oldest(struct spsc_ring *ring, size_t head) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail <= ring->mask) {
+        // The consumer made room in the meantime.
+        return true;
+    }
+
+    void *item = atomic_load_explicit(&ring->slots[tail & ring->mask], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&ring->tail, &tail, tail + 1,
+                                                 memory_order_acq_rel, memory_order_relaxed)) {
+        // The consumer popped the oldest item first, which also made room.
+        return true;
+    }
+
+    atomic_fetch_add_explicit(&ring->stats.dropped, 1, memory_order_relaxed);
+    if (ring->drop) {
+        ring->drop(item);
+    }
+    return true;
+}
+
+static bool
+wait_for_room(struct spsc_ring *ring, size_t head) {
+    long backoff = BLOCK_BACKOFF_MIN_NS;
+    bool counted = false;
+
+    while (head - atomic_load_explicit(&ring->tail, memory_order_acquire) > ring->mask) {
+        if (atomic_load_explicit(&ring->closed, memory_order_acquire)) {
+            return false;
+        }
+
+        if (!counted) {
+            atomic_fetch_add_explicit(&ring->stats.blocked, 1, memory_order_relaxed);
+            counted = true;
+        }
+
+        struct timespec ts = {.tv_sec = 0, .tv_nsec = backoff};
+        nanosleep(&ts, NULL);
+
+        backoff *= 2;
+        if (backoff > BLOCK_BACKOFF_MAX_NS) {
+            backoff = BLOCK_BACKOFF_MAX_NS;
+        }
+    }
+
+    return true;
+}
+
+bool
+spsc_ring_push(struct spsc_ring *ring, void *item) {
+    ww_assert(item);
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head - tail > ring->mask) {
+        bool room = false;
+
+        switch (ring->policy) {
+        case SPSC_DROP_NEWEST:
+            room = false;
+            break;
+        case SPSC_DROP_OLDEST:
+            room = drop_oldest(ring, head);
+            break;
+        case SPSC_BLOCK:
+            room = wait_for_room(ring, head);
+            break;
+        }
+
+        if (!room) {
+            atomic_fetch_add_explicit(&ring->stats.dropped, 1, memory_order_relaxed);
+            return false;
+        }
+    }
+
+    atomic_store_explicit(&ring->slots[head & ring->mask], item, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    atomic_fetch_add_explicit(&ring->stats.pushed, 1, memory_order_relaxed);
+    return true;
+}
+
+struct spsc_stats
+spsc_ring_stats(struct spsc_ring *ring) {
+    return (struct spsc_stats){
+        .pushed = atomic_load_explicit(&ring->stats.pushed, memory_order_relaxed),
+        .popped = atomic_load_explicit(&ring->stats.popped, memory_order_relaxed),
+        .dropped = atomic_load_explicit(&ring->stats.dropped, memory_order_relaxed),
+        .blocked = atomic_load_explicit(&ring->stats.blocked, memory_order_relaxed),
+    };
+}
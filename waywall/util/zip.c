@@ -3,43 +3,69 @@
 #include "util/log.h"
 #include "util/prelude.h"
 #include <fcntl.h>
+#include <inttypes.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <zlib.h>
 
 static const uint32_t MAGIC_EOCD = 0x06054B50;
+static const uint32_t MAGIC_EOCD64 = 0x06064B50;
+static const uint32_t MAGIC_EOCD64_LOCATOR = 0x07064B50;
 static const uint32_t MAGIC_CD = 0x02014B50;
+static const uint32_t MAGIC_LOCAL = 0x04034B50;
+
+static const uint16_t EXTRA_ZIP64 = 0x0001;
+
+static const uint16_t COMPRESSION_STORED = 0;
+static const uint16_t COMPRESSION_DEFLATE = 8;
 
 #define SIZE_EOCD 22
+#define SIZE_EOCD64 56
+#define SIZE_EOCD64_LOCATOR 20
 #define SIZE_CD 46
+#define SIZE_LOCAL 30
 
-struct zip {
-    int fd;
+// The EOCD is followed only by the archive comment, which is at most 65535 bytes long.
+#define MAX_EOCD_SEARCH (SIZE_EOCD + UINT16_MAX)
 
-    struct {
-        char *region;
-        size_t len;
-    } map;
+// Deflate cannot expand data by more than this factor, so entries which claim a larger
+// uncompressed size are rejected before anything is allocated for them.
+#define MAX_DEFLATE_RATIO 1032
 
-    struct zip_eocd {
-        uint32_t signature;
-        uint16_t disk_num;
-        uint16_t disk_cd_start;
-        uint16_t disk_cd_records;
-        uint16_t cd_records;
-        uint32_t cd_size;
-        uint32_t cd_offset;
-        uint16_t comment_len;
-    } __attribute__((packed)) eocd;
+struct zip_eocd {
+    uint32_t signature;
+    uint16_t disk_num;
+    uint16_t disk_cd_start;
+    uint16_t disk_cd_records;
+    uint16_t cd_records;
+    uint32_t cd_size;
+    uint32_t cd_offset;
+    uint16_t comment_len;
+} __attribute__((packed));
 
-    struct {
-        size_t idx;
-        size_t offset;
-        char *filename;
-    } iter;
-};
+struct zip_eocd64_locator {
+    uint32_t signature;
+    uint32_t disk_eocd64;
+    uint64_t eocd64_offset;
+    uint32_t disk_count;
+} __attribute__((packed));
+
+struct zip_eocd64 {
+    uint32_t signature;
+    uint64_t record_size;
+    uint16_t version_made;
+    uint16_t version_extract;
+    uint32_t disk_num;
+    uint32_t disk_cd_start;
+    uint64_t disk_cd_records;
+    uint64_t cd_records;
+    uint64_t cd_size;
+    uint64_t cd_offset;
+} __attribute__((packed));
 
 struct zip_cd {
     uint32_t signature;
@@ -61,119 +87,409 @@ struct zip_cd {
     uint32_t local_header_offset;
 } __attribute__((packed));
 
+struct zip_local {
+    uint32_t signature;
+    uint16_t version_extract;
+    uint16_t flags;
+    uint16_t compression;
+    uint16_t modification_time;
+    uint16_t modification_date;
+    uint32_t crc_uncompressed;
+    uint32_t compressed_size;
+    uint32_t uncompressed_size;
+    uint16_t file_name_len;
+    uint16_t extra_field_len;
+} __attribute__((packed));
+
 static_assert(sizeof(struct zip_eocd) == SIZE_EOCD);
+static_assert(sizeof(struct zip_eocd64) == SIZE_EOCD64);
+static_assert(sizeof(struct zip_eocd64_locator) == SIZE_EOCD64_LOCATOR);
 static_assert(sizeof(struct zip_cd) == SIZE_CD);
+static_assert(sizeof(struct zip_local) == SIZE_LOCAL);
+
+struct zip_entry {
+    const char *name; // null terminated, stored in zip.names
+    size_t name_len;
+    uint32_t hash;
+
+    uint16_t compression;
+    uint64_t compressed_size;
+    uint64_t uncompressed_size;
+    uint64_t local_header_offset;
+};
+
+/*
+ * The central directory is read once when the ZIP file is opened. Every entry is stored in an
+ * array (in central directory order, for `zip_next`) and indexed by name in an open addressing
+ * hash table, so that looking up a file does not require walking the central directory again.
+ */
+struct zip {
+    int fd;
+
+    struct {
+        char *region;
+        size_t len;
+    } map;
+
+    struct {
+        uint64_t records;
+        uint64_t size;
+        uint64_t offset;
+    } cd;
+
+    struct zip_entry *entries;
+    size_t num_entries;
+    char *names;
+
+    uint32_t *table; // indices into entries, UINT32_MAX if empty
+    size_t table_mask;
+
+    size_t iter;
+};
 
 static inline uint32_t
 read32_le(const char *buf) {
-    uint32_t bytes[4] = {buf[0], buf[1], buf[2], buf[3]};
+    uint32_t bytes[4] = {(uint8_t)buf[0], (uint8_t)buf[1], (uint8_t)buf[2], (uint8_t)buf[3]};
     return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (bytes[3] << 24);
 }
 
-static bool
-is_eocd_zip64(struct zip_eocd eocd) {
-    return eocd.cd_offset == 0xFFFFFFFF && eocd.cd_size == 0xFFFFFFFF && eocd.cd_records == 0xFFFF;
+static uint32_t
+hash_name(const char *name, size_t len) {
+    // FNV-1a
+    uint32_t hash = 0x811C9DC5;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 0x01000193;
+    }
+    return hash;
 }
 
-static int
-read_eocd(struct zip *zip) {
-    // Locate the End of Central Directory (EOCD) structure first by reading backwards from the end
-    // of the ZIP file and looking for its signature (MAGIC_EOCD).
-    //
-    // We assume that the first instance of the magic value is the correct one.
-    ssize_t offset = zip->map.len - SIZE_EOCD;
-    bool found = false;
-    for (; offset >= 0; offset--) {
-        uint32_t magic = read32_le(zip->map.region + offset);
-        if (magic == MAGIC_EOCD) {
-            found = true;
+static ssize_t
+find_eocd(struct zip *zip) {
+    if (zip->map.len < SIZE_EOCD) {
+        return -1;
+    }
+
+    // The EOCD signature can also appear inside the archive comment, so the search covers the
+    // entire region which could contain the EOCD. A candidate whose comment ends exactly at the
+    // end of the file is preferred, and otherwise the last candidate is used.
+    size_t start = zip->map.len > MAX_EOCD_SEARCH ? zip->map.len - MAX_EOCD_SEARCH : 0;
+    size_t end = zip->map.len - SIZE_EOCD + 1; // exclusive bound for the signature start
+
+    ssize_t last = -1;
+    const char *region = zip->map.region;
+    const char *cur = region + start;
+    while ((cur = memchr(cur, 'P', (region + end) - cur))) {
+        size_t offset = cur - region;
+        if (read32_le(cur) == MAGIC_EOCD) {
+            struct zip_eocd eocd;
+            memcpy(&eocd, cur, SIZE_EOCD);
+            if (offset + SIZE_EOCD + eocd.comment_len == zip->map.len) {
+                return offset;
+            }
+            last = offset;
+        }
+
+        cur++;
+        if (cur >= region + end) {
             break;
         }
     }
-    if (!found) {
-        ww_log(LOG_ERROR, "failed to find EOCD magic signature");
+
+    return last;
+}
+
+static int
+read_eocd64(struct zip *zip, size_t eocd_offset) {
+    if (eocd_offset < SIZE_EOCD64_LOCATOR) {
+        ww_log(LOG_ERROR, "malformed zip file - missing ZIP64 EOCD locator");
         return 1;
     }
 
-    memcpy(&zip->eocd, zip->map.region + offset, SIZE_EOCD);
+    struct zip_eocd64_locator locator;
+    memcpy(&locator, zip->map.region + eocd_offset - SIZE_EOCD64_LOCATOR, SIZE_EOCD64_LOCATOR);
+    if (locator.signature != MAGIC_EOCD64_LOCATOR) {
+        ww_log(LOG_ERROR, "malformed zip file - missing ZIP64 EOCD locator");
+        return 1;
+    }
 
-    if (is_eocd_zip64(zip->eocd)) {
-        // TODO: Support ZIP64
-        ww_log(LOG_ERROR, "ZIP64 file detected - unsupported");
+    // The ZIP64 EOCD must end before the locator, which cannot underflow since the locator was
+    // checked to fit before the EOCD.
+    size_t locator_offset = eocd_offset - SIZE_EOCD64_LOCATOR;
+    if (locator_offset < SIZE_EOCD64 || locator.eocd64_offset > locator_offset - SIZE_EOCD64) {
+        ww_log(LOG_ERROR, "malformed zip file - ZIP64 EOCD overlaps its locator");
         return 1;
     }
 
-    // Prepare the data in zip->iter for calls to `zip_next`.
-    zip->iter.offset = zip->eocd.cd_offset;
+    struct zip_eocd64 eocd64;
+    memcpy(&eocd64, zip->map.region + locator.eocd64_offset, SIZE_EOCD64);
+    if (eocd64.signature != MAGIC_EOCD64) {
+        ww_log(LOG_ERROR, "failed to find ZIP64 EOCD magic signature");
+        return 1;
+    }
 
+    // The CD is followed by the ZIP64 EOCD.
+    if (eocd64.cd_offset > locator.eocd64_offset ||
+        eocd64.cd_size > locator.eocd64_offset - eocd64.cd_offset) {
+        ww_log(LOG_ERROR, "malformed zip file - CD overlaps the ZIP64 EOCD");
+        return 1;
+    }
+
+    zip->cd.records = eocd64.cd_records;
+    zip->cd.size = eocd64.cd_size;
+    zip->cd.offset = eocd64.cd_offset;
     return 0;
 }
 
-void
-zip_close(struct zip *zip) {
-    close(zip->fd);
-    ww_assert(munmap(zip->map.region, zip->map.len) == 0);
+static int
+read_eocd(struct zip *zip) {
+    ssize_t offset = find_eocd(zip);
+    if (offset == -1) {
+        ww_log(LOG_ERROR, "failed to find EOCD magic signature");
+        return 1;
+    }
+
+    struct zip_eocd eocd;
+    memcpy(&eocd, zip->map.region + offset, SIZE_EOCD);
 
-    if (zip->iter.filename) {
-        free(zip->iter.filename);
+    // Any of these fields may be saturated if the real value is stored in the ZIP64 EOCD.
+    if (eocd.cd_records == 0xFFFF || eocd.cd_size == 0xFFFFFFFF || eocd.cd_offset == 0xFFFFFFFF) {
+        return read_eocd64(zip, offset);
     }
 
-    free(zip);
+    zip->cd.records = eocd.cd_records;
+    zip->cd.size = eocd.cd_size;
+    zip->cd.offset = eocd.cd_offset;
+    return 0;
 }
 
-const char *
-zip_next(struct zip *zip) {
-    if (zip->iter.idx == zip->eocd.cd_records) {
-        return NULL;
+static int
+read_zip64_extra(struct zip_entry *entry, const struct zip_cd *cdr, const char *extra) {
+    // The ZIP64 extra field only contains the values which were saturated in the CD record, in
+    // this order.
+    size_t offset = 0;
+    while (offset + 4 <= cdr->extra_field_len) {
+        uint16_t id, len;
+        memcpy(&id, extra + offset, sizeof(id));
+        memcpy(&len, extra + offset + 2, sizeof(len));
+        offset += 4;
+
+        if (offset + len > cdr->extra_field_len) {
+            break;
+        }
+        if (id != EXTRA_ZIP64) {
+            offset += len;
+            continue;
+        }
+
+        const char *data = extra + offset;
+        size_t data_off = 0;
+
+        uint64_t *fields[] = {
+            cdr->uncompressed_size == 0xFFFFFFFF ? &entry->uncompressed_size : NULL,
+            cdr->compressed_size == 0xFFFFFFFF ? &entry->compressed_size : NULL,
+            cdr->local_header_offset == 0xFFFFFFFF ? &entry->local_header_offset : NULL,
+        };
+        for (size_t i = 0; i < STATIC_ARRLEN(fields); i++) {
+            if (!fields[i]) {
+                continue;
+            }
+            if (data_off + sizeof(uint64_t) > len) {
+                return 1;
+            }
+            memcpy(fields[i], data + data_off, sizeof(uint64_t));
+            data_off += sizeof(uint64_t);
+        }
+
+        return 0;
     }
 
-    if (zip->iter.offset + SIZE_CD >= zip->map.len) {
-        ww_log(LOG_ERROR, "malformed zip file - CD record extends past EOF");
-        goto fail;
+    return 1;
+}
+
+static int
+read_cd(struct zip *zip) {
+    if (zip->cd.offset > zip->map.len || zip->cd.size > zip->map.len - zip->cd.offset) {
+        ww_log(LOG_ERROR, "malformed zip file - CD extends past EOF");
+        return 1;
     }
 
-    // Ensure we are actually reading a Central Directory record by checking for the magic
-    // signature.
-    uint32_t magic = read32_le(zip->map.region + zip->iter.offset);
-    if (magic != MAGIC_CD) {
-        ww_log(LOG_ERROR, "failed to find CD magic signature while reading zip");
-        goto fail;
+    // Every CD record is at least SIZE_CD bytes long, which bounds the number of records before
+    // anything is allocated based on the (untrusted) record count.
+    if (zip->cd.records > zip->cd.size / SIZE_CD || zip->cd.records >= UINT32_MAX) {
+        ww_log(LOG_ERROR, "malformed zip file - too many CD records");
+        return 1;
     }
 
-    struct zip_cd cdr = {0};
-    memcpy(&cdr, zip->map.region + zip->iter.offset, SIZE_CD);
+    zip->num_entries = zip->cd.records;
+    zip->entries = zalloc(zip->num_entries ? zip->num_entries : 1, sizeof(*zip->entries));
+
+    // File names are copied into one buffer so that they can be null terminated. The names take
+    // up less space than the CD itself, so its size is a sufficient bound.
+    zip->names = zalloc(zip->cd.size + 1, 1);
+    size_t names_len = 0;
+
+    size_t table_size = 16;
+    while (table_size < zip->num_entries * 2) {
+        table_size *= 2;
+    }
+    zip->table = malloc(table_size * sizeof(*zip->table));
+    check_alloc(zip->table);
+    memset(zip->table, 0xFF, table_size * sizeof(*zip->table));
+    zip->table_mask = table_size - 1;
+
+    const char *cd = zip->map.region + zip->cd.offset;
+    size_t offset = 0;
+    for (size_t i = 0; i < zip->num_entries; i++) {
+        if (zip->cd.size - offset < SIZE_CD) {
+            ww_log(LOG_ERROR, "malformed zip file - CD record extends past CD");
+            return 1;
+        }
 
-    // Check the full size of the Central Directory record against the size of the ZIP file.
-    size_t record_size = SIZE_CD + cdr.file_name_len + cdr.extra_field_len + cdr.file_comment_len;
-    if (zip->iter.offset + record_size >= zip->map.len) {
-        ww_log(LOG_ERROR, "malformed zip file - CD record extends past EOF");
+        // Ensure we are actually reading a Central Directory record by checking for the magic
+        // signature.
+        if (read32_le(cd + offset) != MAGIC_CD) {
+            ww_log(LOG_ERROR, "failed to find CD magic signature while reading zip");
+            return 1;
+        }
+
+        struct zip_cd cdr;
+        memcpy(&cdr, cd + offset, SIZE_CD);
+
+        size_t record_size =
+            SIZE_CD + cdr.file_name_len + cdr.extra_field_len + cdr.file_comment_len;
+        if (zip->cd.size - offset < record_size) {
+            ww_log(LOG_ERROR, "malformed zip file - CD record extends past CD");
+            return 1;
+        }
+
+        const char *name = cd + offset + SIZE_CD;
+        const char *extra = name + cdr.file_name_len;
+
+        struct zip_entry *entry = &zip->entries[i];
+        entry->name = zip->names + names_len;
+        entry->name_len = cdr.file_name_len;
+        entry->hash = hash_name(name, cdr.file_name_len);
+        entry->compression = cdr.compression;
+        entry->compressed_size = cdr.compressed_size;
+        entry->uncompressed_size = cdr.uncompressed_size;
+        entry->local_header_offset = cdr.local_header_offset;
+
+        memcpy(zip->names + names_len, name, cdr.file_name_len);
+        names_len += cdr.file_name_len + 1;
+
+        bool zip64 = cdr.compressed_size == 0xFFFFFFFF || cdr.uncompressed_size == 0xFFFFFFFF ||
+                     cdr.local_header_offset == 0xFFFFFFFF;
+        if (zip64 && read_zip64_extra(entry, &cdr, extra) != 0) {
+            ww_log(LOG_ERROR, "malformed zip file - missing ZIP64 extra field");
+            return 1;
+        }
+
+        // If an archive contains duplicate names, the first entry wins.
+        size_t slot = entry->hash & zip->table_mask;
+        bool duplicate = false;
+        while (zip->table[slot] != UINT32_MAX) {
+            const struct zip_entry *other = &zip->entries[zip->table[slot]];
+            if (other->hash == entry->hash && other->name_len == entry->name_len &&
+                memcmp(other->name, entry->name, entry->name_len) == 0) {
+                duplicate = true;
+                break;
+            }
+            slot = (slot + 1) & zip->table_mask;
+        }
+        if (!duplicate) {
+            zip->table[slot] = i;
+        }
+
+        offset += record_size;
+    }
+
+    return 0;
+}
+
+static const struct zip_entry *
+find_entry(struct zip *zip, const char *name) {
+    size_t len = strlen(name);
+    uint32_t hash = hash_name(name, len);
+
+    size_t slot = hash & zip->table_mask;
+    while (zip->table[slot] != UINT32_MAX) {
+        const struct zip_entry *entry = &zip->entries[zip->table[slot]];
+        if (entry->hash == hash && entry->name_len == len &&
+            memcmp(entry->name, name, len) == 0) {
+            return entry;
+        }
+        slot = (slot + 1) & zip->table_mask;
+    }
+
+    return NULL;
+}
+
+static int
+inflate_entry(const char *src, size_t src_len, char *dst, size_t dst_len) {
+    z_stream stream = {0};
+
+    // Raw deflate data, without a zlib header.
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK) {
+        ww_log(LOG_ERROR, "failed to initialize zlib stream");
+        return 1;
+    }
+
+    stream.next_in = (Bytef *)src;
+    stream.next_out = (Bytef *)dst;
+
+    // Sizes are checked against what zlib can take in a single call.
+    if (src_len > UINT_MAX || dst_len > UINT_MAX) {
+        ww_log(LOG_ERROR, "zip entry too large to decompress");
         goto fail;
     }
+    stream.avail_in = src_len;
+    stream.avail_out = dst_len;
 
-    // We need to allocate storage for the file name and copy it to our own buffer because it will
-    // not have a null terminator.
-    if (zip->iter.filename) {
-        free(zip->iter.filename);
+    int ret = inflate(&stream, Z_FINISH);
+    if (ret != Z_STREAM_END || stream.total_out != dst_len) {
+        ww_log(LOG_ERROR, "failed to decompress zip entry: %s", stream.msg ? stream.msg : "size");
+        goto fail;
     }
-    zip->iter.filename = zalloc(cdr.file_name_len + 1, 1);
-    memcpy(zip->iter.filename, zip->map.region + zip->iter.offset + SIZE_CD, cdr.file_name_len);
 
-    // Move the iterator forward to the next Central Directory record and return the filename.
-    zip->iter.offset += record_size;
-    zip->iter.idx++;
-    return zip->iter.filename;
+    inflateEnd(&stream);
+    return 0;
 
 fail:
-    // Prevent any further calls to `zip_next` by moving the iterator to the end.
-    zip->iter.idx = zip->eocd.cd_records;
-    return NULL;
+    inflateEnd(&stream);
+    return 1;
+}
+
+void
+zip_close(struct zip *zip) {
+    close(zip->fd);
+    ww_assert(munmap(zip->map.region, zip->map.len) == 0);
+
+    free(zip->entries);
+    free(zip->names);
+    free(zip->table);
+    free(zip);
+}
+
+bool
+zip_contains(struct zip *zip, const char *name) {
+    return find_entry(zip, name) != NULL;
+}
+
+const char *
+zip_next(struct zip *zip) {
+    if (zip->iter == zip->num_entries) {
+        return NULL;
+    }
+
+    return zip->entries[zip->iter++].name;
 }
 
 struct zip *
 zip_open(const char *path) {
     struct zip *zip = zalloc(1, sizeof(*zip));
 
-    zip->fd = open(path, O_RDONLY);
+    zip->fd = open(path, O_RDONLY | O_CLOEXEC);
     if (zip->fd == -1) {
         ww_log_errno(LOG_ERROR, "failed to open zip at '%s'", path);
         goto fail_open;
@@ -184,6 +500,10 @@ zip_open(const char *path) {
         ww_log_errno(LOG_ERROR, "failed to stat zip at '%s'", path);
         goto fail_stat;
     }
+    if (zipstat.st_size == 0) {
+        ww_log(LOG_ERROR, "zip at '%s' is empty", path);
+        goto fail_stat;
+    }
 
     zip->map.len = zipstat.st_size;
     zip->map.region = mmap(NULL, zip->map.len, PROT_READ, MAP_SHARED, zip->fd, 0);
@@ -192,7 +512,7 @@ zip_open(const char *path) {
         goto fail_mmap;
     }
 
-    if (read_eocd(zip) != 0) {
+    if (read_eocd(zip) != 0 || read_cd(zip) != 0) {
         ww_log(LOG_ERROR, "failed to read zip at '%s'", path);
         goto fail_read;
     }
@@ -200,6 +520,9 @@ zip_open(const char *path) {
     return zip;
 
 fail_read:
+    free(zip->entries);
+    free(zip->names);
+    free(zip->table);
     ww_assert(munmap(zip->map.region, zip->map.len) == 0);
 
 fail_mmap:
@@ -210,3 +533,74 @@ fail_open:
     free(zip);
     return NULL;
 }
+
+char *
+zip_read(struct zip *zip, const char *name, size_t *len) {
+    const struct zip_entry *entry = find_entry(zip, name);
+    if (!entry) {
+        return NULL;
+    }
+
+    if (entry->compression != COMPRESSION_STORED && entry->compression != COMPRESSION_DEFLATE) {
+        ww_log(LOG_ERROR, "zip entry '%s' uses unsupported compression method %d", name,
+               (int)entry->compression);
+        return NULL;
+    }
+
+    // The local header repeats the file name and has its own extra field, which may differ in
+    // length from the one in the CD.
+    if (entry->local_header_offset > zip->map.len - SIZE_LOCAL) {
+        ww_log(LOG_ERROR, "malformed zip file - local header extends past EOF");
+        return NULL;
+    }
+
+    struct zip_local local;
+    memcpy(&local, zip->map.region + entry->local_header_offset, SIZE_LOCAL);
+    if (local.signature != MAGIC_LOCAL) {
+        ww_log(LOG_ERROR, "failed to find local header magic signature for '%s'", name);
+        return NULL;
+    }
+
+    uint64_t data_offset =
+        entry->local_header_offset + SIZE_LOCAL + local.file_name_len + local.extra_field_len;
+    if (data_offset > zip->map.len || entry->compressed_size > zip->map.len - data_offset) {
+        ww_log(LOG_ERROR, "malformed zip file - data for '%s' extends past EOF", name);
+        return NULL;
+    }
+
+    // The uncompressed size is untrusted, so it is bounded by the compressed size (which has been
+    // checked against the file size) before being allocated.
+    if (entry->compression == COMPRESSION_STORED &&
+        entry->compressed_size != entry->uncompressed_size) {
+        ww_log(LOG_ERROR, "malformed zip file - stored entry '%s' has mismatched sizes", name);
+        return NULL;
+    }
+    if (entry->uncompressed_size > entry->compressed_size * MAX_DEFLATE_RATIO ||
+        entry->uncompressed_size >= SIZE_MAX) {
+        ww_log(LOG_ERROR, "zip entry '%s' is too large", name);
+        return NULL;
+    }
+
+    const char *src = zip->map.region + data_offset;
+
+    // An extra byte is allocated so that text files can be used as strings.
+    char *data = malloc(entry->uncompressed_size + 1);
+    if (!data) {
+        ww_log(LOG_ERROR, "failed to allocate %" PRIu64 " bytes for zip entry '%s'",
+               entry->uncompressed_size + 1, name);
+        return NULL;
+    }
+
+    if (entry->compression == COMPRESSION_STORED) {
+        memcpy(data, src, entry->uncompressed_size);
+    } else {
+        if (inflate_entry(src, entry->compressed_size, data, entry->uncompressed_size) != 0) {
+            free(data);
+            return NULL;
+        }
+    }
+
+    data[entry->uncompressed_size] = '\0';
+    *len = entry->uncompressed_size;
+    return data;
+}
@@ -1,6 +1,7 @@
 #include "wrap.h"
 #include "config/config.h"
 #include "config/vm.h"
+#include "cpu.h"
 #include "inotify.h"
 #include "instance.h"
 #include "scene.h"
@@ -16,6 +17,7 @@
 #include "subproc.h"
 #include "timer.h"
 #include "util/alloc.h"
+#include "util/debug.h"
 #include "util/log.h"
 #include "util/prelude.h"
 #include "xdg-shell-client-protocol.h"
@@ -23,7 +25,9 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/inotify.h>
+#include <time.h>
 #include <unistd.h>
 #include <wayland-server-core.h>
 #include <wayland-util.h>
@@ -32,6 +36,28 @@
 #define IS_ANCHORED(wrap, view) (wrap->floating.anchored == view)
 #define SHOULD_ANCHOR(wrap) (wrap->cfg->theme.ninb_anchor != ANCHOR_NONE)
 
+// Hidden instances have no surface on the host compositor, so their frame callbacks would never
+// complete if they were forwarded. Unless a different cap is set, they are paced at this rate.
+#define HIDDEN_INSTANCE_FPS 30
+
+/*
+ * Key sequences started from Lua are executed entirely from C. Each step is assigned an absolute
+ * deadline when the sequence is started, and a single timer entry is re-armed to the deadline of
+ * the next pending step. All steps which are due when the timer fires are sent to the Minecraft
+ * instance in one batch.
+ */
+struct wrap_macro {
+    struct wl_list link; // wrap.macros
+    struct wrap *wrap;
+    struct wrap_instance *target;
+
+    struct ww_timer_entry *timer;
+
+    struct syn_key *keys;
+    int64_t *deadlines; // CLOCK_MONOTONIC, in nanoseconds
+    size_t len, next;
+};
+
 static void on_anchored_resize(struct wl_listener *listener, void *data);
 
 struct floating_view {
@@ -202,6 +228,11 @@ floating_view_create(struct wrap *wrap, struct server_view *view) {
     fview->view = view;
     wl_list_insert(&wrap->floating.views, &fview->link);
 
+    pid_t pid = server_view_get_pid(view);
+    if (pid > 0 && wrap->cfg->cpu[CPU_GROUP_HELPERS].enabled) {
+        cpu_apply(pid, &wrap->cfg->cpu[CPU_GROUP_HELPERS]);
+    }
+
     if (wrap->floating.visible) {
         server_view_set_visible(view, true);
     }
@@ -257,12 +288,334 @@ floating_view_destroy(struct wrap *wrap, struct server_view *view) {
     ww_panic("could not find floating view");
 }
 
+static void
+update_scene_instance(struct wrap_instance *winst) {
+    int percent = -1;
+    if (winst->instance) {
+        const struct instance_state *state = &winst->instance->state;
+        if (state->screen == SCREEN_GENERATING || state->screen == SCREEN_PREVIEWING) {
+            percent = state->data.percent;
+        }
+    }
+
+    scene_set_instance(winst->wrap->scene, winst->index, winst->capture, percent);
+}
+
+static void
+apply_cpu_group(struct wrap_instance *winst, bool visible, bool force) {
+    // The default scheduling attributes (all cores, a nice value of 0, and SCHED_OTHER) are used
+    // for groups which are not configured.
+    static const struct config_cpu_group defaults = {.enabled = true};
+
+    struct config *cfg = winst->wrap->cfg;
+
+    int group = winst->cpu_override;
+    if (group == -1) {
+        bool title = winst->instance && winst->instance->state.screen == SCREEN_TITLE;
+        if (title && cfg->cpu[CPU_GROUP_TITLE].enabled) {
+            group = CPU_GROUP_TITLE;
+        } else {
+            group = visible ? CPU_GROUP_ACTIVE : CPU_GROUP_BACKGROUND;
+        }
+    }
+    if (!cfg->cpu[group].enabled) {
+        group = -1;
+    }
+
+    // Instances which have only been in unconfigured groups are left as they are.
+    if (!force && group == winst->cpu_group) {
+        return;
+    }
+
+    pid_t pid = server_view_get_pid(winst->view);
+    if (pid <= 0) {
+        return;
+    }
+
+    cpu_apply(pid, group == -1 ? &defaults : &cfg->cpu[group]);
+    winst->cpu_group = group;
+}
+
+static void
+update_cpu_group(struct wrap_instance *winst, bool visible) {
+    apply_cpu_group(winst, visible, false);
+}
+
+static void
+on_state_idle(void *data) {
+    struct wrap_instance *winst = data;
+    struct wrap *wrap = winst->wrap;
+    winst->state_idle = NULL;
+
+    // Listeners are only notified of actual transitions, which are also recorded in the
+    // instance's history. The "state" event only concerns the active instance.
+    if (instance_state_update(winst->instance)) {
+        wrap->last_transition = winst;
+        update_scene_instance(winst);
+        update_cpu_group(winst, winst == wrap->active);
+
+        config_vm_signal_event(wrap->cfg->vm, "instance_state");
+        if (winst == wrap->active) {
+            config_vm_signal_event(wrap->cfg->vm, "state");
+        }
+    }
+}
+
 static void
 process_state_update(int wd, uint32_t mask, const char *name, void *data) {
-    struct wrap *wrap = data;
+    struct wrap_instance *winst = data;
+
+    winst->instance->stats.events++;
+    WW_DEBUG(state.events, winst->instance->stats.events);
+
+    // The game rewrites the state file for every percentage point while a world is generating, so
+    // many modifications can be queued by the time the inotify fd is read. Only the final contents
+    // matter, so the file is read once after all pending inotify events have been processed.
+    if (!winst->state_idle) {
+        struct wl_event_loop *loop = wl_display_get_event_loop(winst->wrap->server->display);
+        winst->state_idle = wl_event_loop_add_idle(loop, on_state_idle, winst);
+        check_alloc(winst->state_idle);
+    }
+}
+
+static void
+cancel_state_idle(struct wrap_instance *winst) {
+    if (winst->state_idle) {
+        wl_event_source_remove(winst->state_idle);
+        winst->state_idle = NULL;
+    }
+}
+
+static int64_t
+macro_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void
+macro_destroy(struct wrap_macro *macro) {
+    if (macro->timer) {
+        ww_timer_entry_destroy(macro->timer);
+    }
+
+    wl_list_remove(&macro->link);
+    WW_DEBUG(macro.active, wl_list_length(&macro->wrap->macros));
+
+    free(macro->keys);
+    free(macro->deadlines);
+    free(macro);
+}
+
+static void macro_timer_fire(void *data);
+
+static void
+macro_timer_destroy(void *data) {
+    struct wrap_macro *macro = data;
+
+    // This function is called if the timer entry is destroyed (which should only happen if the
+    // global timer manager is destroyed.)
+    macro->timer = NULL;
+}
+
+static void
+macro_run(struct wrap_macro *macro) {
+    int64_t now = macro_now();
+
+    size_t start = macro->next;
+    while (macro->next < macro->len && macro->deadlines[macro->next] <= now) {
+        macro->next++;
+    }
+
+    if (macro->next > start) {
+        server_view_send_keys(macro->target->view, macro->next - start, macro->keys + start);
+
+        if (util_debug_enabled) {
+            int64_t lateness_us = (now - macro->deadlines[start]) / 1000;
 
-    instance_state_update(wrap->instance);
-    config_vm_signal_event(wrap->cfg->vm, "state");
+            util_debug_data.macro.steps += macro->next - start;
+            util_debug_data.macro.last_lateness_us = lateness_us;
+            if (lateness_us > util_debug_data.macro.max_lateness_us) {
+                util_debug_data.macro.max_lateness_us = lateness_us;
+            }
+        }
+    }
+
+    if (macro->next == macro->len) {
+        macro_destroy(macro);
+        return;
+    }
+
+    int64_t deadline = macro->deadlines[macro->next];
+    if (macro->timer) {
+        struct timespec ts = {
+            .tv_sec = deadline / 1000000000,
+            .tv_nsec = deadline % 1000000000,
+        };
+        ww_timer_entry_set_deadline(macro->timer, ts);
+    } else {
+        int64_t delay = deadline - now;
+        struct timespec duration = {
+            .tv_sec = delay / 1000000000,
+            .tv_nsec = delay % 1000000000,
+        };
+
+        macro->timer = ww_timer_add_entry(macro->wrap->timer, duration, macro_timer_fire,
+                                          macro_timer_destroy, macro);
+        if (!macro->timer) {
+            ww_log(LOG_ERROR, "failed to create timer entry for key sequence");
+            macro_destroy(macro);
+        }
+    }
+}
+
+static void
+macro_timer_fire(void *data) {
+    struct wrap_macro *macro = data;
+
+    macro_run(macro);
+}
+
+static bool
+watch_state(struct wrap_instance *winst) {
+    str path = instance_get_state_path(winst->instance);
+
+    winst->instance->state_wd = inotify_subscribe(winst->wrap->inotify, path, IN_MODIFY,
+                                                  process_state_update, winst);
+    str_free(path);
+
+    if (winst->instance->state_wd == -1) {
+        ww_log(LOG_ERROR, "failed to watch instance state");
+        return false;
+    }
+    return true;
+}
+
+static struct wrap_instance *
+wrap_instance_create(struct wrap *wrap, struct server_view *view, char *dir,
+                     struct instance_detect *detect) {
+    struct wrap_instance *winst = zalloc(1, sizeof(*winst));
+
+    winst->wrap = wrap;
+    winst->view = view;
+    winst->dir = dir;
+    winst->detect = detect;
+    winst->capture = server_gl_capture_create(wrap->gl, view->surface);
+    winst->cpu_group = -1;
+    winst->cpu_override = -1;
+
+    // Use the lowest free index so that indices remain small and are reused once an instance
+    // closes. The list is kept sorted by index.
+    winst->index = 1;
+    struct wl_list *prev = &wrap->instances;
+
+    struct wrap_instance *other;
+    wl_list_for_each (other, &wrap->instances, link) {
+        if (other->index != winst->index) {
+            break;
+        }
+        winst->index++;
+        prev = &other->link;
+    }
+    wl_list_insert(prev, &winst->link);
+
+    update_scene_instance(winst);
+
+    return winst;
+}
+
+static void
+wrap_instance_destroy(struct wrap_instance *winst) {
+    struct wrap *wrap = winst->wrap;
+    ww_assert(wrap->active != winst);
+
+    struct wrap_macro *macro, *tmp_macro;
+    wl_list_for_each_safe (macro, tmp_macro, &wrap->macros, link) {
+        if (macro->target == winst) {
+            macro_destroy(macro);
+        }
+    }
+
+    if (winst->detect) {
+        instance_detect_destroy(winst->detect);
+    }
+    if (winst->instance) {
+        cancel_state_idle(winst);
+        if (winst->instance->state_wd != -1) {
+            inotify_unsubscribe(wrap->inotify, winst->instance->state_wd);
+        }
+        instance_destroy(winst->instance);
+    }
+
+    if (wrap->last_transition == winst) {
+        wrap->last_transition = NULL;
+    }
+
+    scene_remove_instance(wrap->scene, winst->index);
+    server_gl_capture_unref(winst->capture);
+
+    wl_list_remove(&winst->link);
+    free(winst->dir);
+    free(winst);
+}
+
+static struct wrap_instance *
+find_instance(struct wrap *wrap, struct server_view *view) {
+    struct wrap_instance *winst;
+    wl_list_for_each (winst, &wrap->instances, link) {
+        if (winst->view == view) {
+            return winst;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+set_active(struct wrap *wrap, struct wrap_instance *winst) {
+    wrap->active = winst;
+    wrap->view = winst ? winst->view : NULL;
+    wrap->instance = winst ? winst->instance : NULL;
+
+    server_gl_set_capture(wrap->gl, winst ? winst->capture : NULL);
+}
+
+static void
+apply_frame_rate(struct wrap_instance *winst, bool visible) {
+    int32_t fps = winst->fps;
+    if (fps == 0 && !visible) {
+        fps = HIDDEN_INSTANCE_FPS;
+    }
+    server_surface_set_frame_rate(winst->view->surface, fps);
+}
+
+static void
+hide_instance(struct wrap *wrap, struct wrap_instance *winst) {
+    // Background instances are kept at the size of the waywall window so that they can be mirrored
+    // consistently.
+    server_view_set_centered(winst->view, true);
+    server_view_set_size(winst->view, wrap->width, wrap->height);
+    server_view_set_visible(winst->view, false);
+    server_view_commit(winst->view);
+
+    apply_frame_rate(winst, false);
+    update_cpu_group(winst, false);
+}
+
+static void
+show_instance(struct wrap *wrap, struct wrap_instance *winst) {
+    server_view_set_centered(winst->view, true);
+    server_view_set_size(winst->view, wrap->active_res.w > 0 ? wrap->active_res.w : wrap->width,
+                         wrap->active_res.h > 0 ? wrap->active_res.h : wrap->height);
+    server_view_set_visible(winst->view, true);
+    server_view_commit(winst->view);
+
+    apply_frame_rate(winst, true);
+    update_cpu_group(winst, true);
+
+    // HACK: This is so that scene objects (images, mirrors, text) appear over the instance. This is
+    // probably not the best spot to do it, though.
+    wl_subsurface_place_below(winst->view->subsurface, winst->view->ui->tree.surface);
 }
 
 static void
@@ -278,9 +631,12 @@ static void
 on_close(struct wl_listener *listener, void *data) {
     struct wrap *wrap = wl_container_of(listener, wrap, on_close);
 
-    // When the view is destroyed, the server event loop will be stopped and waywall will exit.
-    // See `on_view_destroy`.
-    server_view_close(wrap->view);
+    // When the last instance is destroyed, the server event loop will be stopped and waywall will
+    // exit. See `on_view_destroy`.
+    struct wrap_instance *winst, *tmp;
+    wl_list_for_each_safe (winst, tmp, &wrap->instances, link) {
+        server_view_close(winst->view);
+    }
 }
 
 static void
@@ -322,6 +678,14 @@ on_resize(struct wl_listener *listener, void *data) {
         }
     }
 
+    struct wrap_instance *winst;
+    wl_list_for_each (winst, &wrap->instances, link) {
+        if (winst != wrap->active) {
+            server_view_set_size(winst->view, wrap->width, wrap->height);
+            server_view_commit(winst->view);
+        }
+    }
+
     if (SHOULD_ANCHOR(wrap)) {
         floating_update_anchored(wrap);
     }
@@ -332,31 +696,90 @@ on_resize(struct wl_listener *listener, void *data) {
 }
 
 static void
-on_view_create(struct wl_listener *listener, void *data) {
-    struct wrap *wrap = wl_container_of(listener, wrap, on_view_create);
-    struct server_view *view = data;
+on_scene_frame(struct wl_listener *listener, void *data) {
+    struct wrap *wrap = wl_container_of(listener, wrap, on_scene_frame);
 
-    if (wrap->view) {
-        floating_view_create(wrap, view);
+    config_vm_signal_event(wrap->cfg->vm, "frame");
+}
+
+static struct wrap_instance *
+find_instance_by_dir(struct wrap *wrap, const char *dir) {
+    struct wrap_instance *winst;
+    wl_list_for_each (winst, &wrap->instances, link) {
+        if (winst->dir && strcmp(winst->dir, dir) == 0) {
+            return winst;
+        }
+    }
+    return NULL;
+}
+
+static void
+on_instance_detect(struct server_view *view, struct instance *instance, void *data) {
+    struct wrap *wrap = data;
+
+    // Pending detections are cancelled when their instance is destroyed.
+    struct wrap_instance *winst = find_instance(wrap, view);
+    ww_assert(winst);
+
+    winst->detect = NULL;
+    if (!instance) {
+        return;
+    }
+
+    winst->instance = instance;
+    if (!watch_state(winst)) {
+        instance_destroy(winst->instance);
+        winst->instance = NULL;
         return;
     }
 
-    wrap->view = view;
-    wrap->instance = instance_create(view, wrap->inotify);
-    if (wrap->instance) {
-        str path = instance_get_state_path(wrap->instance);
+    if (winst == wrap->active) {
+        wrap->instance = instance;
+    }
+    update_scene_instance(winst);
+    update_cpu_group(winst, winst == wrap->active);
+}
+
+static void
+on_view_create(struct wl_listener *listener, void *data) {
+    struct wrap *wrap = wl_container_of(listener, wrap, on_view_create);
+    struct server_view *view = data;
 
-        wrap->instance->state_wd =
-            inotify_subscribe(wrap->inotify, path, IN_MODIFY, process_state_update, wrap);
-        if (wrap->instance->state_wd == -1) {
-            ww_log(LOG_ERROR, "failed to watch instance state");
-            instance_destroy(wrap->instance);
-            wrap->instance = NULL;
+    // The first view is always treated as the main instance. Later views are only treated as
+    // instances if they are in a game directory, and are otherwise floating windows (e.g.
+    // Ninjabrain Bot.) The game's mods are scanned in the background, and the instance's state is
+    // only watched once state output has been found.
+    //
+    // Programs started with waywall.exec inherit waywall's working directory, which is the game
+    // directory when waywall is used as a wrapper command. Their windows, and any window in the
+    // directory of an existing instance, are therefore never treated as instances.
+    struct wl_event_loop *loop = wl_display_get_event_loop(wrap->server->display);
+    if (wrap->active) {
+        char *dir = NULL;
+        if (!subproc_owns(wrap->subproc, server_view_get_pid(view))) {
+            dir = instance_get_dir(view);
+        }
+
+        struct instance_detect *detect = NULL;
+        if (dir && !find_instance_by_dir(wrap, dir)) {
+            detect = instance_detect_create(view, dir, loop, on_instance_detect, wrap);
+        }
+        if (!detect) {
+            free(dir);
+            floating_view_create(wrap, view);
+            return;
         }
 
-        str_free(path);
+        struct wrap_instance *winst = wrap_instance_create(wrap, view, dir, detect);
+        hide_instance(wrap, winst);
+        return;
     }
 
+    char *dir = instance_get_dir(view);
+    struct instance_detect *detect =
+        dir ? instance_detect_create(view, dir, loop, on_instance_detect, wrap) : NULL;
+    set_active(wrap, wrap_instance_create(wrap, view, dir, detect));
+
     // HACK: This is not ideal. We know that the xdg_toplevel view is created as a result of the
     // xdg_surface role commit event, so the pending buffer will not have been put into the
     // current state yet. I would like to have a better API for this (perhaps change when the
@@ -375,15 +798,7 @@ on_view_create(struct wl_listener *listener, void *data) {
     ww_assert(wrap->width > 0 && wrap->height > 0);
     ww_assert(wrap->view);
 
-    server_view_set_centered(wrap->view, true);
-    server_view_set_visible(wrap->view, true);
-    server_view_commit(wrap->view);
-
-    // HACK: This is so that scene objects (images, mirrors, text) appear over the instance. This is
-    // probably not the best spot to do it, though.
-    wl_subsurface_place_below(wrap->view->subsurface, wrap->view->ui->tree.surface);
-
-    server_gl_set_capture(wrap->gl, view->surface);
+    show_instance(wrap, wrap->active);
 }
 
 static void
@@ -391,18 +806,35 @@ on_view_destroy(struct wl_listener *listener, void *data) {
     struct wrap *wrap = wl_container_of(listener, wrap, on_view_destroy);
     struct server_view *view = data;
 
-    if (wrap->view != view) {
+    struct wrap_instance *winst = find_instance(wrap, view);
+    if (!winst) {
         floating_view_destroy(wrap, view);
         return;
     }
 
-    if (wrap->instance) {
-        inotify_unsubscribe(wrap->inotify, wrap->instance->state_wd);
-        instance_destroy(wrap->instance);
-        wrap->instance = NULL;
+    if (winst != wrap->active) {
+        wrap_instance_destroy(winst);
+        return;
+    }
+
+    // If the active instance closes, switch to another one. waywall only exits once the last
+    // instance has closed.
+    bool had_focus = server_view_has_focus(winst->view);
+
+    set_active(wrap, NULL);
+    wrap_instance_destroy(winst);
+
+    if (!wl_list_empty(&wrap->instances)) {
+        struct wrap_instance *next = wl_container_of(wrap->instances.next, next, link);
+
+        set_active(wrap, next);
+        show_instance(wrap, next);
+        if (had_focus || !wrap->floating.visible) {
+            server_set_input_focus(wrap->server, next->view);
+        }
+        return;
     }
 
-    wrap->view = NULL;
     server_ui_hide(wrap->server->ui);
     server_shutdown(wrap->server);
 }
@@ -556,7 +988,9 @@ wrap_create(struct server *server, struct inotify *inotify, struct ww_timer *tim
     wrap->subproc = subproc_create(server);
     wrap->timer = timer;
 
+    wl_list_init(&wrap->instances);
     wl_list_init(&wrap->floating.views);
+    wl_list_init(&wrap->macros);
 
     config_vm_set_wrap(wrap->cfg->vm, wrap);
 
@@ -572,6 +1006,9 @@ wrap_create(struct server *server, struct inotify *inotify, struct ww_timer *tim
     wrap->on_resize.notify = on_resize;
     wl_signal_add(&server->ui->events.resize, &wrap->on_resize);
 
+    wrap->on_scene_frame.notify = on_scene_frame;
+    wl_signal_add(&wrap->scene->events.frame, &wrap->on_scene_frame);
+
     wrap->on_view_create.notify = on_view_create;
     wl_signal_add(&server->ui->events.view_create, &wrap->on_view_create);
 
@@ -593,10 +1030,19 @@ fail_gl:
 
 void
 wrap_destroy(struct wrap *wrap) {
-    if (wrap->instance) {
-        instance_destroy(wrap->instance);
+    struct wrap_macro *macro, *tmp_macro;
+    wl_list_for_each_safe (macro, tmp_macro, &wrap->macros, link) {
+        macro_destroy(macro);
+    }
+
+    set_active(wrap, NULL);
+
+    struct wrap_instance *winst, *tmp_winst;
+    wl_list_for_each_safe (winst, tmp_winst, &wrap->instances, link) {
+        wrap_instance_destroy(winst);
     }
 
+    wl_list_remove(&wrap->on_scene_frame.link);
     scene_destroy(wrap->scene);
     server_gl_destroy(wrap->gl);
 
@@ -645,17 +1091,43 @@ wrap_set_config(struct wrap *wrap, struct config *cfg) {
         floating_update_anchored(wrap);
     }
 
+    // The CPU groups may have changed, so they need to be applied again. Instances which had a
+    // group applied are reset to the defaults if their group is no longer configured.
+    struct wrap_instance *winst;
+    wl_list_for_each (winst, &wrap->instances, link) {
+        apply_cpu_group(winst, winst == wrap->active, winst->cpu_group != -1);
+    }
+
     return 0;
 }
 
-void
-wrap_lua_exec(struct wrap *wrap, char *cmd[static 64]) {
-    subproc_exec(wrap->subproc, cmd);
+struct wrap_instance *
+wrap_get_instance(struct wrap *wrap, int index) {
+    struct wrap_instance *winst;
+    wl_list_for_each (winst, &wrap->instances, link) {
+        if (winst->index == index) {
+            return winst;
+        }
+    }
+
+    return NULL;
+}
+
+pid_t
+wrap_lua_exec(struct wrap *wrap, char *cmd[static 64], const struct subproc_capture *capture) {
+    pid_t pid = subproc_exec(wrap->subproc, cmd, capture);
+    if (pid > 0 && wrap->cfg->cpu[CPU_GROUP_HELPERS].enabled) {
+        cpu_apply(pid, &wrap->cfg->cpu[CPU_GROUP_HELPERS]);
+    }
+    return pid;
 }
 
 void
-wrap_lua_press_key(struct wrap *wrap, uint32_t keycode) {
-    if (!wrap->view) {
+wrap_lua_press_key(struct wrap *wrap, struct wrap_instance *target, uint32_t keycode) {
+    if (!target) {
+        target = wrap->active;
+    }
+    if (!target) {
         return;
     }
 
@@ -664,7 +1136,39 @@ wrap_lua_press_key(struct wrap *wrap, uint32_t keycode) {
         {keycode, false},
     };
 
-    server_view_send_keys(wrap->view, STATIC_ARRLEN(keys), keys);
+    server_view_send_keys(target->view, STATIC_ARRLEN(keys), keys);
+}
+
+void
+wrap_lua_press_keys(struct wrap *wrap, struct wrap_instance *target, size_t num_steps,
+                    const struct wrap_macro_step steps[static num_steps]) {
+    if (!target) {
+        target = wrap->active;
+    }
+    if (!target || num_steps == 0) {
+        return;
+    }
+
+    struct wrap_macro *macro = zalloc(1, sizeof(*macro));
+    macro->wrap = wrap;
+    macro->target = target;
+    macro->len = num_steps;
+    macro->keys = zalloc(num_steps, sizeof(*macro->keys));
+    macro->deadlines = zalloc(num_steps, sizeof(*macro->deadlines));
+
+    int64_t deadline = macro_now();
+    for (size_t i = 0; i < num_steps; i++) {
+        deadline += (int64_t)steps[i].delay_us * 1000;
+
+        macro->keys[i] = (struct syn_key){steps[i].keycode, steps[i].press};
+        macro->deadlines[i] = deadline;
+    }
+
+    wl_list_insert(&wrap->macros, &macro->link);
+    WW_DEBUG(macro.active, wl_list_length(&wrap->macros));
+
+    // Any leading steps without a delay are sent immediately.
+    macro_run(macro);
 }
 
 int
@@ -691,6 +1195,56 @@ wrap_lua_set_res(struct wrap *wrap, int32_t width, int32_t height) {
     return 0;
 }
 
+int
+wrap_lua_set_active_instance(struct wrap *wrap, struct wrap_instance *target) {
+    if (!wrap->active) {
+        return 1;
+    }
+    if (target == wrap->active) {
+        return 0;
+    }
+
+    struct wrap_instance *prev = wrap->active;
+    bool had_focus = server_view_has_focus(prev->view);
+
+    hide_instance(wrap, prev);
+    set_active(wrap, target);
+    show_instance(wrap, target);
+
+    // Floating windows keep input focus if they had it.
+    if (had_focus) {
+        server_set_input_focus(wrap->server, target->view);
+    }
+
+    return 0;
+}
+
+void
+wrap_lua_set_cpu_group(struct wrap *wrap, struct wrap_instance *target, int group) {
+    if (!target) {
+        target = wrap->active;
+    }
+    if (!target) {
+        return;
+    }
+
+    target->cpu_override = group;
+    update_cpu_group(target, target == wrap->active);
+}
+
+void
+wrap_lua_set_fps(struct wrap *wrap, struct wrap_instance *target, int32_t fps) {
+    if (!target) {
+        target = wrap->active;
+    }
+    if (!target) {
+        return;
+    }
+
+    target->fps = fps;
+    apply_frame_rate(target, target == wrap->active);
+}
+
 void
 wrap_lua_show_floating(struct wrap *wrap, bool show) {
     floating_set_visible(wrap, show);